@@ -0,0 +1,51 @@
+#ifndef ANNOUNCE_SCHEDULER_FUNCTIONS_H
+#define ANNOUNCE_SCHEDULER_FUNCTIONS_H
+
+#include "PeerFunctions.h"
+#include <chrono>
+#include <random>
+#include <set>
+
+// Tunables for spreading announces over time
+struct AnnounceSchedulerConfig {
+    int64_t default_interval_s = 1800;        // Used until a tracker tells us its interval
+    int64_t default_min_interval_s = 60;
+    double jitter_fraction = 0.1;             // Re-announce up to 10% before the interval expires
+    int64_t coalesce_window_ms = 5000;        // Pull same-tracker announces this close together into one batch
+    double max_announces_per_second = 50.0;   // Token bucket that smooths bursts of due announces
+    int64_t retry_base_s = 15;                // First retry delay after a failed announce, doubled per failure
+    int64_t quick_timeout_ms = 3000;          // Bound on a quick round (from the download loop, or at exit)
+};
+
+// Announce bookkeeping for one torrent
+struct TorrentAnnounceState {
+    AnnounceRequest request;                  // Tracker URL, info hash, transfer counters and pending event
+    AnnounceResponse last_response;
+    std::chrono::steady_clock::time_point next_announce;
+    std::chrono::steady_clock::time_point last_announce;
+    int64_t interval_s = 0;
+    int64_t min_interval_s = 0;
+    int failures = 0;
+    bool started_announced = false;
+    bool active = true;
+};
+
+// Announce schedule for many torrents, ordered by due time
+struct AnnounceScheduler {
+    AnnounceSchedulerConfig config;
+    std::vector<TorrentAnnounceState> torrents;
+    std::set<std::pair<std::chrono::steady_clock::time_point, size_t>> queue;
+    double tokens = 0;
+    std::chrono::steady_clock::time_point last_refill;
+    std::mt19937 generator{std::random_device{}()};
+};
+
+size_t add_scheduled_torrent(AnnounceScheduler& scheduler, const AnnounceRequest& request);
+void record_transfer(AnnounceScheduler& scheduler, size_t torrent, int64_t uploaded, int64_t downloaded, int64_t left);
+void mark_torrent_completed(AnnounceScheduler& scheduler, size_t torrent);
+void mark_torrent_stopped(AnnounceScheduler& scheduler, size_t torrent);
+void request_more_peers(AnnounceScheduler& scheduler, size_t torrent);
+std::chrono::milliseconds time_until_next_announce(const AnnounceScheduler& scheduler);
+size_t run_due_announces(AnnounceScheduler& scheduler, bool quick = false);
+
+#endif
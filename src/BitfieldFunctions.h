@@ -0,0 +1,23 @@
+#ifndef BITFIELD_FUNCTIONS_H
+#define BITFIELD_FUNCTIONS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Set of piece indices, one bit per piece packed into 64-bit words. Bits keep the wire order (piece 0 is the
+// most significant bit of word 0), so a bitfield message converts with one byte swap per word. Bits past
+// 'size' are always clear, which lets the word kernels run to the end without masking.
+struct Bitfield {
+    std::vector<uint64_t> words;
+    size_t size = 0;
+};
+
+void init_bitfield(Bitfield& bitfield, size_t size, bool value = false);
+bool bitfield_test(const Bitfield& bitfield, size_t index);
+void bitfield_set(Bitfield& bitfield, size_t index);
+bool bitfield_from_wire(Bitfield& bitfield, const char* data, size_t length, size_t size);
+size_t bitfield_count(const Bitfield& bitfield);
+bool bitfield_any_and_not(const Bitfield& a, const Bitfield& b);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "DownloadPieceFunctions.h"
 
-void complete_file_download(const std::string& peer_ip, int port, const std::string& info_hash, const std::string& peer_id, const std::vector<std::string>& piece_hashes, int piece_length, int file_length, const std::string& download_filename);
+bool complete_file_download(const std::vector<PeerEndpoint>& peers, const std::string& info_hash, const std::string& peer_id, const std::vector<std::string>& piece_hashes, int64_t piece_length, int64_t file_length, const std::string& download_filename,
+                            PeerConnectionPool* pool = nullptr, const DownloadOptions& options = {});
 
-#endif
\ No newline at end of file
+#endif
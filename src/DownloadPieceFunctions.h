@@ -1,15 +1,129 @@
 #ifndef DOWNLOAD_PIECE_FUNCTIONS_H
 #define DOWNLOAD_PIECE_FUNCTIONS_H
 
-#include "HandshakeFunctions.h"
-
-bool handle_bitfield_message(int client_socket);
-bool send_interested_message(int client_socket);
-bool wait_for_unchoke(int client_socket);
-bool handle_preparational_messages(int client_socket);
-bool send_request_message(int client_socket, int piece_index, int block_offset, int block_length);
-bool receive_piece_block(int client_socket, char* piece_buffer, int piece_index, int block_offset, int block_length);
-bool download_piece(int client_socket, int piece_index, int piece_length, const std::string& expected_hash, const std::string& download_filename = "", char* file_buffer = nullptr, int64_t buffer_offset = 0);
-void complete_piece_download(const std::string& ip, int port, const std::string& info_hash, const std::string& peer_id, int piece_index, int piece_length, const std::string& expeceted_hash, const std::string& download_filename, bool download = true);
-
-#endif
\ No newline at end of file
+#include "PeerConnectionFunctions.h"
+#include "IoUringFunctions.h"
+#include "PeerDialerFunctions.h"
+#include "PeerPoolFunctions.h"
+#include "PiecePickerFunctions.h"
+#include "MetadataFunctions.h"
+#include <memory>
+#include <unordered_map>
+
+struct AnnounceScheduler;
+
+enum class PieceState : uint8_t {
+    Unwanted,
+    Missing,
+    Downloading,
+    Complete
+};
+
+// Command-line choices that shape how a download talks to its peers
+struct DownloadOptions {
+    bool prefer_utp = false;       // Dial uTP first, falling back to TCP
+    size_t pipeline_depth = 16;    // Block requests in flight per peer: the starting point, or fixed if not adaptive
+    bool adaptive_pipeline = true; // Resize each peer's pipeline to its rate x request latency
+    size_t min_pipeline_depth = 2;
+    size_t max_pipeline_depth = 500;
+    int endgame_max_requests = 2;  // Peers one block may be requested from at once, once every block is requested
+
+    // Where the caller announces the torrent, if anywhere: due re-announces are sent from the download loop,
+    // and an early one is asked for when few peers are left
+    AnnounceScheduler* trackers = nullptr;
+    std::vector<size_t> tracker_torrents; // The torrent's entries in 'trackers', one per tracker
+};
+
+// Counters summed over every connection of a download
+struct DownloadStats {
+    uint64_t read_calls = 0;
+    uint64_t bytes_received = 0;
+    uint64_t direct_bytes = 0;
+    uint64_t write_calls = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t utp_packets_sent = 0;
+    uint64_t utp_packets_resent = 0;
+    size_t max_requests_outstanding = 0; // Highest number of requests one peer had in flight
+    uint64_t duplicate_bytes = 0;        // Block payloads that arrived after another peer had delivered them
+    uint64_t endgame_requests = 0;       // Requests for blocks already outstanding from another peer
+    uint64_t cancels_sent = 0;
+    uint64_t requests_rejected = 0;      // Fast extension rejects, each re-routed to another peer
+    uint64_t pex_peers_received = 0;     // Peers first heard of through peer exchange
+    uint64_t pex_messages_sent = 0;
+};
+
+// Piece being downloaded. Blocks may arrive in any order and from any peer: one bit per block tells a
+// duplicate apart, and each block counts the connections it is outstanding from (its requesters are found
+// in their own request queues). Only endgame requests a block from more than one connection.
+struct PieceProgress {
+    char* data = nullptr;                       // The piece's slot in download storage
+    std::vector<uint64_t> received;             // Bit per block
+    std::vector<uint8_t> requests;              // Per block, connections with a request for it outstanding or choked
+    int blocks_received = 0;
+    int blocks_unrequested = 0;                 // Neither received nor outstanding from any peer
+};
+
+// Download of some or all pieces of a torrent over any number of peer connections
+struct TorrentDownload {
+    std::string info_hash;
+    std::string peer_id;
+    std::vector<std::string> piece_hashes;
+    int64_t piece_length = 0;
+    int64_t file_length = 0;
+
+    std::vector<PieceState> piece_states;
+    std::unordered_map<int, PieceProgress> pieces_in_progress; // Every piece in the Downloading state
+    Bitfield finished_pieces;            // Complete or unwanted: a peer's pieces AND NOT these are what we need from it
+    PiecePicker picker;                  // Swarm availability and the rarest-first order of the pieces still needed
+    bool interest_stale = false;         // A piece was completed since interest in each peer was last checked
+    std::unique_ptr<char[]> discard_block; // Where a cancelled copy of a block still streaming in is received
+    int pieces_remaining = 0;
+    MetadataDownload metadata;           // Active while a magnet link's info dictionary is fetched, before any piece is known
+    DownloadOptions options;
+
+    // Bytes of the wanted pieces: the mapped output file, or anonymous memory until one is opened
+    char* storage = nullptr;
+    size_t storage_length = 0;
+    int64_t storage_offset = 0;    // File offset of storage[0]
+    bool storage_file_backed = false;
+
+    int64_t downloaded_bytes = 0;  // Block payload bytes received
+    DownloadStats stats;
+    SocketTuningConfig socket_tuning;
+    std::vector<PeerTuningSummary> peer_tuning; // One entry per connection that received anything
+    EventLoop loop;
+    PeerDialer dialer;
+    PeerConnectionPool* pool = nullptr; // Where established connections go when the download finishes, if anywhere
+    IoUringEngine* io_uring = nullptr; // Null when built without io_uring or the kernel lacks it
+    UtpContext* utp = nullptr;         // Opened on the first uTP dial
+
+    // Set once the output file is mapped as storage or streamed to through io_uring
+    int output_fd = -1;
+    std::string output_filename;
+    std::vector<std::unique_ptr<PeerConnection>> connections;
+};
+
+int64_t piece_size(const TorrentDownload& torrent, int piece_index);
+char* piece_storage(TorrentDownload& torrent, int piece_index);
+bool init_torrent_download(TorrentDownload& torrent, const std::string& info_hash, const std::string& peer_id, const std::vector<std::string>& piece_hashes,
+                           int64_t piece_length, int64_t file_length, const std::vector<int>& wanted_pieces = {});
+bool add_peer_connection(TorrentDownload& torrent, const PeerEndpoint& peer, bool over_utp = false);
+void queue_interested_message(PeerConnection& connection);
+void queue_not_interested_message(PeerConnection& connection);
+void queue_request_message(PeerConnection& connection, int piece_index, int block_offset, int block_length);
+void queue_cancel_message(PeerConnection& connection, int piece_index, int block_offset, int block_length);
+void on_peer_handshake(TorrentDownload& torrent, PeerConnection& connection);
+char* piece_block_destination(TorrentDownload& torrent, PeerConnection& connection, uint32_t piece_index, uint32_t block_offset, uint32_t block_length);
+void on_piece_block_received(TorrentDownload& torrent, PeerConnection& connection, uint32_t piece_index, uint32_t block_offset, uint32_t block_length);
+bool peer_message_ignored(uint8_t message_id);
+void handle_peer_message(TorrentDownload& torrent, PeerConnection& connection, uint8_t message_id, const char* payload, uint32_t payload_length);
+bool run_torrent_download(TorrentDownload& torrent);
+void open_torrent_output(TorrentDownload& torrent, const std::string& filename);
+bool save_torrent_download(TorrentDownload& torrent, const std::string& filename);
+void finish_torrent_download(TorrentDownload& torrent);
+void print_download_stats(const TorrentDownload& torrent);
+bool complete_piece_download(const std::vector<PeerEndpoint>& peers, const std::string& info_hash, const std::string& peer_id, const std::vector<std::string>& piece_hashes,
+                             int64_t piece_length, int64_t file_length, int piece_index, const std::string& download_filename,
+                             PeerConnectionPool* pool = nullptr, const DownloadOptions& options = {});
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef EVENT_LOOP_FUNCTIONS_H
+#define EVENT_LOOP_FUNCTIONS_H
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <sys/epoll.h>
+
+using EventHandler = std::function<void(uint32_t events)>;
+
+// Registered descriptor; the token in epoll_event.data tells stale events from a reused fd
+struct EventRegistration {
+    int fd = -1;
+    EventHandler handler;
+};
+
+// Edge-triggered epoll reactor; handlers must drain their descriptor, since no new event comes for data already
+// queued. Drained means EAGAIN, or for a stream socket a read shorter than the space offered: the receive queue was
+// empty then, and anything arriving later raises a fresh edge.
+struct EventLoop {
+    int epoll_fd = -1;
+    uint64_t next_token = 1;
+    std::unordered_map<uint64_t, EventRegistration> registrations;
+    std::unordered_map<int, uint64_t> token_by_fd;
+};
+
+bool set_non_blocking(int fd);
+bool create_event_loop(EventLoop& loop);
+void destroy_event_loop(EventLoop& loop);
+bool event_loop_add(EventLoop& loop, int fd, uint32_t events, EventHandler handler);
+void event_loop_remove(EventLoop& loop, int fd);
+int run_event_loop_once(EventLoop& loop, int timeout_ms);
+
+#endif
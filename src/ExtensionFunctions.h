@@ -0,0 +1,31 @@
+#ifndef EXTENSION_FUNCTIONS_H
+#define EXTENSION_FUNCTIONS_H
+
+#include <cstdint>
+#include <string>
+
+struct PeerConnection;
+
+// IDs we assign to the extension messages we announce; peers send them to us with these IDs
+static const uint8_t UT_PEX_ID = 1;
+static const uint8_t UT_METADATA_ID = 2;
+
+// What a peer announced in its extension protocol handshake (BEP 10)
+struct PeerExtensions {
+    bool supported = false;        // Reserved bit 20 was set in its handshake
+    bool fast = false;             // Fast extension (BEP 6), reserved bit 62: both sides set it
+    bool handshake_received = false;
+    uint32_t request_limit = 0;    // 'reqq': requests it queues before dropping them, 0 if unstated
+    std::string client;            // 'v'
+    uint8_t metadata_id = 0;       // Its ID for ut_metadata (BEP 9), 0 if it doesn't support it
+    uint8_t pex_id = 0;            // Its ID for ut_pex (BEP 11), 0 if it doesn't support it
+    int64_t metadata_size = 0;     // Size of the info dictionary it can send, 0 if unstated
+};
+
+bool peer_supports_extensions(const char* reserved);
+bool peer_supports_fast_extension(const char* reserved);
+void queue_extended_message(PeerConnection& connection, uint8_t extended_id, const std::string& payload);
+void queue_extension_handshake(PeerConnection& connection, uint32_t request_limit);
+bool handle_extension_handshake(PeerConnection& connection, const char* payload, uint32_t payload_length);
+
+#endif
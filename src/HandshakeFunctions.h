@@ -2,22 +2,24 @@
 #define HANDSHAKE_FUNCTIONS_H
 
 #include "InfoFunctions.h"
+#include "PeerFunctions.h"
 #include <cstring>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 
-void split_ip_and_port(const std::string& peer, std::string& ip, int& port);
 ssize_t recv_all(int socket, char* buffer, size_t len);
-int create_socket();
-bool setup_server_address(const std::string& ip, int port, sockaddr_in& server_address);
-bool connect_to_server(int client_socket, const sockaddr_in& server_address);
-int establish_connection(const std::string& ip, int port);
+int create_socket(int family = AF_INET);
+bool connect_to_server(int client_socket, const PeerEndpoint& peer, int timeout_ms = 5000);
+int establish_connection(const PeerEndpoint& peer);
 std::string prepare_handshake_message(const std::string& info_hash, const std::string& peer_id);
 bool send_handshake_message(int client_socket, const std::string& message);
 bool receive_handshake_response(int client_socket, char* response_buffer, size_t buffer_size, bool download);
 bool perform_handshake(int client_socket, const std::string& info_hash, const std::string& peer_id, bool download = false);
-void complete_handshake(const std::string& ip, int port, const std::string& info_hash, const std::string& peer_id, bool download = false);
+void complete_handshake(const PeerEndpoint& peer, const std::string& info_hash, const std::string& peer_id, bool download = false);
 
 
 
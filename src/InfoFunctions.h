@@ -9,6 +9,8 @@
 std::string read_torrent_file(const std::string& filename);
 std::string bencode(const json& obj);
 std::string sha1(const std::string& input);
+std::string sha1(const char* data, size_t length);
+void read_info_dictionary(const json& info_dict, int64_t& file_length, int64_t& piece_length, std::vector<std::string>& pieces_hashes);
 void get_info(const std::string& filename, std::string& tracker_url, int64_t& file_length, std::string& info_hash, int64_t& piece_length, 
                       std::vector<std::string>& pieces_hashes);
 void print_info(const std::string& tracker_url, const int64_t& file_length, const std::string& info_hash, const int64_t& piece_length, 
@@ -0,0 +1,25 @@
+#ifndef IO_URING_FUNCTIONS_H
+#define IO_URING_FUNCTIONS_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct EventLoop;
+struct PeerConnection;
+struct TorrentDownload;
+
+// io_uring socket/disk engine. Only built with -DBITTORRENT_IO_URING=ON (raw kernel ABI); otherwise
+// create_uring_engine returns nullptr and every caller stays on the epoll path.
+struct IoUringEngine;
+
+IoUringEngine* create_uring_engine(EventLoop& loop);
+void destroy_uring_engine(IoUringEngine* engine);
+bool uring_engine_attach_connection(IoUringEngine* engine, PeerConnection& connection);
+void uring_engine_detach_connection(IoUringEngine* engine, PeerConnection& connection);
+void uring_engine_flush_connection(IoUringEngine* engine, PeerConnection& connection);
+bool uring_engine_register_output(IoUringEngine* engine, int file_fd, char* storage, size_t storage_length);
+bool uring_engine_write(IoUringEngine* engine, const char* data, size_t length, int64_t file_offset);
+void uring_engine_submit(IoUringEngine* engine);
+bool uring_engine_wait_writes(IoUringEngine* engine);
+
+#endif
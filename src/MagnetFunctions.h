@@ -0,0 +1,20 @@
+#ifndef MAGNET_FUNCTIONS_H
+#define MAGNET_FUNCTIONS_H
+
+#include "DownloadFileFunctions.h"
+
+// What a magnet link names: the info hash, and where peers may be found
+struct MagnetLink {
+    std::string info_hash;              // Hexadecimal, lower case
+    std::string display_name;           // 'dn', empty if not given
+    std::vector<std::string> trackers;  // 'tr', in the order given
+    std::vector<PeerEndpoint> peers;    // 'x.pe'
+};
+
+bool parse_magnet_link(const std::string& uri, MagnetLink& magnet);
+bool fetch_torrent_metadata(const std::vector<PeerEndpoint>& peers, const std::string& info_hash, const std::string& peer_id, std::string& metadata,
+                            PeerConnectionPool* pool = nullptr, const DownloadOptions& options = {});
+bool complete_magnet_download(const std::vector<PeerEndpoint>& peers, const std::string& info_hash, const std::string& peer_id, const std::string& download_filename,
+                              int64_t& file_length, const DownloadOptions& options = {});
+
+#endif
@@ -4,12 +4,36 @@
 #include "HandshakeFunctions.h"
 #include "DownloadPieceFunctions.h"
 #include "DownloadFileFunctions.h"
+#include "MagnetFunctions.h"
+#include "AnnounceSchedulerFunctions.h"
+#include "ScrapeFunctions.h"
+#include <map>
 
 int main(int argc, char* argv[]) {
     // Flush after every std::cout / std::cerr
     std::cout << std::unitbuf;
     std::cerr << std::unitbuf;
 
+    // Download options may appear anywhere: "--utp" dials peers over uTP first, falling back to TCP,
+    // and "--pipeline-depth N" fixes how many block requests are kept in flight per peer instead of
+    // sizing each peer's pipeline from its measured rate and RTT
+    DownloadOptions options;
+    int kept = 1;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--utp") {
+            options.prefer_utp = true;
+        }
+        else if(arg == "--pipeline-depth" && i + 1 < argc) {
+            options.pipeline_depth = std::max(1, std::stoi(argv[++i]));
+            options.adaptive_pipeline = false;
+        }
+        else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+
     if (argc < 2) {
         std::cerr << "Usage: " << argv[0] << " decode <encoded_value>" << std::endl;
         return 1;
@@ -24,10 +48,8 @@ int main(int argc, char* argv[]) {
     int64_t piece_length;
     std::vector<std::string> pieces_hashes = {};
     int port = 6881;
-    int64_t uploaded = 0;
-    int64_t downloaded = 0;
-    int64_t left = file_length;
     bool compact = true;
+    AnnounceScheduler scheduler;
 
 
     if (command == "decode") {
@@ -58,10 +80,36 @@ int main(int argc, char* argv[]) {
         std::string filename = argv[2];
         get_info(filename, tracker_url, file_length, info_hash, piece_length, pieces_hashes);
 
-        std::vector<std::string> peers = get_peers(tracker_url, info_hash, peer_id, port, uploaded, downloaded, file_length, compact);
+        std::vector<PeerEndpoint> peers = get_peers(tracker_url, info_hash, peer_id, port, 0, 0, file_length, compact);
         
         print_peers(peers);
     }
+    else if(command == "scrape") {
+        if(argc < 3) {
+            std::cerr << "Usage: " << argv[0] << " scrape <torrent_file> [<torrent_file>...]" << std::endl;
+            return 1;
+        }
+
+        // Group the torrents by tracker so each tracker is asked once for all of its info hashes
+        std::map<std::string, std::vector<std::string>> hashes_by_tracker;
+        for(int i = 2; i < argc; ++i) {
+            tracker_url = "";
+            info_hash = "";
+            pieces_hashes.clear();
+            get_info(argv[i], tracker_url, file_length, info_hash, piece_length, pieces_hashes);
+
+            if(!info_hash.empty()) {
+                hashes_by_tracker[tracker_url].push_back(info_hash);
+            }
+        }
+
+        std::vector<ScrapeStats> stats;
+        for(const auto& [tracker, hashes] : hashes_by_tracker) {
+            scrape_tracker(tracker, hashes, stats);
+        }
+
+        print_scrape_stats(stats);
+    }
     else if(command == "handshake") {
         if(argc < 4) {
             std::cerr << "Usage: " << argv[0] << " decode <encoded_value>" << std::endl;
@@ -69,15 +117,14 @@ int main(int argc, char* argv[]) {
         }
 
         std::string filename = argv[2];
-        std::string peer = argv[3];
+        PeerEndpoint peer;
+        if(!parse_peer_endpoint(argv[3], peer)) {
+            return 1;
+        }
 
         get_info(filename, tracker_url, file_length, info_hash, piece_length, pieces_hashes);
 
-        std::string ip;
-        int ip_port;
-        split_ip_and_port(peer, ip, ip_port);
-
-        complete_handshake(ip, ip_port, info_hash, peer_id);
+        complete_handshake(peer, info_hash, peer_id);
     }
     else if(command == "download_piece") {
         if(argc < 6) {
@@ -89,18 +136,48 @@ int main(int argc, char* argv[]) {
         std::string torrent_filename = argv[4];
         get_info(torrent_filename, tracker_url, file_length, info_hash, piece_length, pieces_hashes);
 
-        std::string peer = get_peers(tracker_url, info_hash, peer_id, port, uploaded, downloaded, file_length, compact)[0];
+        AnnounceRequest request;
+        request.tracker_url = tracker_url;
+        request.info_hash = info_hash;
+        request.peer_id = peer_id;
+        request.port = port;
+        request.left = file_length;
+        request.compact = compact;
 
-        std::string ip;
-        int ip_port;
-        split_ip_and_port(peer, ip, ip_port);
+        size_t torrent = add_scheduled_torrent(scheduler, request);
+        run_due_announces(scheduler);
+        options.trackers = &scheduler;
+        options.tracker_torrents = {torrent};
 
-        int piece_index = std::stoi(argv[5]);
+        const std::vector<PeerEndpoint>& peers = scheduler.torrents[torrent].last_response.peers;
+        if(peers.empty()) {
+            std::cerr << "No peers available." << std::endl;
+            return 1;
+        }
+
+        // With several piece indices, piece i goes to '<output>.i' and later pieces reuse the peer connections of earlier ones
+        PeerConnectionPool pool;
+        int64_t downloaded_length = 0;
+        for(int i = 5; i < argc; ++i) {
+            int piece_index = std::stoi(argv[i]);
+            std::string piece_filename = argc == 6 ? download_filename : download_filename + "." + std::to_string(piece_index);
 
-        if(piece_index == file_length / piece_length)
-            piece_length = file_length - (piece_length * piece_index);
+            if(complete_piece_download(peers, info_hash, peer_id, pieces_hashes, piece_length, file_length, piece_index, piece_filename, &pool, options)) {
+                int64_t piece_bytes = std::min(piece_length, file_length - piece_length * piece_index);
+                downloaded_length += piece_bytes;
+                record_transfer(scheduler, torrent, 0, piece_bytes, file_length - downloaded_length);
+            }
+        }
+
+        if(argc > 6) {
+            std::cerr << "Reused " << pool.reused << " pooled peer connections across " << argc - 5 << " pieces" << std::endl;
+        }
+        close_pooled_connections(pool);
 
-        complete_piece_download(ip, ip_port, info_hash, peer_id, piece_index, piece_length, pieces_hashes[piece_index], download_filename);
+        // Announces on the way out are quick rounds, so an unreachable tracker can't hold up the exit
+        // (and a "stopped" that fails is not retried)
+        mark_torrent_stopped(scheduler, torrent);
+        run_due_announces(scheduler, true);
     }
     else if (command == "download") {
         if(argc < 5) {
@@ -112,13 +189,84 @@ int main(int argc, char* argv[]) {
         std::string torrent_filename = argv[4];
         get_info(torrent_filename, tracker_url, file_length, info_hash, piece_length, pieces_hashes);
 
-        std::string peer = get_peers(tracker_url, info_hash, peer_id, port, uploaded, downloaded, file_length, compact)[2];
+        AnnounceRequest request;
+        request.tracker_url = tracker_url;
+        request.info_hash = info_hash;
+        request.peer_id = peer_id;
+        request.port = port;
+        request.left = file_length;
+        request.compact = compact;
 
-        std::string ip;
-        int ip_port;
-        split_ip_and_port(peer, ip, ip_port);
+        size_t torrent = add_scheduled_torrent(scheduler, request);
+        run_due_announces(scheduler);
+        options.trackers = &scheduler;
+        options.tracker_torrents = {torrent};
 
-        complete_file_download(ip, ip_port, info_hash, peer_id, pieces_hashes, piece_length, file_length, download_filename);
+        const std::vector<PeerEndpoint>& peers = scheduler.torrents[torrent].last_response.peers;
+        if(peers.empty()) {
+            std::cerr << "No peers available." << std::endl;
+            return 1;
+        }
+
+        if(complete_file_download(peers, info_hash, peer_id, pieces_hashes, piece_length, file_length, download_filename, nullptr, options)) {
+            record_transfer(scheduler, torrent, 0, file_length, 0);
+            mark_torrent_completed(scheduler, torrent);
+            run_due_announces(scheduler, true);
+        }
+
+        mark_torrent_stopped(scheduler, torrent);
+        run_due_announces(scheduler, true);
+    }
+    else if(command == "magnet") {
+        if(argc < 5) {
+            std::cerr << "Usage: " << argv[0] << " magnet -o <output_file> <magnet_link>" << std::endl;
+            return 1;
+        }
+
+        std::string download_filename = argv[3];
+        MagnetLink magnet;
+        if(!parse_magnet_link(argv[4], magnet)) {
+            return 1;
+        }
+
+        // Ask every tracker the link names; peers it lists itself (x.pe) are tried as well
+        std::vector<size_t> torrents;
+        for(const std::string& tracker : magnet.trackers) {
+            AnnounceRequest request;
+            request.tracker_url = tracker;
+            request.info_hash = magnet.info_hash;
+            request.peer_id = peer_id;
+            request.port = port;
+            request.left = 1; // Unknown until the metadata arrives; anything but 0 keeps us from counting as a seed
+            request.compact = compact;
+            torrents.push_back(add_scheduled_torrent(scheduler, request));
+        }
+        run_due_announces(scheduler);
+        options.trackers = &scheduler;
+        options.tracker_torrents = torrents;
+
+        std::vector<PeerEndpoint> peers = magnet.peers;
+        for(size_t torrent : torrents) {
+            const std::vector<PeerEndpoint>& tracker_peers = scheduler.torrents[torrent].last_response.peers;
+            peers.insert(peers.end(), tracker_peers.begin(), tracker_peers.end());
+        }
+        if(peers.empty()) {
+            std::cerr << "No peers available." << std::endl;
+            return 1;
+        }
+
+        if(complete_magnet_download(peers, magnet.info_hash, peer_id, download_filename, file_length, options)) {
+            for(size_t torrent : torrents) {
+                record_transfer(scheduler, torrent, 0, file_length, 0);
+                mark_torrent_completed(scheduler, torrent);
+            }
+            run_due_announces(scheduler, true);
+        }
+
+        for(size_t torrent : torrents) {
+            mark_torrent_stopped(scheduler, torrent);
+        }
+        run_due_announces(scheduler, true);
     }
     else {
         std::cerr << "unknown command: " << command << std::endl;
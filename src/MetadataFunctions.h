@@ -0,0 +1,34 @@
+#ifndef METADATA_FUNCTIONS_H
+#define METADATA_FUNCTIONS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct TorrentDownload;
+struct PeerConnection;
+
+static const int64_t METADATA_PIECE_SIZE = 16 * 1024;
+static const int64_t MAX_METADATA_SIZE = 16 * 1024 * 1024; // Larger metadata_size claims are ignored
+
+// Info dictionary being fetched over ut_metadata (BEP 9) for a download started from a magnet link. It is split
+// into 16 KiB pieces, each asked of a different peer where possible, and must hash to the info hash once all are in.
+struct MetadataDownload {
+    bool active = false;            // The piece count isn't known yet: messages naming pieces are deferred
+    int64_t size = 0;               // From the first peer stating a metadata_size; 0 until then
+    std::string data;
+    std::vector<uint8_t> received;  // Per piece
+    std::vector<uint8_t> requests;  // Per piece, connections with a request for it unanswered
+    int pieces_remaining = 0;
+    bool complete = false;          // Every piece is in and the whole hashes to the info hash
+    int hash_failures = 0;
+};
+
+bool init_metadata_download(TorrentDownload& torrent, const std::string& info_hash, const std::string& peer_id);
+void on_metadata_peer_handshake(TorrentDownload& torrent, PeerConnection& connection);
+void request_metadata_pieces(TorrentDownload& torrent, PeerConnection& connection);
+void handle_metadata_message(TorrentDownload& torrent, PeerConnection& connection, const char* payload, uint32_t payload_length);
+void release_metadata_requests(TorrentDownload& torrent, PeerConnection& connection);
+bool metadata_download_done(const TorrentDownload& torrent);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef PEER_CONNECTION_FUNCTIONS_H
+#define PEER_CONNECTION_FUNCTIONS_H
+
+#include "HandshakeFunctions.h"
+#include "EventLoopFunctions.h"
+#include "SocketTuningFunctions.h"
+#include "UtpFunctions.h"
+#include "ExtensionFunctions.h"
+#include "PexFunctions.h"
+#include "BitfieldFunctions.h"
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+
+struct TorrentDownload;
+
+enum class PeerConnectionState {
+    Connecting,   // Non-blocking connect() in progress
+    Handshaking,  // Handshake sent, waiting for the peer's 68-byte handshake
+    Active,       // Exchanging length-prefixed peer messages
+    Closed
+};
+
+// Received bytes not yet parsed. Reads land after 'end' and parsed messages advance 'start', so one
+// large recv can frame many messages; only a trailing partial message is ever moved to the front.
+struct PeerReadBuffer {
+    std::unique_ptr<char[]> data;
+    size_t capacity = 0;
+    size_t start = 0;
+    size_t end = 0;
+    size_t skip = 0;               // Bytes of an ignored payload still to be dropped as they arrive
+};
+
+// Piece block whose payload is being received straight into download storage
+struct DirectBlock {
+    char* destination = nullptr;   // Where the next payload byte goes
+    size_t remaining = 0;
+    uint32_t piece_index = 0;
+    uint32_t block_offset = 0;
+    uint32_t block_length = 0;
+};
+
+// Block requested from the peer and not received yet
+struct BlockRequest {
+    uint32_t piece_index = 0;
+    uint32_t block_offset = 0;
+    uint32_t block_length = 0;
+    std::chrono::steady_clock::time_point sent;
+};
+
+// One non-blocking peer connection driven by the event loop
+struct PeerConnection {
+    int socket = -1;
+    PeerEndpoint endpoint;
+    PeerConnectionState state = PeerConnectionState::Connecting;
+    EventLoop* loop = nullptr;
+    TorrentDownload* torrent = nullptr;
+    std::chrono::steady_clock::time_point attempt_deadline; // Must reach Active by then
+    std::chrono::steady_clock::time_point connect_started;
+    std::chrono::steady_clock::time_point handshake_sent;
+
+    PeerReadBuffer inbound;
+    DirectBlock direct_block;
+    std::string outbound;          // Queued messages, serialised back to back and sent together
+    size_t outbound_offset = 0;
+    bool corked = false;
+    bool want_write = false;       // A send hit EAGAIN, so the socket becoming writable should resume it
+
+    uint64_t read_calls = 0;       // recv() calls (or io_uring receive completions)
+    uint64_t bytes_received = 0;
+    uint64_t direct_bytes = 0;     // Payload bytes that skipped the read buffer
+    uint64_t write_calls = 0;      // send() calls (or io_uring sends)
+    uint64_t bytes_sent = 0;
+    SocketTuning tuning;
+
+    std::string remote_peer_id;
+    PeerExtensions extensions;
+    PeerExchange pex;
+    bool peer_choking = true;
+    bool peer_interested = false;
+    bool am_interested = false;
+    Bitfield peer_pieces;                  // From its bitfield and have messages; sized at the handshake
+    uint64_t peer_requests_dropped = 0;    // Its requests; we keep every peer choked, so none are served
+    std::vector<int> allowed_fast;         // Pieces it lets us request while choked (Fast extension)
+    std::deque<int> suggested_pieces;      // Pieces it suggested, most recent last (Fast extension)
+    std::vector<std::pair<uint8_t, std::string>> deferred_messages; // Messages naming pieces, held until the metadata arrives
+    size_t deferred_bytes = 0;             // Their payloads plus overhead, capped so a peer can't grow them without bound
+    std::vector<int> metadata_requests;    // ut_metadata pieces asked of it and not answered yet
+    bool metadata_rejected = false;        // It rejected a ut_metadata request, so it isn't asked again
+
+    // Requests in flight, oldest first; they may span several pieces. New requests are cut from the
+    // unrequested blocks of 'piece_index', and another piece is picked once none are left.
+    std::deque<BlockRequest> requests;
+    int piece_index = -1;
+    size_t max_requests_outstanding = 0;
+
+    size_t request_target = 0;             // Pipeline depth for this peer, resized from its rate x min RTT
+
+    // Set once the socket is handed from epoll to the torrent's io_uring engine
+    bool uses_io_uring = false;
+    uint64_t uring_id = 0;
+
+    // uTP transport instead of a TCP socket; 'utp' is cleared once closed, 'over_utp' stays set
+    UtpSocket* utp = nullptr;
+    bool over_utp = false;
+};
+
+bool start_peer_connection(PeerConnection& connection, EventLoop& loop, const std::string& handshake_message, int receive_buffer = 0);
+bool start_utp_peer_connection(PeerConnection& connection, EventLoop& loop, UtpContext& context, const std::string& handshake_message);
+void handle_peer_connection_events(PeerConnection& connection, uint32_t events);
+void reserve_peer_read_space(PeerReadBuffer& buffer, size_t min_free);
+void append_peer_inbound(PeerConnection& connection, const char* data, size_t length);
+void process_peer_inbound(PeerConnection& connection, bool peer_closed);
+void queue_peer_bytes(PeerConnection& connection, const char* data, size_t length);
+bool flush_peer_connection(PeerConnection& connection);
+void close_peer_connection(PeerConnection& connection, const std::string& reason = "");
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef PEER_DIALER_FUNCTIONS_H
+#define PEER_DIALER_FUNCTIONS_H
+
+#include "PeerFunctions.h"
+#include <chrono>
+#include <deque>
+#include <set>
+
+struct TorrentDownload;
+struct PeerConnection;
+
+struct PeerDialerConfig {
+    int attempt_timeout_ms = 5000;  // Connect plus handshake for one peer
+    int dial_timeout_ms = 30000;    // Give up if no peer has completed a handshake by then
+    size_t max_half_open = 16;      // Connects and handshakes in flight at once
+    size_t max_connections = 30;
+    bool prefer_utp = false;        // Dial uTP first; peers that don't answer it are redialed over TCP
+    int utp_attempt_timeout_ms = 2000;
+};
+
+// Peers waiting to be dialed; the event loop drives the connects, so dead peers only cost their attempt timeout
+struct PeerDialer {
+    PeerDialerConfig config;
+    std::deque<PeerEndpoint> candidates;
+    std::set<PeerKey> known_peers;         // Endpoints already queued, to drop duplicates from trackers and peer exchange
+    std::set<PeerKey> tcp_only;            // Peers whose uTP attempt failed
+    std::chrono::steady_clock::time_point deadline;
+    bool any_handshake = false;
+    int attempts = 0;
+    int failures = 0;
+};
+
+void add_peer_candidates(TorrentDownload& torrent, const std::vector<PeerEndpoint>& peers);
+void dial_peer_candidates(TorrentDownload& torrent);
+bool retry_peer_over_tcp(TorrentDownload& torrent, const PeerConnection& connection);
+void expire_peer_attempts(TorrentDownload& torrent);
+bool peer_dial_deadline_passed(const TorrentDownload& torrent);
+int dial_wait_timeout_ms(const TorrentDownload& torrent, int max_timeout_ms);
+
+#endif
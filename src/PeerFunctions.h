@@ -3,13 +3,82 @@
 
 #include "DecodeFunctions.h"
 #include <sstream>
+#include <array>
 #include <curl/curl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
+// Peer address kept in binary socket-address form from tracker reply to connect()
+struct PeerEndpoint {
+    union {
+        sockaddr generic;
+        sockaddr_in v4;
+        sockaddr_in6 v6;
+    } address;
+
+    int family() const { return address.generic.sa_family; }
+    const sockaddr* sockaddr_ptr() const { return &address.generic; }
+    socklen_t length() const { return family() == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in); }
+};
+
+// Binary identity of an endpoint for sets and map keys: the family, the address (IPv4 in the first 4 bytes) and the port
+struct PeerKey {
+    uint8_t family = 0;
+    std::array<uint8_t, 16> address{};
+    uint16_t port = 0;
+    auto operator<=>(const PeerKey&) const = default;
+};
+
+// Announce events, numbered as in the UDP tracker protocol (BEP 15)
+enum class AnnounceEvent : int32_t {
+    None = 0,
+    Completed = 1,
+    Started = 2,
+    Stopped = 3
+};
+
+// Parameters of a single announce, shared by the HTTP and UDP tracker clients
+struct AnnounceRequest {
+    std::string tracker_url;
+    std::string info_hash; // Hexadecimal info hash
+    std::string peer_id;
+    int port = 6881;
+    int64_t uploaded = 0;
+    int64_t downloaded = 0;
+    int64_t left = 0;
+    AnnounceEvent event = AnnounceEvent::None;
+    int32_t num_want = -1;
+    bool compact = true;
+};
+
+// Tracker reply to an announce
+struct AnnounceResponse {
+    std::vector<PeerEndpoint> peers;
+    int64_t interval = 0;
+    int64_t min_interval = 0;
+    int64_t seeders = -1;
+    int64_t leechers = -1;
+    std::string failure_reason;
+};
+
+// Swarm statistics for one info hash, as returned by a scrape
+struct ScrapeStats {
+    std::array<char, 20> info_hash; // Binary info hash
+    int64_t seeders = -1;           // -1 when the tracker left a counter out
+    int64_t completed = -1;
+    int64_t leechers = -1;
+};
 
 std::string hex_to_binary(const std::string& hex);
 std::string url_encode(const std::string& value);
-static size_t write_callback(void* content, size_t size, size_t nmemb, std::string* response);
-std::vector<std::string> get_peers(const std::string& tracker_url, const std::string info_hash, const std::string& peer_id, int port, int64_t uploaded, 
+size_t write_callback(void* content, size_t size, size_t nmemb, std::string* response);
+bool parse_compact_peers(const char* peers, size_t length, int family, std::vector<PeerEndpoint>& peers_arr);
+bool parse_peer_endpoint(const std::string& peer, PeerEndpoint& endpoint);
+std::string format_peer_endpoint(const PeerEndpoint& endpoint);
+PeerKey make_peer_key(const PeerEndpoint& endpoint);
+bool http_announce(const AnnounceRequest& request, AnnounceResponse& response, long timeout_ms = 0);
+bool announce_to_tracker(const AnnounceRequest& request, AnnounceResponse& response);
+std::vector<PeerEndpoint> get_peers(const std::string& tracker_url, const std::string info_hash, const std::string& peer_id, int port, int64_t uploaded,
                               int64_t downloaded, int64_t left, bool compact);
-void print_peers(const std::vector<std::string>& peers);
-#endif
\ No newline at end of file
+void print_peers(const std::vector<PeerEndpoint>& peers);
+#endif
@@ -0,0 +1,37 @@
+#ifndef PEER_POOL_FUNCTIONS_H
+#define PEER_POOL_FUNCTIONS_H
+
+#include "PeerFunctions.h"
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+struct PeerConnection;
+
+struct PeerConnectionPoolConfig {
+    int idle_timeout_ms = 60000;    // Idle connections older than this are closed instead of reused
+    size_t max_idle = 64;
+};
+
+// Idle connection waiting for the next download of the same torrent
+struct PooledPeerConnection {
+    std::unique_ptr<PeerConnection> connection;
+    std::chrono::steady_clock::time_point released;
+};
+
+// Handshaken connections kept alive between downloads, keyed by (hexadecimal info hash, endpoint),
+// so repeated piece downloads from the same peer skip the connect, handshake and unchoke wait
+struct PeerConnectionPool {
+    PeerConnectionPoolConfig config;
+    std::map<std::pair<std::string, PeerKey>, PooledPeerConnection> idle;
+    int released = 0;
+    int reused = 0;
+};
+
+bool release_pooled_connection(PeerConnectionPool& pool, std::unique_ptr<PeerConnection>& connection);
+std::unique_ptr<PeerConnection> take_pooled_connection(PeerConnectionPool& pool, const std::string& info_hash, const PeerEndpoint& endpoint);
+void close_pooled_connections(PeerConnectionPool& pool);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef PEX_FUNCTIONS_H
+#define PEX_FUNCTIONS_H
+
+#include "PeerFunctions.h"
+#include <chrono>
+#include <map>
+
+struct TorrentDownload;
+struct PeerConnection;
+
+static const int PEX_INTERVAL_S = 60;   // At most one ut_pex message per connection per minute, each way
+static const size_t PEX_MAX_ADDED = 50; // Per address family in one message; the rest wait for the next one
+
+// Peer exchange (ut_pex, BEP 11) with one connection: what it has been told, and when it may next be told or tell us
+struct PeerExchange {
+    std::map<PeerKey, PeerEndpoint> advertised;              // The peers we sent it
+    std::chrono::steady_clock::time_point next_send;
+    std::chrono::steady_clock::time_point next_accepted;     // Messages arriving earlier are ignored
+};
+
+void handle_pex_message(TorrentDownload& torrent, PeerConnection& connection, const char* payload, uint32_t payload_length);
+void send_peer_exchange(TorrentDownload& torrent);
+
+#endif
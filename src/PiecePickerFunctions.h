@@ -0,0 +1,53 @@
+#ifndef PIECE_PICKER_FUNCTIONS_H
+#define PIECE_PICKER_FUNCTIONS_H
+
+#include "BitfieldFunctions.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+static const int PIECE_PRIORITY_LEVELS = 8; // 0: don't download, 4: default, 7: first
+static const uint8_t DEFAULT_PIECE_PRIORITY = 4;
+
+// Pieces of one priority sorted by availability. Pieces of equal availability form a bucket, so a piece
+// moves to the neighbouring bucket with one swap against the bucket's edge and one boundary update.
+struct PickerLevel {
+    std::vector<int> pieces;
+    std::vector<size_t> bucket_start; // bucket_start[a]: first position with availability a; the last entry is pieces.size()
+};
+
+// Rarest-first order over the pieces still to download: highest priority first, then fewest peers.
+// Within a bucket the order is random, so peers that see the same availability don't all pick the same piece.
+struct PiecePicker {
+    std::vector<uint32_t> availability;   // Connected peers that have each piece, listed or not
+    std::vector<uint8_t> priority;
+    std::vector<size_t> position;         // Index within its level's 'pieces', or a marker for unlisted ones
+    std::array<PickerLevel, PIECE_PRIORITY_LEVELS> levels;
+    std::mt19937 random{std::random_device{}()};
+};
+
+void init_piece_picker(PiecePicker& picker, const std::vector<uint8_t>& priorities);
+void piece_picker_increment(PiecePicker& picker, int piece_index);
+void piece_picker_decrement(PiecePicker& picker, int piece_index);
+void piece_picker_add_peer(PiecePicker& picker, const Bitfield& pieces, int delta);
+void piece_picker_remove(PiecePicker& picker, int piece_index);
+
+// Function to find the first piece in picking order that 'eligible' accepts (the peer has it and nobody has started
+// it), or -1. Only peers' pieces are asked about, and those have availability 1 or more, so each level's first bucket
+// is skipped. A template so the check inlines into the walk instead of costing an indirect call per piece.
+template<typename Eligible>
+int piece_picker_pick(const PiecePicker& picker, const Eligible& eligible) {
+    for(int priority = PIECE_PRIORITY_LEVELS - 1; priority > 0; --priority) {
+        const PickerLevel& level = picker.levels[priority];
+        if(level.bucket_start.size() < 2) continue;
+
+        for(size_t position = level.bucket_start[1]; position < level.pieces.size(); ++position) {
+            if(eligible(level.pieces[position])) return level.pieces[position];
+        }
+    }
+    return -1;
+}
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef SCRAPE_FUNCTIONS_H
+#define SCRAPE_FUNCTIONS_H
+
+#include "PeerFunctions.h"
+
+bool scrape_url_from_announce(const std::string& announce_url, std::string& scrape_url);
+bool http_scrape(const std::string& scrape_url, const std::vector<std::string>& info_hashes, std::vector<ScrapeStats>& stats);
+bool scrape_tracker(const std::string& announce_url, const std::vector<std::string>& info_hashes, std::vector<ScrapeStats>& stats);
+void print_scrape_stats(const std::vector<ScrapeStats>& stats);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef SOCKET_TUNING_FUNCTIONS_H
+#define SOCKET_TUNING_FUNCTIONS_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct PeerConnection;
+
+struct SocketTuningConfig {
+    int max_buffer = 8 * 1024 * 1024;       // Per socket
+    int64_t total_buffer_limit = 64 * 1024 * 1024; // Receive buffers set at connect, summed over a download
+    int min_notsent_lowat = 16 * 1024;
+    int retune_interval_ms = 500;
+};
+
+// Per-connection measurements and the buffer sizes chosen from them (0 until first read back)
+struct SocketTuning {
+    double min_rtt_ms = 0;                  // Lowest of the connect and request-to-block samples
+    double receive_rate = 0;                // Bytes per second, smoothed
+    std::chrono::steady_clock::time_point last_tune;
+    uint64_t last_tune_bytes = 0;
+
+    int receive_buffer = 0;
+    int send_buffer = 0;
+    int notsent_lowat = 0;
+};
+
+// What's kept of a connection's tuning once it's gone, for the download summary
+struct PeerTuningSummary {
+    std::string endpoint;
+    double min_rtt_ms = 0;
+    double receive_rate = 0;
+    int receive_buffer = 0;
+    int send_buffer = 0;
+    int notsent_lowat = 0;
+    uint64_t bytes_received = 0;
+    size_t request_target = 0;
+};
+
+void record_rtt_sample(SocketTuning& tuning, double rtt_ms);
+void read_socket_buffers(int socket, SocketTuning& tuning);
+int choose_connect_receive_buffer(const SocketTuningConfig& config, const std::vector<std::unique_ptr<PeerConnection>>& connections);
+void set_connect_receive_buffer(int socket, int receive_buffer);
+void tune_socket_buffers(const SocketTuningConfig& config, std::vector<std::unique_ptr<PeerConnection>>& connections);
+PeerTuningSummary summarize_socket_tuning(const PeerConnection& connection);
+void print_peer_tuning(const std::vector<PeerTuningSummary>& peers);
+
+#endif
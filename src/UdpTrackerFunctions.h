@@ -0,0 +1,38 @@
+#ifndef UDP_TRACKER_FUNCTIONS_H
+#define UDP_TRACKER_FUNCTIONS_H
+
+#include "PeerFunctions.h"
+#include <chrono>
+#include <unordered_map>
+#include <sys/socket.h>
+
+// Retransmission settings; BEP 15 waits 15 * 2^n seconds and gives up after n = 8
+struct UdpTrackerConfig {
+    int base_timeout_ms = 15000;
+    int max_retransmits = 8;
+    int connection_id_lifetime_s = 60;
+};
+
+// One connect-then-request exchange driven by run_udp_tracker_batch
+struct UdpTrackerJob {
+    std::string tracker_url;
+    int32_t action = 0;      // 1 = announce, 2 = scrape
+    std::string body;        // Request bytes following connection_id, action and transaction_id
+    std::string reply;       // Response bytes following action and transaction_id
+    std::string error;
+    int family = AF_INET;    // Address family of the tracker, which decides the compact peer size
+    bool done = false;
+    bool success = false;
+};
+
+UdpTrackerConfig& udp_tracker_config();
+bool parse_udp_tracker_url(const std::string& url, std::string& host, std::string& port);
+void run_udp_tracker_batch(std::vector<UdpTrackerJob>& jobs, const UdpTrackerConfig& config = udp_tracker_config());
+std::string build_udp_announce_body(const AnnounceRequest& request);
+bool parse_udp_announce_reply(const std::string& reply, int family, AnnounceResponse& response);
+bool udp_announce(const AnnounceRequest& request, AnnounceResponse& response);
+std::vector<bool> udp_announce_batch(const std::vector<AnnounceRequest>& requests, std::vector<AnnounceResponse>& responses,
+                                     const UdpTrackerConfig& config = udp_tracker_config());
+bool udp_scrape(const std::string& tracker_url, const std::vector<std::string>& info_hashes, std::vector<ScrapeStats>& stats);
+
+#endif
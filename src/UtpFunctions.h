@@ -0,0 +1,130 @@
+#ifndef UTP_FUNCTIONS_H
+#define UTP_FUNCTIONS_H
+
+#include "PeerFunctions.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+
+struct EventLoop;
+struct UtpContext;
+
+struct UtpConfig {
+    uint32_t target_delay_us = 100000;      // LEDBAT target for the queuing delay our packets see
+    uint32_t max_window_increase = 3000;    // Bytes per RTT at zero queuing delay (MAX_CWND_INCREASE_BYTES_PER_RTT)
+    uint32_t receive_window = 1024 * 1024;  // Out-of-order bytes we buffer, advertised in every packet
+    size_t min_datagram = 576 - 28;         // The path MTU search runs between these UDP payload sizes
+    size_t max_datagram = 1500 - 28;
+    int min_timeout_ms = 500;
+    int max_timeouts = 6;                   // Consecutive retransmission timeouts before the connection fails
+};
+
+enum class UtpState {
+    SynSent,
+    Connected,
+    FinSent,                                // Closed by us; waiting for the FIN to be acknowledged
+    Closed
+};
+
+// Sent packet kept until acknowledged; the header is rewritten on every transmission
+struct UtpPacket {
+    std::string datagram;
+    uint16_t seq_nr = 0;
+    std::chrono::steady_clock::time_point sent;
+    int transmissions = 0;
+    bool sacked = false;       // Selectively acknowledged, but something before it is still missing
+    bool need_resend = false;
+    bool mtu_probe = false;
+};
+
+// One uTP connection multiplexed over the context's UDP socket
+struct UtpSocket {
+    UtpContext* context = nullptr;
+    PeerEndpoint remote;                    // In the context socket's address family
+    UtpState state = UtpState::SynSent;
+    uint16_t recv_id = 0;
+    uint16_t send_id = 0;
+    uint16_t seq_nr = 1;                    // Next sequence number we send
+    uint16_t ack_nr = 0;                    // Last sequence number received in order
+
+    std::deque<UtpPacket> outgoing;         // Unacknowledged packets in sequence order
+    std::string send_pending;               // Written but not yet packetised because the window is full
+    size_t bytes_in_flight = 0;
+
+    std::map<uint16_t, std::string> reorder; // Packets received past a gap, by sequence number
+    size_t reorder_bytes = 0;
+    bool fin_received = false;
+    uint16_t eof_seq = 0;
+    bool need_ack = false;
+
+    // LEDBAT congestion control
+    double max_window = 0;
+    double slow_start_threshold = 0;
+    bool slow_start = true;
+    uint32_t peer_window = 0;
+    uint32_t reply_micro = 0;               // Our receive time minus the peer's send time, echoed back
+    std::array<uint32_t, 2> base_delay = {UINT32_MAX, UINT32_MAX}; // Minimum delay in this and the previous minute
+    std::chrono::steady_clock::time_point base_delay_rotated;
+    uint32_t our_delay_us = 0;
+    uint16_t loss_recovery_seq = 0;         // No further window cut until this is acknowledged
+    uint16_t last_ack_received = 0;
+    int duplicate_acks = 0;
+
+    double rtt_ms = 0;
+    double rtt_var_ms = 0;
+    int timeout_ms = 1000;
+    std::chrono::steady_clock::time_point timeout_deadline;
+    int timeouts = 0;
+
+    // Path MTU search: datagrams up to 'mtu_floor' are known to get through, above 'mtu_ceiling' they don't
+    size_t mtu_floor = 0;
+    size_t mtu_ceiling = 0;
+    size_t mtu_probe_size = 0;              // Size of the probe in flight, 0 if none
+    uint16_t mtu_probe_seq = 0;
+
+    std::function<void()> on_connect;
+    std::function<void(const char* data, size_t length)> on_data;
+    std::function<void(const std::string& reason)> on_close; // Empty reason: the peer finished sending
+};
+
+// Key of a connection: the remote address (IPv4 as v4-mapped IPv6) and our receive connection ID
+struct UtpKey {
+    std::array<uint8_t, 16> address;
+    uint16_t port = 0;
+    uint16_t connection_id = 0;
+    auto operator<=>(const UtpKey&) const = default;
+};
+
+// UDP socket pair carrying every uTP connection of a download
+struct UtpContext {
+    int socket = -1;                        // DF set: probes and normal traffic
+    int fragment_socket = -1;               // Same port, fragmentation allowed: packets found too big for the path
+    int family = AF_INET6;                  // Dual-stack where the host allows it
+    EventLoop* loop = nullptr;
+    UtpConfig config;
+    std::map<UtpKey, std::unique_ptr<UtpSocket>> sockets;
+    std::function<void(UtpSocket& socket)> on_accept; // Set to accept incoming connections
+    std::mt19937 random{std::random_device{}()};
+    std::unique_ptr<uint8_t[]> receive_buffer; // recvmmsg batch, allocated on first use
+
+    uint64_t packets_sent = 0;
+    uint64_t packets_resent = 0;
+    uint64_t packets_received = 0;
+};
+
+UtpContext* create_utp_context(EventLoop& loop, int port = 0);
+void destroy_utp_context(UtpContext* context);
+int utp_context_port(const UtpContext& context);
+UtpSocket* utp_connect(UtpContext& context, const PeerEndpoint& endpoint);
+void utp_write(UtpSocket& socket, const char* data, size_t length);
+void utp_close(UtpSocket& socket);
+void utp_context_tick(UtpContext& context);
+int utp_context_timeout_ms(const UtpContext& context, int max_timeout_ms);
+
+#endif
@@ -0,0 +1,222 @@
+#include "AnnounceSchedulerFunctions.h"
+#include "UdpTrackerFunctions.h"
+#include <algorithm>
+#include <unordered_set>
+
+using announce_clock = std::chrono::steady_clock;
+
+// Helper function to (re)queue a torrent at the given time
+static void schedule_announce(AnnounceScheduler& scheduler, size_t torrent, announce_clock::time_point when) {
+    TorrentAnnounceState& state = scheduler.torrents[torrent];
+    scheduler.queue.erase({state.next_announce, torrent});
+    state.next_announce = when;
+    scheduler.queue.insert({when, torrent});
+}
+
+// Helper function to pick the next regular announce time: the tracker interval shortened by a random jitter,
+// but never earlier than the tracker's minimum interval
+static announce_clock::time_point jittered_announce_time(AnnounceScheduler& scheduler, const TorrentAnnounceState& state, announce_clock::time_point now) {
+    std::uniform_real_distribution<double> jitter(1.0 - scheduler.config.jitter_fraction, 1.0);
+    int64_t delay_ms = static_cast<int64_t>(state.interval_s * 1000 * jitter(scheduler.generator));
+    delay_ms = std::max(delay_ms, state.min_interval_s * 1000);
+
+    return now + std::chrono::milliseconds(delay_ms);
+}
+
+// Function to register a torrent; its "started" announce is due immediately
+size_t add_scheduled_torrent(AnnounceScheduler& scheduler, const AnnounceRequest& request) {
+    TorrentAnnounceState state;
+    state.request = request;
+    state.request.event = AnnounceEvent::Started;
+    state.interval_s = scheduler.config.default_interval_s;
+    state.min_interval_s = scheduler.config.default_min_interval_s;
+
+    if(scheduler.torrents.empty()) {
+        scheduler.tokens = scheduler.config.max_announces_per_second;
+        scheduler.last_refill = announce_clock::now();
+    }
+
+    scheduler.torrents.push_back(state);
+    size_t torrent = scheduler.torrents.size() - 1;
+
+    scheduler.torrents[torrent].next_announce = announce_clock::now();
+    scheduler.queue.insert({scheduler.torrents[torrent].next_announce, torrent});
+
+    return torrent;
+}
+
+// Function to add transferred bytes to a torrent's counters and update the bytes still missing
+void record_transfer(AnnounceScheduler& scheduler, size_t torrent, int64_t uploaded, int64_t downloaded, int64_t left) {
+    AnnounceRequest& request = scheduler.torrents[torrent].request;
+    request.uploaded += uploaded;
+    request.downloaded += downloaded;
+    request.left = left;
+}
+
+// Function to queue the "completed" event; events are sent without waiting for the interval
+void mark_torrent_completed(AnnounceScheduler& scheduler, size_t torrent) {
+    TorrentAnnounceState& state = scheduler.torrents[torrent];
+    if(!state.active || state.request.event == AnnounceEvent::Stopped) return;
+
+    state.request.left = 0;
+    if(state.request.event == AnnounceEvent::None) {
+        state.request.event = AnnounceEvent::Completed;
+        schedule_announce(scheduler, torrent, announce_clock::now());
+    }
+}
+
+// Function to queue the "stopped" event; the torrent leaves the schedule once it is sent
+void mark_torrent_stopped(AnnounceScheduler& scheduler, size_t torrent) {
+    TorrentAnnounceState& state = scheduler.torrents[torrent];
+    if(!state.active) return;
+
+    if(!state.started_announced) {
+        // The tracker never heard of us, so there is nothing to stop
+        scheduler.queue.erase({state.next_announce, torrent});
+        state.active = false;
+        return;
+    }
+
+    state.request.event = AnnounceEvent::Stopped;
+    schedule_announce(scheduler, torrent, announce_clock::now());
+}
+
+// Function to ask for an early announce (e.g. when running low on peers), honoring the minimum interval
+void request_more_peers(AnnounceScheduler& scheduler, size_t torrent) {
+    TorrentAnnounceState& state = scheduler.torrents[torrent];
+    if(!state.active) return;
+
+    auto earliest = state.last_announce + std::chrono::seconds(state.min_interval_s);
+    if(earliest < state.next_announce) {
+        schedule_announce(scheduler, torrent, std::max(earliest, announce_clock::now()));
+    }
+}
+
+// Helper function to add tokens earned since the last refill, capped at one second's worth
+static void refill_tokens(AnnounceScheduler& scheduler, announce_clock::time_point now) {
+    double elapsed_s = std::chrono::duration<double>(now - scheduler.last_refill).count();
+    scheduler.tokens = std::min(scheduler.config.max_announces_per_second, scheduler.tokens + elapsed_s * scheduler.config.max_announces_per_second);
+    scheduler.last_refill = now;
+}
+
+// Function to compute how long the caller may sleep before run_due_announces has work
+std::chrono::milliseconds time_until_next_announce(const AnnounceScheduler& scheduler) {
+    if(scheduler.queue.empty()) {
+        return std::chrono::milliseconds::max();
+    }
+
+    auto now = announce_clock::now();
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(scheduler.queue.begin()->first - now);
+
+    if(scheduler.tokens < 1.0) {
+        // Wait for a tenth of a second's worth of tokens so throttled announces still leave in batches
+        double wanted = std::max(1.0, scheduler.config.max_announces_per_second / 10);
+        auto token_wait = std::chrono::milliseconds(static_cast<int64_t>(1000 * (wanted - scheduler.tokens) / scheduler.config.max_announces_per_second) + 1);
+        wait = std::max(wait, token_wait);
+    }
+
+    return std::max(wait, std::chrono::milliseconds(0));
+}
+
+// Helper function to update a torrent's schedule from the outcome of its announce
+static void apply_announce_result(AnnounceScheduler& scheduler, size_t torrent, bool success, AnnounceResponse& response, announce_clock::time_point now) {
+    TorrentAnnounceState& state = scheduler.torrents[torrent];
+    state.last_announce = now;
+
+    if(state.request.event == AnnounceEvent::Stopped) {
+        // Never retry a stop; the tracker will expire us anyway
+        state.active = false;
+        return;
+    }
+
+    if(!success) {
+        ++state.failures;
+        int64_t retry_s = std::min(scheduler.config.retry_base_s << std::min(state.failures - 1, 16), state.interval_s);
+        std::uniform_int_distribution<int64_t> jitter(0, retry_s * 100); // Up to +10% so failed torrents don't retry in lockstep
+        schedule_announce(scheduler, torrent, now + std::chrono::milliseconds(retry_s * 1000 + jitter(scheduler.generator)));
+        return;
+    }
+
+    state.failures = 0;
+    if(state.request.event == AnnounceEvent::Started) {
+        state.started_announced = true;
+    }
+    state.request.event = AnnounceEvent::None;
+
+    if(response.interval > 0) {
+        state.interval_s = response.interval;
+    }
+    if(response.min_interval > 0) {
+        state.min_interval_s = std::min(response.min_interval, state.interval_s);
+    }
+    else {
+        state.min_interval_s = std::min(scheduler.config.default_min_interval_s, state.interval_s);
+    }
+
+    state.last_response = std::move(response);
+    schedule_announce(scheduler, torrent, jittered_announce_time(scheduler, state, now));
+}
+
+// Function to send every announce that is due, plus announces to the same tracker due within the
+// coalescing window, limited by the token bucket. UDP announces to the same tracker share one batch.
+// In a quick round no tracker can hold the caller much past quick_timeout_ms: each HTTP request is cut off then,
+// and the UDP batch spends half of it on each of the connect and the announce, with a single retransmit.
+size_t run_due_announces(AnnounceScheduler& scheduler, bool quick) {
+    auto now = announce_clock::now();
+    refill_tokens(scheduler, now);
+
+    auto coalesce_until = now + std::chrono::milliseconds(scheduler.config.coalesce_window_ms);
+    std::unordered_set<std::string> due_trackers;
+    std::vector<size_t> selected;
+
+    // Step 1: Walk the queue in due order and select what to send now
+    for(auto it = scheduler.queue.begin(); it != scheduler.queue.end() && it->first <= coalesce_until && scheduler.tokens >= 1.0;) {
+        const std::string& tracker_url = scheduler.torrents[it->second].request.tracker_url;
+
+        if(it->first <= now) {
+            due_trackers.insert(tracker_url);
+        }
+        else if(!due_trackers.count(tracker_url)) {
+            ++it;
+            continue;
+        }
+
+        selected.push_back(it->second);
+        scheduler.tokens -= 1.0;
+        it = scheduler.queue.erase(it);
+    }
+
+    // Step 2: Send UDP announces as one batch and HTTP announces one by one
+    std::vector<AnnounceRequest> udp_requests;
+    std::vector<size_t> udp_torrents;
+
+    for(size_t torrent : selected) {
+        const AnnounceRequest& request = scheduler.torrents[torrent].request;
+
+        if(request.tracker_url.rfind("udp://", 0) == 0) {
+            udp_requests.push_back(request);
+            udp_torrents.push_back(torrent);
+            continue;
+        }
+
+        AnnounceResponse response;
+        bool success = http_announce(request, response, quick ? scheduler.config.quick_timeout_ms : 0);
+        apply_announce_result(scheduler, torrent, success, response, announce_clock::now());
+    }
+
+    if(!udp_requests.empty()) {
+        std::vector<AnnounceResponse> responses;
+        UdpTrackerConfig udp_config = udp_tracker_config();
+        if(quick) {
+            udp_config.base_timeout_ms = static_cast<int>(std::max<int64_t>(scheduler.config.quick_timeout_ms / 6, 1));
+            udp_config.max_retransmits = 1; // Waits 1 + 2 base timeouts per exchange
+        }
+        std::vector<bool> results = udp_announce_batch(udp_requests, responses, udp_config);
+
+        for(size_t i = 0; i < udp_torrents.size(); ++i) {
+            apply_announce_result(scheduler, udp_torrents[i], results[i], responses[i], announce_clock::now());
+        }
+    }
+
+    return selected.size();
+}
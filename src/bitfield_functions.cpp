@@ -0,0 +1,81 @@
+#include "BitfieldFunctions.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+// Whole-bitfield kernels are plain word loops the compiler vectorises. On x86-64 an AVX2 clone (which also
+// brings the popcnt instruction) is chosen at load time where the CPU has it, with a baseline fallback.
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define BITFIELD_KERNEL __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+#ifndef BITFIELD_KERNEL
+#define BITFIELD_KERNEL
+#endif
+
+// Helper function to get the bit of an index within its word (wire order: most significant first)
+static uint64_t bit_mask(size_t index) {
+    return uint64_t(1) << (63 - index % 64);
+}
+
+// Helper function to clear the bits past the last index, which the kernels rely on
+static void clear_spare_bits(Bitfield& bitfield) {
+    if(bitfield.size % 64 != 0) {
+        bitfield.words.back() &= ~uint64_t(0) << (64 - bitfield.size % 64);
+    }
+}
+
+// Function to size a bitfield for 'size' pieces with every bit set to 'value'
+void init_bitfield(Bitfield& bitfield, size_t size, bool value) {
+    bitfield.size = size;
+    bitfield.words.assign((size + 63) / 64, value ? ~uint64_t(0) : 0);
+    clear_spare_bits(bitfield);
+}
+
+// Function to test one bit; indices past the end read as clear
+bool bitfield_test(const Bitfield& bitfield, size_t index) {
+    return index < bitfield.size && (bitfield.words[index / 64] & bit_mask(index));
+}
+
+// Function to set one bit
+void bitfield_set(Bitfield& bitfield, size_t index) {
+    bitfield.words[index / 64] |= bit_mask(index);
+}
+
+// Function to load a bitfield message's payload; returns false if its length doesn't match 'size' pieces
+// or a spare bit past the last piece is set
+bool bitfield_from_wire(Bitfield& bitfield, const char* data, size_t length, size_t size) {
+    if(length != (size + 7) / 8) {
+        return false;
+    }
+
+    init_bitfield(bitfield, size);
+    memcpy(bitfield.words.data(), data, length);
+    if constexpr(std::endian::native == std::endian::little) {
+        for(uint64_t& word : bitfield.words) word = std::byteswap(word);
+    }
+
+    uint64_t last = bitfield.words.empty() ? 0 : bitfield.words.back();
+    clear_spare_bits(bitfield);
+    return bitfield.words.empty() || bitfield.words.back() == last;
+}
+
+// Function to count the set bits
+BITFIELD_KERNEL size_t bitfield_count(const Bitfield& bitfield) {
+    size_t count = 0;
+    for(uint64_t word : bitfield.words) count += std::popcount(word);
+    return count;
+}
+
+// Function to check whether any bit is set in 'a' and clear in 'b', stopping at the first such word
+BITFIELD_KERNEL bool bitfield_any_and_not(const Bitfield& a, const Bitfield& b) {
+    size_t words = std::min(a.words.size(), b.words.size());
+    for(size_t i = 0; i < words; ++i) {
+        if(a.words[i] & ~b.words[i]) return true;
+    }
+    for(size_t i = words; i < a.words.size(); ++i) {
+        if(a.words[i]) return true;
+    }
+    return false;
+}
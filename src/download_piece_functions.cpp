@@ -1,108 +1,225 @@
 #include "DownloadPieceFunctions.h"
+#include "AnnounceSchedulerFunctions.h"
+#include <algorithm>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-// Helper function to receive a peer message and extract message id and payload length
-bool receive_peer_message(int client_socket, int &message_id, size_t& payload_length) {
-    //Buffer for message length and ID
-    char header[5] = {0};
+static const int BLOCK_SIZE = 16 * 1024; // 16 KiB block size
 
-    //Receive 4 bytes (message length) + 1 byte (message ID)
-    ssize_t bytes_received = recv_all(client_socket, header, sizeof(header));
-    if(bytes_received != sizeof(header)) {
-        std::cerr << "Failed to receive peer message header." << std::endl;
+// Deferred messages held per peer while the metadata is fetched, counting a few bytes of overhead each: room for the
+// bitfield of the largest metadata accepted (under 110 KB) and a stream of haves. A peer sending more is dropped.
+static const size_t MAX_DEFERRED_BYTES = 256 * 1024;
+static const size_t DEFERRED_MESSAGE_OVERHEAD = 16;
+
+// Helper function to get the size of a piece; only the last piece may be shorter
+int64_t piece_size(const TorrentDownload& torrent, int piece_index) {
+    int64_t piece_start = static_cast<int64_t>(piece_index) * torrent.piece_length;
+    return std::min(torrent.piece_length, torrent.file_length - piece_start);
+}
+
+// Helper function to get where a piece lives in the download storage
+char* piece_storage(TorrentDownload& torrent, int piece_index) {
+    return torrent.storage + static_cast<int64_t>(piece_index) * torrent.piece_length - torrent.storage_offset;
+}
+
+// Function to set up a download of the wanted pieces (all pieces if 'wanted_pieces' is empty)
+bool init_torrent_download(TorrentDownload& torrent, const std::string& info_hash, const std::string& peer_id, const std::vector<std::string>& piece_hashes,
+                           int64_t piece_length, int64_t file_length, const std::vector<int>& wanted_pieces) {
+    torrent.info_hash = info_hash;
+    torrent.peer_id = peer_id;
+    torrent.piece_hashes = piece_hashes;
+    torrent.piece_length = piece_length;
+    torrent.file_length = file_length;
+    torrent.piece_states.assign(piece_hashes.size(), wanted_pieces.empty() ? PieceState::Missing : PieceState::Unwanted);
+
+    for(int piece_index : wanted_pieces) {
+        if(piece_index < 0 || piece_index >= static_cast<int>(piece_hashes.size())) {
+            std::cerr << "Invalid piece index: " << piece_index << std::endl;
+            return false;
+        }
+        torrent.piece_states[piece_index] = PieceState::Missing;
+    }
+
+    // Storage spans from the first to the last wanted piece
+    auto first = std::find(torrent.piece_states.begin(), torrent.piece_states.end(), PieceState::Missing);
+    auto last = std::find(torrent.piece_states.rbegin(), torrent.piece_states.rend(), PieceState::Missing);
+    if(first == torrent.piece_states.end()) {
+        std::cerr << "No pieces to download." << std::endl;
         return false;
     }
 
-    //Extract message length (4 bytes, big-endian) and message ID (1 byte)
-    uint32_t length = ntohl(*(uint32_t*)header); // Convert network byte order to host byte order
-    message_id = static_cast<unsigned char>(header[4]); // 5th byte is the message ID
-    payload_length = length - 1; // Subtract 1 for the message ID
+    int first_piece = first - torrent.piece_states.begin();
+    int last_piece = torrent.piece_states.rend() - last - 1;
 
+    torrent.pieces_remaining = std::count(torrent.piece_states.begin(), torrent.piece_states.end(), PieceState::Missing);
+    init_bitfield(torrent.finished_pieces, piece_hashes.size());
+    for(size_t piece_index = 0; piece_index < piece_hashes.size(); ++piece_index) {
+        if(torrent.piece_states[piece_index] == PieceState::Unwanted) bitfield_set(torrent.finished_pieces, piece_index);
+    }
+    std::vector<uint8_t> priorities(piece_hashes.size(), 0);
+    for(size_t piece_index = 0; piece_index < piece_hashes.size(); ++piece_index) {
+        if(torrent.piece_states[piece_index] == PieceState::Missing) priorities[piece_index] = DEFAULT_PIECE_PRIORITY;
+    }
+    init_piece_picker(torrent.picker, priorities);
+    torrent.storage_offset = static_cast<int64_t>(first_piece) * piece_length;
+    torrent.storage_length = static_cast<int64_t>(last_piece) * piece_length + piece_size(torrent, last_piece) - torrent.storage_offset;
+
+    void* storage = mmap(nullptr, torrent.storage_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(storage == MAP_FAILED) {
+        std::cerr << "Failed to allocate " << torrent.storage_length << " bytes of download storage: " << strerror(errno) << std::endl;
+        return false;
+    }
+    torrent.storage = static_cast<char*>(storage);
+
+    if(!create_event_loop(torrent.loop)) {
+        munmap(torrent.storage, torrent.storage_length);
+        torrent.storage = nullptr;
+        return false;
+    }
+
+    torrent.io_uring = create_uring_engine(torrent.loop);
     return true;
 }
 
-// Function to receive and skip the bitfield message
-bool handle_bitfield_message(int client_socket) {
-    int message_id;
-    size_t payload_length;
+static void request_blocks(TorrentDownload& torrent, PeerConnection& connection);
+static size_t clamp_pipeline_depth(const TorrentDownload& torrent, const PeerConnection& connection, size_t depth);
+static void update_peer_interest(TorrentDownload& torrent, PeerConnection& connection);
+static void queue_empty_bitfield_message(const TorrentDownload& torrent, PeerConnection& connection);
+static void queue_have_none_message(PeerConnection& connection);
+static std::deque<BlockRequest>* find_block_request(PeerConnection& connection, uint32_t piece_index, uint32_t block_offset,
+                                                    std::deque<BlockRequest>::iterator& found);
 
-    // Receive the message
-    if(!receive_peer_message(client_socket, message_id, payload_length)) {
+// Helper function to resume a pooled connection in this download: it is already handshaken and interested,
+// so an unchoked peer gets its first request right away
+static bool adopt_pooled_connection(TorrentDownload& torrent, std::unique_ptr<PeerConnection> connection) {
+    connection->torrent = &torrent;
+    connection->loop = &torrent.loop;
+    connection->tuning.last_tune = std::chrono::steady_clock::now();
+
+    PeerConnection* connection_ptr = connection.get();
+    if(!event_loop_add(torrent.loop, connection->socket, EPOLLIN | EPOLLOUT | EPOLLRDHUP, [connection_ptr](uint32_t events) {
+        handle_peer_connection_events(*connection_ptr, events);
+    })) {
+        close(connection->socket);
         return false;
     }
 
-    // Check if it's a bitfield message (ID 5)
-    if(message_id == 5) {
-        // Skip the payload
-        char* payload_buffer = new char[payload_length];
-        ssize_t bytes_skipped = recv_all(client_socket, payload_buffer, payload_length);
-        delete[] payload_buffer;
+    torrent.dialer.any_handshake = true;
+    torrent.connections.push_back(std::move(connection));
 
-        if(bytes_skipped != payload_length) {
-            std::cerr << "Error skipping bitfield payload." << std::endl;
+    PeerConnection& adopted = *torrent.connections.back();
+    adopted.request_target = clamp_pipeline_depth(torrent, adopted, torrent.options.adaptive_pipeline && adopted.request_target
+                                                                        ? adopted.request_target : torrent.options.pipeline_depth);
+    if(adopted.peer_pieces.size != torrent.piece_hashes.size()) {
+        init_bitfield(adopted.peer_pieces, torrent.piece_hashes.size()); // Pooled by a metadata fetch, before the piece count was known
+    }
+    piece_picker_add_peer(torrent.picker, adopted.peer_pieces, 1);
+
+    // Replay what the peer said about its pieces while the metadata was fetched, now that it can be checked
+    adopted.deferred_bytes = 0;
+    for(const auto& [message_id, payload] : std::exchange(adopted.deferred_messages, {})) {
+        if(adopted.state == PeerConnectionState::Closed) return true;
+        handle_peer_message(torrent, adopted, message_id, payload.data(), payload.size());
+    }
+    update_peer_interest(torrent, adopted);
+    process_peer_inbound(adopted, false); // Messages that were read but not parsed before it was pooled
+    request_blocks(torrent, adopted);
+    flush_peer_connection(adopted);
+    return true;
+}
+
+// Function to open a new non-blocking connection to a peer (or reuse a pooled one); the handshake goes out once connected
+bool add_peer_connection(TorrentDownload& torrent, const PeerEndpoint& peer, bool over_utp) {
+    if(torrent.pool && !over_utp) {
+        std::unique_ptr<PeerConnection> pooled = take_pooled_connection(*torrent.pool, torrent.info_hash, peer);
+        if(pooled && adopt_pooled_connection(torrent, std::move(pooled))) {
+            return true;
+        }
+    }
+
+    auto connection = std::make_unique<PeerConnection>();
+    connection->endpoint = peer;
+    connection->torrent = &torrent;
+
+    if(over_utp) {
+        if(!torrent.utp) torrent.utp = create_utp_context(torrent.loop);
+        if(!torrent.utp || !start_utp_peer_connection(*connection, torrent.loop, *torrent.utp, prepare_handshake_message(torrent.info_hash, torrent.peer_id))) {
             return false;
         }
     }
     else {
-        std::cerr << "Expected bitfield message, but received another message with ID: " << message_id << std::endl;
-        return false;
+        int receive_buffer = choose_connect_receive_buffer(torrent.socket_tuning, torrent.connections);
+        if(!start_peer_connection(*connection, torrent.loop, prepare_handshake_message(torrent.info_hash, torrent.peer_id), receive_buffer)) {
+            return false;
+        }
+    }
+
+    // Interested rides in the same first write as the handshake, so the peer's handshake, bitfield and unchoke
+    // can all come back within one round trip. An empty bitfield goes first: we advertise the Fast extension,
+    // which needs a bitfield, have all or have none before anything else, and whether the peer supports it (and
+    // so would understand have none) isn't known until its handshake arrives. Every peer accepts a bitfield.
+    // Without the metadata there is no bitfield to send, so both wait for the peer's handshake.
+    if(!torrent.metadata.active) {
+        queue_empty_bitfield_message(torrent, *connection);
+        queue_interested_message(*connection);
     }
 
+    torrent.connections.push_back(std::move(connection));
     return true;
 }
 
-// Helper function to send the "interested" message
-bool send_interested_message(int client_socket) {
+// Helper function to queue a have none message, which stands in for the bitfield when the piece count isn't
+// known yet (Fast extension)
+static void queue_have_none_message(PeerConnection& connection) {
+    char message[5];
+    uint32_t message_length = htonl(1);
+    memcpy(message, &message_length, sizeof(message_length));
+    message[4] = 15; // Message ID for "have none"
+
+    queue_peer_bytes(connection, message, sizeof(message));
+}
+
+// Helper function to queue a bitfield message announcing no pieces
+static void queue_empty_bitfield_message(const TorrentDownload& torrent, PeerConnection& connection) {
+    size_t payload_length = (torrent.piece_hashes.size() + 7) / 8;
+    std::string message(5 + payload_length, '\0');
+
+    uint32_t message_length = htonl(1 + payload_length);
+    memcpy(message.data(), &message_length, sizeof(message_length));
+    message[4] = 5; // Message ID for "bitfield"
+
+    queue_peer_bytes(connection, message.data(), message.size());
+}
+
+// Helper function to queue the "interested" message
+void queue_interested_message(PeerConnection& connection) {
     // Construct the interested message: 4 bytes for length (1) + 1 byte for message ID (2)
-    char message[5] = {0}; // 4 bytes for length + 1 byte for message ID
+    char message[5] = {0};
 
-    // Set message length (4 bytes in big-endian format) and message ID (2)
     uint32_t message_length = htonl(1); // The length is 1 because there's no payload
     memcpy(message, &message_length, sizeof(message_length));
     message[4] = 2; // Message ID for "interested"
 
-    //Send message
-    ssize_t bytes_sent = send(client_socket, message, sizeof(message), 0);
-    if(bytes_sent != sizeof(message)) {
-        std::cerr << "Error sending interested message." << std::endl;
-        return false;
-    }
-
-    return true;
+    queue_peer_bytes(connection, message, sizeof(message));
+    connection.am_interested = true;
 }
 
-// Helper function to wait for the "unchoke" message
-bool wait_for_unchoke(int client_socket) {
-    int message_id;
-    size_t payload_length;
+// Helper function to queue the "not interested" message
+void queue_not_interested_message(PeerConnection& connection) {
+    char message[5] = {0};
 
-    // Loop to continuously wait for messages until an unchoke message is received
-    while(true) {
-        //Receive the next peer message
-        if(!receive_peer_message(client_socket, message_id, payload_length)) {
-            return false;
-        }
+    uint32_t message_length = htonl(1);
+    memcpy(message, &message_length, sizeof(message_length));
+    message[4] = 3; // Message ID for "not interested"
 
-        // Check if it's an unchoke message (ID 1)
-        if(message_id == 1) {
-            return true;
-        }
-        else {
-            if(payload_length > 0) {
-                char* payload_buffer = new char[payload_length];
-                ssize_t bytes_skipped = recv_all(client_socket, payload_buffer, payload_length);
-                delete[] payload_buffer;
-
-                if (bytes_skipped != payload_length) {
-                    std::cerr << "Error skipping message payload." << std::endl;
-                    return false;
-                }
-            }
-        }
-    }
+    queue_peer_bytes(connection, message, sizeof(message));
+    connection.am_interested = false;
 }
 
-// Helper function to send a request for a block of a piece
-bool send_request_message(int client_socket, int piece_index, int block_offset, int block_length) {
+// Helper function to queue a request for a block of a piece
+void queue_request_message(PeerConnection& connection, int piece_index, int block_offset, int block_length) {
     char message[17]; // 4 bytes for length, 1 byte for message ID, and 12 bytes for the request
 
     // Construct the message
@@ -119,173 +236,935 @@ bool send_request_message(int client_socket, int piece_index, int block_offset,
     memcpy(message + 9, &block_offset_n, sizeof(block_offset_n));
     memcpy(message + 13, &block_length_n, sizeof(block_length_n));
 
-    // Send the message
-    ssize_t bytes_sent = send(client_socket, message, sizeof(message), 0);
-    if (bytes_sent != sizeof(message)) {
-        std::cerr << "Error sending request message." << std::endl;
+    queue_peer_bytes(connection, message, sizeof(message));
+}
+
+// Helper function to queue a cancel for a block requested earlier; built like the request it withdraws
+void queue_cancel_message(PeerConnection& connection, int piece_index, int block_offset, int block_length) {
+    char message[17]; // 4 bytes for length, 1 byte for message ID, and 12 bytes naming the block
+
+    uint32_t message_length = htonl(13);
+    memcpy(message, &message_length, sizeof(message_length));
+    message[4] = 8; // Message ID for "cancel"
+
+    uint32_t piece_index_n = htonl(piece_index);
+    uint32_t block_offset_n = htonl(block_offset);
+    uint32_t block_length_n = htonl(block_length);
+    memcpy(message + 5, &piece_index_n, sizeof(piece_index_n));
+    memcpy(message + 9, &block_offset_n, sizeof(block_offset_n));
+    memcpy(message + 13, &block_length_n, sizeof(block_length_n));
+
+    queue_peer_bytes(connection, message, sizeof(message));
+}
+
+// Helper function to get the number of blocks in a piece
+static int piece_block_count(const TorrentDownload& torrent, int piece_index) {
+    return static_cast<int>((piece_size(torrent, piece_index) + BLOCK_SIZE - 1) / BLOCK_SIZE);
+}
+
+// Helper function to check a block's bit in a piece's received bitmap
+static bool block_received(const PieceProgress& progress, int block) {
+    return (progress.received[block / 64] >> (block % 64)) & 1;
+}
+
+// Helper function to start tracking a missing piece's blocks
+static PieceProgress& start_piece_progress(TorrentDownload& torrent, int piece_index) {
+    int blocks = piece_block_count(torrent, piece_index);
+    PieceProgress& progress = torrent.pieces_in_progress[piece_index];
+    progress.data = piece_storage(torrent, piece_index);
+    progress.received.assign((blocks + 63) / 64, 0);
+    progress.requests.assign(blocks, 0);
+    progress.blocks_received = 0;
+    progress.blocks_unrequested = blocks;
+    torrent.piece_states[piece_index] = PieceState::Downloading;
+    return progress;
+}
+
+// Helper function to check that the peer has a piece and will take requests for it now: it is unchoking us, or
+// the piece is in its allowed fast set
+static bool can_request_piece(const PeerConnection& connection, int piece_index) {
+    if(!bitfield_test(connection.peer_pieces, piece_index)) {
         return false;
     }
+    return !connection.peer_choking ||
+           std::find(connection.allowed_fast.begin(), connection.allowed_fast.end(), piece_index) != connection.allowed_fast.end();
+}
+
+// Helper function to find a piece of the peer's this connection can request blocks of. A piece already in progress
+// with blocks nobody has asked for comes first, the one closest to done, so partial pieces get finished (and can be
+// verified and shared) rather than each peer starting its own; otherwise the rarest missing piece of the highest priority.
+static int pick_piece(TorrentDownload& torrent, const PeerConnection& connection) {
+    int partial = -1;
+    for(const auto& [piece_index, progress] : torrent.pieces_in_progress) {
+        if(progress.blocks_unrequested == 0 || !can_request_piece(connection, piece_index)) continue;
+
+        if(partial == -1 || torrent.picker.priority[piece_index] > torrent.picker.priority[partial] ||
+           (torrent.picker.priority[piece_index] == torrent.picker.priority[partial] &&
+            progress.blocks_unrequested < torrent.pieces_in_progress[partial].blocks_unrequested)) {
+            partial = piece_index;
+        }
+    }
+    if(partial != -1) return partial;
 
-    return true;
+    auto startable = [&](int candidate) {
+        return torrent.piece_states[candidate] == PieceState::Missing && can_request_piece(connection, candidate);
+    };
+
+    // A piece the peer suggested is likely in its cache, so it is served without a disk read
+    for(auto suggested = connection.suggested_pieces.rbegin(); suggested != connection.suggested_pieces.rend(); ++suggested) {
+        if(startable(*suggested)) {
+            start_piece_progress(torrent, *suggested);
+            return *suggested;
+        }
+    }
+
+    int piece_index = piece_picker_pick(torrent.picker, startable);
+    if(piece_index == -1) return -1;
+
+    start_piece_progress(torrent, piece_index);
+    return piece_index;
 }
 
-// Helper function to receive a piece block and write it into the buffer
-bool receive_piece_block(int client_socket, char* piece_buffer, int piece_index, int block_offset, int block_length) 
-{
-    // Message header is 9 bytes: 4 bytes for piece index, 4 bytes for block offset, 1 byte for ID
-    char message_header[13];
+// Helper function to count one more connection with a block outstanding
+static void add_block_request(PieceProgress& progress, int block) {
+    if(progress.requests[block]++ == 0 && !block_received(progress, block)) {
+        --progress.blocks_unrequested;
+    }
+}
 
-    // Receive the message header (13 bytes total: 4 for length, 1 for ID, 4 for index, 4 for offset)
-    ssize_t bytes_received = recv_all(client_socket, message_header, sizeof(message_header));
-    
-    if (bytes_received < 0) {
-        // An error occurred while receiving the header
-        std::cerr << "Error receiving piece header: " << strerror(errno) << std::endl;
-        return false;
-    } else if (bytes_received == 0) {
-        // The connection was closed before we could receive any data
-        std::cerr << "Connection closed by the peer while receiving piece header." << std::endl;
-        return false;
+// Helper function to count one connection fewer with a block outstanding (its request was answered, cancelled,
+// or died with the connection); a block nobody has outstanding any more can be requested again
+static void drop_block_request(TorrentDownload& torrent, uint32_t piece_index, uint32_t block_offset) {
+    auto found = torrent.pieces_in_progress.find(piece_index);
+    if(found == torrent.pieces_in_progress.end()) return; // Verified, or failed and restarted
+
+    PieceProgress& progress = found->second;
+    int block = block_offset / BLOCK_SIZE;
+    if(progress.requests[block] > 0 && --progress.requests[block] == 0 && !block_received(progress, block)) {
+        ++progress.blocks_unrequested;
     }
+}
 
-    // Extract the message length (first 4 bytes)
-    uint32_t message_length = ntohl(*reinterpret_cast<uint32_t*>(message_header));
+// Helper function to fill in the request for a block of a piece
+static void make_block_request(const TorrentDownload& torrent, int piece_index, int block, BlockRequest& request) {
+    int64_t block_offset = static_cast<int64_t>(block) * BLOCK_SIZE;
+    request.piece_index = piece_index;
+    request.block_offset = block_offset;
+    request.block_length = std::min<int64_t>(BLOCK_SIZE, piece_size(torrent, piece_index) - block_offset);
+}
 
-    // Extract the message ID (next 1 byte, should be 7 for "piece")
-    uint8_t message_id = static_cast<uint8_t>(message_header[4]);
-    if (message_id != 7) {
-        std::cerr << "Unexpected message ID: " << static_cast<int>(message_id) << std::endl;
+// Helper function to check whether every block still needed has been requested from some peer, so the only way to
+// speed up the tail is to ask a second peer for blocks stuck behind a slow one
+static bool in_endgame(const TorrentDownload& torrent) {
+    if(torrent.pieces_in_progress.size() != static_cast<size_t>(torrent.pieces_remaining)) {
+        return false; // Some wanted piece hasn't been started
+    }
+    return std::all_of(torrent.pieces_in_progress.begin(), torrent.pieces_in_progress.end(), [](const auto& entry) {
+        return entry.second.blocks_unrequested == 0;
+    });
+}
+
+// Helper function to pick an endgame duplicate: a block of one of the peer's pieces that isn't in yet, isn't
+// already asked of this connection, and has the fewest requesters below the limit
+static bool next_endgame_request(TorrentDownload& torrent, PeerConnection& connection, BlockRequest& request) {
+    if(!in_endgame(torrent)) {
         return false;
     }
 
-    // Extract the piece index and block offset
-    uint32_t received_piece_index = ntohl(*reinterpret_cast<uint32_t*>(message_header + 5));
-    uint32_t received_block_offset = ntohl(*reinterpret_cast<uint32_t*>(message_header + 9));
+    int best_piece = -1, best_block = -1;
+    for(auto& [piece_index, progress] : torrent.pieces_in_progress) {
+        if(!can_request_piece(connection, piece_index)) continue;
 
-    if (received_piece_index != piece_index || received_block_offset != block_offset) {
-        std::cerr << "Piece or block offset mismatch. Expected piece index: " << piece_index 
-                  << ", received: " << received_piece_index 
-                  << ", Expected block offset: " << block_offset 
-                  << ", received: " << received_block_offset << std::endl;
-        return false;
+        for(int block = 0; block < static_cast<int>(progress.requests.size()); ++block) {
+            if(block_received(progress, block) || progress.requests[block] >= torrent.options.endgame_max_requests ||
+               (best_piece != -1 && progress.requests[block] >= torrent.pieces_in_progress[best_piece].requests[best_block])) {
+                continue;
+            }
+
+            std::deque<BlockRequest>::iterator mine;
+            if(find_block_request(connection, piece_index, block * BLOCK_SIZE, mine)) continue;
+
+            best_piece = piece_index;
+            best_block = block;
+        }
     }
+    if(best_piece == -1) return false;
 
-    // Now receive the block data
-    ssize_t block_bytes_received = recv_all(client_socket, piece_buffer + block_offset, block_length);
+    add_block_request(torrent.pieces_in_progress[best_piece], best_block);
+    make_block_request(torrent, best_piece, best_block, request);
+    ++torrent.stats.endgame_requests;
+    return true;
+}
 
-    if (block_bytes_received < 0) {
-        // Some error occurred during receiving
-        std::cerr << "Error receiving piece block data: " << strerror(errno) << std::endl;
-        return false;
-    } else if (block_bytes_received == 0) {
-        // Connection closed before receiving the full block
-        std::cerr << "Connection closed before receiving full block data." << std::endl;
-        return false;
+// Helper function to cut the connection's next block request from the first unrequested block of its piece,
+// moving on to another piece when none are left, and to endgame duplicates when no piece is left to start;
+// returns false once there is nothing left to ask this peer for
+static bool next_block_request(TorrentDownload& torrent, PeerConnection& connection, BlockRequest& request) {
+    for(;;) {
+        auto found = torrent.pieces_in_progress.end();
+        if(connection.piece_index != -1) {
+            found = torrent.pieces_in_progress.find(connection.piece_index);
+        }
+        if(found == torrent.pieces_in_progress.end() || found->second.blocks_unrequested == 0 || !can_request_piece(connection, connection.piece_index)) {
+            connection.piece_index = pick_piece(torrent, connection);
+            if(connection.piece_index == -1) return next_endgame_request(torrent, connection, request);
+            continue;
+        }
+
+        PieceProgress& progress = found->second;
+        int blocks = static_cast<int>(progress.requests.size());
+        for(int block = 0; block < blocks; ++block) {
+            if(progress.requests[block] == 0 && !block_received(progress, block)) {
+                add_block_request(progress, block);
+                make_block_request(torrent, connection.piece_index, block, request);
+                return true;
+            }
+        }
+        progress.blocks_unrequested = 0; // Unreachable while the count is kept right
+    }
+}
+
+// Helper function to top the connection's requests in flight back up to its pipeline depth, so the peer
+// always has the next blocks queued instead of idling for a round trip after each one
+static void request_blocks(TorrentDownload& torrent, PeerConnection& connection) {
+    if(connection.peer_choking && connection.allowed_fast.empty()) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    BlockRequest request;
+    while(connection.requests.size() < connection.request_target && next_block_request(torrent, connection, request)) {
+        request.sent = now;
+        queue_request_message(connection, request.piece_index, request.block_offset, request.block_length);
+        connection.requests.push_back(request);
+    }
+
+    connection.max_requests_outstanding = std::max(connection.max_requests_outstanding, connection.requests.size());
+}
+
+// Helper function to clamp a pipeline depth to the configured bounds and to the 'reqq' the peer announced
+static size_t clamp_pipeline_depth(const TorrentDownload& torrent, const PeerConnection& connection, size_t depth) {
+    size_t upper = torrent.options.max_pipeline_depth;
+    if(connection.extensions.request_limit > 0) {
+        upper = std::min<size_t>(upper, connection.extensions.request_limit);
+    }
+    return std::max<size_t>(1, std::min(std::max(depth, torrent.options.min_pipeline_depth), upper));
+}
+
+// Helper function to resize each peer's pipeline to twice its bandwidth-delay product in blocks. A pipeline that
+// is too short caps the rate at depth x block / RTT, so the measured rate x RTT sits near the current depth
+// until the link saturates and the doubled target keeps growing it until then. Small changes are ignored so
+// the depth doesn't wobble with every rate sample.
+static void update_pipeline_depths(TorrentDownload& torrent) {
+    if(!torrent.options.adaptive_pipeline) {
+        return;
+    }
+
+    for(auto& connection : torrent.connections) {
+        const SocketTuning& tuning = connection->tuning;
+        if(connection->state != PeerConnectionState::Active || tuning.receive_rate == 0 || tuning.min_rtt_ms == 0) {
+            continue;
+        }
+
+        double bandwidth_delay = tuning.receive_rate * tuning.min_rtt_ms / 1000;
+        size_t target = clamp_pipeline_depth(torrent, *connection, static_cast<size_t>(std::ceil(2 * bandwidth_delay / BLOCK_SIZE)) + 2);
+        size_t current = connection->request_target;
+        size_t difference = target > current ? target - current : current - target;
+        if(difference > std::max<size_t>(2, current / 4)) {
+            connection->request_target = target;
+            request_blocks(torrent, *connection);
+        }
+    }
+}
+
+// Helper function to find an outstanding request matching a received block
+static std::deque<BlockRequest>* find_block_request(PeerConnection& connection, uint32_t piece_index, uint32_t block_offset,
+                                                    std::deque<BlockRequest>::iterator& found) {
+    found = std::find_if(connection.requests.begin(), connection.requests.end(), [&](const BlockRequest& request) {
+        return request.piece_index == piece_index && request.block_offset == block_offset;
+    });
+    return found != connection.requests.end() ? &connection.requests : nullptr;
+}
+
+// Helper function to retire a connection's request for a block that has arrived, sampling its latency
+static void retire_block_request(TorrentDownload& torrent, PeerConnection& connection, uint32_t piece_index, uint32_t block_offset) {
+    std::deque<BlockRequest>::iterator request;
+    std::deque<BlockRequest>* queue = find_block_request(connection, piece_index, block_offset, request);
+    if(!queue) return;
+
+    if(queue == &connection.requests) {
+        auto latency = std::chrono::steady_clock::now() - request->sent;
+        record_rtt_sample(connection.tuning, std::chrono::duration<double, std::milli>(latency).count());
+    }
+    queue->erase(request);
+    drop_block_request(torrent, piece_index, block_offset);
+}
+
+// Helper function to withdraw the other connections' interest in a block that has just arrived. Endgame duplicates
+// still in flight are cancelled; a copy already streaming into storage is pointed at a scratch block instead, so
+// its bytes can't land in the piece after it has been verified.
+static void cancel_duplicate_requests(TorrentDownload& torrent, PeerConnection& receiver, uint32_t piece_index, uint32_t block_offset) {
+    for(auto& connection : torrent.connections) {
+        if(connection.get() == &receiver) continue;
+
+        DirectBlock& direct = connection->direct_block;
+        if(direct.remaining > 0 && direct.piece_index == piece_index && direct.block_offset == block_offset) {
+            if(!torrent.discard_block) torrent.discard_block = std::make_unique<char[]>(BLOCK_SIZE);
+            direct.destination = torrent.discard_block.get() + (direct.block_length - direct.remaining);
+        }
+
+        std::deque<BlockRequest>::iterator request;
+        std::deque<BlockRequest>* queue = find_block_request(*connection, piece_index, block_offset, request);
+        if(!queue) continue;
+
+        if(queue == &connection->requests && connection->state == PeerConnectionState::Active) {
+            queue_cancel_message(*connection, piece_index, block_offset, request->block_length);
+            ++torrent.stats.cancels_sent;
+        }
+        queue->erase(request);
+        drop_block_request(torrent, piece_index, block_offset);
+        request_blocks(torrent, *connection); // Its pipeline slot goes to another block
+    }
+}
+
+// Helper function to make a closing connection's outstanding blocks requestable by other peers, and take its
+// pieces out of the swarm availability; the blocks it already delivered are kept
+static void release_connection_pieces(TorrentDownload& torrent, PeerConnection& connection) {
+    piece_picker_add_peer(torrent.picker, connection.peer_pieces, -1);
+
+    for(const BlockRequest& request : connection.requests) drop_block_request(torrent, request.piece_index, request.block_offset);
+
+    connection.piece_index = -1;
+    connection.requests.clear();
+}
+
+// Helper function to take back the requests a peer without the Fast extension discarded by choking us, so
+// unchoked peers can be asked for those blocks now rather than after this peer unchokes again (if it ever does)
+static void release_choked_requests(TorrentDownload& torrent, PeerConnection& connection) {
+    if(connection.requests.empty()) {
+        return;
+    }
+
+    for(const BlockRequest& request : connection.requests) drop_block_request(torrent, request.piece_index, request.block_offset);
+    connection.requests.clear();
+
+    for(auto& other : torrent.connections) {
+        if(other.get() != &connection) request_blocks(torrent, *other);
+    }
+}
+
+// Helper function to check a finished piece against its SHA-1 hash, hashing it where it was received
+static void verify_piece(TorrentDownload& torrent, int piece_index) {
+    torrent.pieces_in_progress.erase(piece_index);
+    if(sha1(piece_storage(torrent, piece_index), piece_size(torrent, piece_index)) != torrent.piece_hashes[piece_index]) {
+        std::cerr << "Hash mismatch! Piece " << piece_index << " is corrupted; downloading it again." << std::endl;
+        torrent.piece_states[piece_index] = PieceState::Missing;
+        return;
+    }
+
+    torrent.piece_states[piece_index] = PieceState::Complete;
+    bitfield_set(torrent.finished_pieces, piece_index);
+    piece_picker_remove(torrent.picker, piece_index);
+    torrent.interest_stale = true;
+    --torrent.pieces_remaining;
+
+    if(torrent.output_fd != -1 && !torrent.storage_file_backed) {
+        char* data = piece_storage(torrent, piece_index);
+        uring_engine_write(torrent.io_uring, data, piece_size(torrent, piece_index), data - torrent.storage);
+    }
+}
+
+// Function to get where a piece block's payload belongs in storage, or nullptr if it isn't wanted (its piece isn't
+// being downloaded, or the block is already in). Any peer may deliver any block of a piece in progress.
+char* piece_block_destination(TorrentDownload& torrent, PeerConnection& connection, uint32_t piece_index, uint32_t block_offset, uint32_t block_length) {
+    auto found = torrent.pieces_in_progress.find(piece_index);
+    if(found == torrent.pieces_in_progress.end() || block_offset % BLOCK_SIZE != 0) {
+        return nullptr;
+    }
+
+    PieceProgress& progress = found->second;
+    int block = block_offset / BLOCK_SIZE;
+    if(block >= static_cast<int>(progress.requests.size()) ||
+       block_length != std::min<int64_t>(BLOCK_SIZE, piece_size(torrent, piece_index) - block_offset)) {
+        close_peer_connection(connection, "unexpected block length");
+        return nullptr;
+    }
+
+    return block_received(progress, block) ? nullptr : progress.data + block_offset;
+}
+
+// Function called once a block's payload is in storage: mark it received, retire its request, verify the piece
+// once all of it is in, and refill the pipeline
+void on_piece_block_received(TorrentDownload& torrent, PeerConnection& connection, uint32_t piece_index, uint32_t block_offset, uint32_t block_length) {
+    retire_block_request(torrent, connection, piece_index, block_offset);
+
+    auto found = torrent.pieces_in_progress.find(piece_index);
+    int block = block_offset / BLOCK_SIZE;
+    if(found == torrent.pieces_in_progress.end() || block_received(found->second, block)) {
+        torrent.stats.duplicate_bytes += block_length; // Another peer finished it while this copy streamed in
+        request_blocks(torrent, connection);
+        return;
+    }
+
+    PieceProgress& progress = found->second;
+    if(progress.requests[block] == 0) {
+        --progress.blocks_unrequested; // Sent without being asked, or after its request was released
+    }
+    progress.received[block / 64] |= uint64_t(1) << (block % 64);
+    ++progress.blocks_received;
+    cancel_duplicate_requests(torrent, connection, piece_index, block_offset);
+
+    torrent.downloaded_bytes += block_length;
+    if(progress.blocks_received == static_cast<int>(progress.requests.size())) {
+        verify_piece(torrent, piece_index);
+    }
+
+    request_blocks(torrent, connection);
+}
+
+// Helper function to store a block that arrived complete in the read buffer
+static void handle_piece_message(TorrentDownload& torrent, PeerConnection& connection, const char* payload, uint32_t payload_length) {
+    if(payload_length < 8) {
+        close_peer_connection(connection, "truncated piece message");
+        return;
+    }
+
+    uint32_t piece_index = ntohl(*reinterpret_cast<const uint32_t*>(payload));
+    uint32_t block_offset = ntohl(*reinterpret_cast<const uint32_t*>(payload + 4));
+    uint32_t block_length = payload_length - 8;
+
+    char* destination = piece_block_destination(torrent, connection, piece_index, block_offset, block_length);
+    if(!destination) {
+        if(connection.state == PeerConnectionState::Active) {
+            torrent.stats.duplicate_bytes += block_length;
+            retire_block_request(torrent, connection, piece_index, block_offset);
+            request_blocks(torrent, connection);
+        }
+        return;
+    }
+
+    memcpy(destination, payload + 8, block_length);
+    on_piece_block_received(torrent, connection, piece_index, block_offset, block_length);
+}
+
+// Function called once the peer's handshake has been validated
+void on_peer_handshake(TorrentDownload& torrent, PeerConnection& connection) {
+    torrent.dialer.any_handshake = true;
+    init_bitfield(connection.peer_pieces, torrent.piece_hashes.size()); // A peer with no pieces may send no bitfield
+    connection.request_target = clamp_pipeline_depth(torrent, connection, torrent.options.pipeline_depth);
+    if(torrent.metadata.active && connection.extensions.fast) {
+        queue_have_none_message(connection);
+    }
+    if(connection.extensions.supported) {
+        queue_extension_handshake(connection, 250);
+    }
+    if(!connection.am_interested) {
+        queue_interested_message(connection);
+    }
+}
+
+// Helper function to tell the peer whether it has any piece we still need, when that changes
+static void update_peer_interest(TorrentDownload& torrent, PeerConnection& connection) {
+    bool interested = bitfield_any_and_not(connection.peer_pieces, torrent.finished_pieces);
+    if(interested && !connection.am_interested) {
+        queue_interested_message(connection);
+    }
+    else if(!interested && connection.am_interested) {
+        queue_not_interested_message(connection);
+    }
+}
+
+// Helper function to re-check interest in every peer after pieces were completed; one AND-NOT pass per peer
+static void update_swarm_interest(TorrentDownload& torrent) {
+    if(!torrent.interest_stale) {
+        return;
+    }
+
+    torrent.interest_stale = false;
+    for(auto& connection : torrent.connections) {
+        if(connection->state == PeerConnectionState::Active) {
+            update_peer_interest(torrent, *connection);
+        }
+    }
+}
+
+// Helper function to record a have message; the piece count is known, so an index past it is a protocol error
+static void handle_have_message(TorrentDownload& torrent, PeerConnection& connection, const char* payload, uint32_t payload_length) {
+    if(payload_length != 4) {
+        close_peer_connection(connection, "invalid have message");
+        return;
+    }
+
+    uint32_t piece_index = ntohl(*reinterpret_cast<const uint32_t*>(payload));
+    if(piece_index >= torrent.piece_hashes.size()) {
+        close_peer_connection(connection, "have message for a piece past the last");
+        return;
     }
+    if(bitfield_test(connection.peer_pieces, piece_index)) {
+        return;
+    }
+
+    bitfield_set(connection.peer_pieces, piece_index);
+    piece_picker_increment(torrent.picker, piece_index);
+    if(!bitfield_test(torrent.finished_pieces, piece_index)) {
+        if(!connection.am_interested) queue_interested_message(connection);
+        request_blocks(torrent, connection);
+    }
+}
 
-    if (block_bytes_received != block_length) {
-        std::cerr << "Expected " << block_length << " bytes, but received " << block_bytes_received << " bytes." << std::endl;
+// Helper function to record a bitfield message. It normally comes first, but a late one simply replaces what
+// have messages said so far; spare bits past the last piece must be clear.
+static void handle_bitfield_message(TorrentDownload& torrent, PeerConnection& connection, const char* payload, uint32_t payload_length) {
+    Bitfield pieces;
+    if(!bitfield_from_wire(pieces, payload, payload_length, torrent.piece_hashes.size())) {
+        close_peer_connection(connection, "invalid bitfield");
+        return;
+    }
+
+    piece_picker_add_peer(torrent.picker, connection.peer_pieces, -1);
+    connection.peer_pieces = std::move(pieces);
+    piece_picker_add_peer(torrent.picker, connection.peer_pieces, 1);
+
+    update_peer_interest(torrent, connection);
+    request_blocks(torrent, connection);
+}
+
+// Helper function to read the piece index of a Fast extension message, closing the connection if it's malformed
+static bool read_fast_piece_index(TorrentDownload& torrent, PeerConnection& connection, const char* payload, uint32_t payload_length, int& piece_index) {
+    if(!connection.extensions.fast || payload_length != 4) {
+        close_peer_connection(connection, "invalid fast extension message");
         return false;
     }
 
+    uint32_t index = ntohl(*reinterpret_cast<const uint32_t*>(payload));
+    if(index >= torrent.piece_hashes.size()) {
+        close_peer_connection(connection, "fast extension message for a piece past the last");
+        return false;
+    }
+    piece_index = static_cast<int>(index);
     return true;
 }
 
-// Function to download a piece
-bool download_piece(int client_socket, int piece_index, int piece_length, const std::string& expected_hash, const std::string& download_filename, char* file_buffer, int64_t buffer_offset) {
-    // Step 10: Break the piece into blocks and request them
-    const int BLOCK_SIZE = 16 * 1024; // 16 KiB block size
-    char* piece_buffer = new char[piece_length]; // Buffer to hold the entire piece
-    size_t total_received = 0; // Track total bytes received
+// Helper function to replace the peer's pieces with all or none of them (have all / have none), which stands in
+// for a bitfield message of every bit set or clear
+static void handle_have_all_or_none(TorrentDownload& torrent, PeerConnection& connection, bool have_all, uint32_t payload_length) {
+    if(!connection.extensions.fast || payload_length != 0) {
+        close_peer_connection(connection, "invalid fast extension message");
+        return;
+    }
+
+    piece_picker_add_peer(torrent.picker, connection.peer_pieces, -1);
+    init_bitfield(connection.peer_pieces, torrent.piece_hashes.size(), have_all);
+    piece_picker_add_peer(torrent.picker, connection.peer_pieces, 1);
+
+    update_peer_interest(torrent, connection);
+    request_blocks(torrent, connection);
+}
+
+// Helper function to handle a reject request: the block becomes requestable again at once, and the other
+// connections refill their pipelines so one of them picks it up
+static void handle_reject_message(TorrentDownload& torrent, PeerConnection& connection, const char* payload, uint32_t payload_length) {
+    if(!connection.extensions.fast || payload_length != 12) {
+        close_peer_connection(connection, "invalid reject message");
+        return;
+    }
+
+    uint32_t piece_index = ntohl(*reinterpret_cast<const uint32_t*>(payload));
+    uint32_t block_offset = ntohl(*reinterpret_cast<const uint32_t*>(payload + 4));
+    std::deque<BlockRequest>::iterator request;
+    std::deque<BlockRequest>* queue = find_block_request(connection, piece_index, block_offset, request);
+    if(!queue) {
+        return; // Already received, or cancelled
+    }
+
+    queue->erase(request);
+    drop_block_request(torrent, piece_index, block_offset);
+    ++torrent.stats.requests_rejected;
+    if(connection.piece_index == static_cast<int>(piece_index)) {
+        connection.piece_index = -1; // Move on rather than asking for the same block again
+    }
+
+    for(auto& other : torrent.connections) {
+        if(other.get() != &connection && other->state == PeerConnectionState::Active) {
+            request_blocks(torrent, *other);
+        }
+    }
+}
+
+// Helper function to queue a reject for a request we won't serve (Fast extension); we keep every peer choked
+static void queue_reject_message(PeerConnection& connection, const char* request) {
+    char message[17];
+    uint32_t message_length = htonl(13);
+    memcpy(message, &message_length, sizeof(message_length));
+    message[4] = 16; // Message ID for "reject request"
+    memcpy(message + 5, request, 12);
+
+    queue_peer_bytes(connection, message, sizeof(message));
+}
+
+// Helper function to check whether a message describes the peer's pieces, which can't be checked (or recorded)
+// until the metadata says how many there are: have, bitfield, suggest piece, have all, have none and allowed fast
+static bool message_names_pieces(uint8_t message_id) {
+    return message_id == 4 || message_id == 5 || (message_id >= 13 && message_id <= 15) || message_id == 17;
+}
+
+// Function to tell the connection layer which messages it may drop without buffering their payload
+bool peer_message_ignored(uint8_t message_id) {
+    bool handled = message_id <= 8 || (message_id >= 13 && message_id <= 17) || message_id == 20;
+    return !handled;
+}
+
+// Function to update connection state for one peer message. Every message is valid at any time after the
+// handshake (keep-alives never get here); only a malformed one closes the connection, and unknown IDs are ignored.
+void handle_peer_message(TorrentDownload& torrent, PeerConnection& connection, uint8_t message_id, const char* payload, uint32_t payload_length) {
+    if(torrent.metadata.active && message_names_pieces(message_id)) {
+        connection.deferred_bytes += payload_length + DEFERRED_MESSAGE_OVERHEAD;
+        if(connection.deferred_bytes > MAX_DEFERRED_BYTES) {
+            close_peer_connection(connection, "too many piece messages before the metadata arrived");
+            return;
+        }
+        connection.deferred_messages.emplace_back(message_id, std::string(payload, payload_length));
+        return;
+    }
 
-    for (int block_offset = 0; block_offset < piece_length; block_offset += BLOCK_SIZE) {
-        int block_length = std::min(BLOCK_SIZE, piece_length - block_offset);
-        // Send the request for this block
-        if (!send_request_message(client_socket, piece_index, block_offset, block_length)) {
-            delete[] piece_buffer; // Cleanup on failure
-            return false; // Failure to send request message
+    switch(message_id) {
+        case 0: // choke
+            connection.peer_choking = true;
+            if(!connection.extensions.fast) { // With the Fast extension each one is rejected, or served if allowed fast
+                release_choked_requests(torrent, connection);
+            }
+            break;
+        case 1: // unchoke
+            connection.peer_choking = false;
+            request_blocks(torrent, connection);
+            break;
+        case 2: // interested
+            connection.peer_interested = true;
+            break;
+        case 3: // not interested
+            connection.peer_interested = false;
+            break;
+        case 4: // have
+            handle_have_message(torrent, connection, payload, payload_length);
+            break;
+        case 5: // bitfield
+            handle_bitfield_message(torrent, connection, payload, payload_length);
+            break;
+        case 6: // request: the peer is choked, so it shouldn't ask; what it asks for is dropped (rejected with the Fast extension)
+        case 8: // cancel: nothing is queued for it to cancel
+            if(payload_length != 12) {
+                close_peer_connection(connection, message_id == 6 ? "invalid request message" : "invalid cancel message");
+                break;
+            }
+            if(message_id == 6) {
+                ++connection.peer_requests_dropped;
+                if(connection.extensions.fast) queue_reject_message(connection, payload);
+            }
+            break;
+        case 7: // piece
+            handle_piece_message(torrent, connection, payload, payload_length);
+            break;
+        case 13: { // suggest piece
+            int piece_index;
+            if(!read_fast_piece_index(torrent, connection, payload, payload_length, piece_index)) break;
+            connection.suggested_pieces.push_back(piece_index);
+            if(connection.suggested_pieces.size() > 16) connection.suggested_pieces.pop_front();
+            break;
+        }
+        case 14: // have all
+        case 15: // have none
+            handle_have_all_or_none(torrent, connection, message_id == 14, payload_length);
+            break;
+        case 16: // reject request
+            handle_reject_message(torrent, connection, payload, payload_length);
+            break;
+        case 17: { // allowed fast: requests for this piece are served even while we are choked
+            int piece_index;
+            if(!read_fast_piece_index(torrent, connection, payload, payload_length, piece_index)) break;
+            if(std::find(connection.allowed_fast.begin(), connection.allowed_fast.end(), piece_index) == connection.allowed_fast.end()) {
+                connection.allowed_fast.push_back(piece_index);
+                request_blocks(torrent, connection);
+            }
+            break;
         }
-        // Receive the block data
-        if (!receive_piece_block(client_socket, piece_buffer, piece_index, block_offset, block_length)) {
-            delete[] piece_buffer; // Cleanup on failure
-            return false; // Failure to receive piece block
+        case 20: // extended: the peer's 'reqq' caps how deep we pipeline to it, ut_metadata carries the info dictionary,
+                 // and ut_pex other peers of the swarm
+            if(payload_length >= 1 && static_cast<uint8_t>(payload[0]) == UT_METADATA_ID) {
+                handle_metadata_message(torrent, connection, payload + 1, payload_length - 1);
+                break;
+            }
+            if(payload_length >= 1 && static_cast<uint8_t>(payload[0]) == UT_PEX_ID) {
+                handle_pex_message(torrent, connection, payload + 1, payload_length - 1);
+                break;
+            }
+            if(!handle_extension_handshake(connection, payload, payload_length)) {
+                close_peer_connection(connection, "invalid extension handshake");
+                break;
+            }
+            connection.request_target = clamp_pipeline_depth(torrent, connection, connection.request_target);
+            if(torrent.metadata.active) on_metadata_peer_handshake(torrent, connection);
+            break;
+        default: // port (DHT) and IDs from extensions we didn't announce
+            break;
+    }
+}
+
+// Helper function to add a finished connection's counters to the download's
+static void collect_connection_stats(TorrentDownload& torrent, const PeerConnection& connection) {
+    torrent.stats.read_calls += connection.read_calls;
+    torrent.stats.bytes_received += connection.bytes_received;
+    torrent.stats.direct_bytes += connection.direct_bytes;
+    torrent.stats.write_calls += connection.write_calls;
+    torrent.stats.bytes_sent += connection.bytes_sent;
+    torrent.stats.max_requests_outstanding = std::max(torrent.stats.max_requests_outstanding, connection.max_requests_outstanding);
+
+    if(connection.bytes_received > 0) {
+        torrent.peer_tuning.push_back(summarize_socket_tuning(connection));
+    }
+}
+
+// Helper function to hand the pieces of closed connections back and drop the connections
+static void reap_closed_connections(TorrentDownload& torrent) {
+    for(auto& connection : torrent.connections) {
+        if(connection->state == PeerConnectionState::Closed) {
+            collect_connection_stats(torrent, *connection);
         }
-        // Check if the block was received as a 0-byte message indicating download completion
-        if (block_length == 0) {
-            break; // Exit the loop if the download is complete
+        if(connection->state == PeerConnectionState::Closed && connection->remote_peer_id.empty() && !retry_peer_over_tcp(torrent, *connection)) {
+            ++torrent.dialer.failures; // Never got past the handshake
         }
-        // Update total bytes received
-        total_received += block_length;
-        // If we have received all data for the piece, break out of the loop
-        if (total_received >= piece_length) {
-            break; // All blocks for this piece have been received
+        if(connection->state == PeerConnectionState::Closed) {
+            release_connection_pieces(torrent, *connection);
+            release_metadata_requests(torrent, *connection);
         }
     }
 
-    std::string piece(piece_buffer, piece_length);
+    std::erase_if(torrent.connections, [](const std::unique_ptr<PeerConnection>& connection) {
+        return connection->state == PeerConnectionState::Closed;
+    });
+}
+
+// Helper function to check whether the download has what it came for: every wanted piece, or a magnet link's metadata
+static bool torrent_download_done(const TorrentDownload& torrent) {
+    return torrent.metadata.active ? metadata_download_done(torrent) : torrent.pieces_remaining == 0;
+}
 
-    std::string calculated_hash = sha1(piece);
+// Helper function to keep the trackers in the loop while downloading: once connections and queued peers fall below
+// half the connection limit an early announce is asked for (the tracker's minimum interval still applies), and any
+// announce that is due is sent, its peers becoming dial candidates
+static void refresh_tracker_peers(TorrentDownload& torrent) {
+    AnnounceScheduler* trackers = torrent.options.trackers;
+    if(!trackers) {
+        return;
+    }
 
-    // Check if the calculated hash matches the expected hash
-    if (calculated_hash != expected_hash) {
-        std::cerr << "Hash mismatch! Downloaded piece is corrupted." << std::endl;
-        delete[] piece_buffer; // Cleanup on failure
-        return false; // Hash mismatch
+    if(torrent.connections.size() + torrent.dialer.candidates.size() < torrent.dialer.config.max_connections / 2) {
+        for(size_t tracker_torrent : torrent.options.tracker_torrents) {
+            request_more_peers(*trackers, tracker_torrent);
+        }
     }
 
-    if(file_buffer) {
-        std::memcpy(file_buffer + buffer_offset, piece_buffer, piece_length);
+    // A quick round, so an unresponsive tracker stalls the peer connections for a few seconds at most
+    if(time_until_next_announce(*trackers).count() > 0 || run_due_announces(*trackers, true) == 0) {
+        return;
+    }
+    for(size_t tracker_torrent : torrent.options.tracker_torrents) {
+        add_peer_candidates(torrent, trackers->torrents[tracker_torrent].last_response.peers);
     }
-    else if(!download_filename.empty()) {
-        // Step 11: Write the piece to disk
-        std::ofstream output_file(download_filename, std::ios::binary);
-        if (!output_file) {
-            std::cerr << "Failed to open output file." << std::endl;
-            delete[] piece_buffer; // Cleanup on failure
-            return false; // Failure to open output file
+}
+
+// Function to drive the event loop until every wanted piece (or the metadata) is verified or no connection is left
+bool run_torrent_download(TorrentDownload& torrent) {
+    dial_peer_candidates(torrent);
+
+    while(!torrent_download_done(torrent) && !(torrent.connections.empty() && torrent.dialer.candidates.empty())) {
+        int timeout_ms = dial_wait_timeout_ms(torrent, 1000);
+        if(torrent.utp) timeout_ms = utp_context_timeout_ms(*torrent.utp, timeout_ms);
+        run_event_loop_once(torrent.loop, timeout_ms);
+
+        // Messages handled for one peer may have queued bytes for another
+        for(auto& connection : torrent.connections) {
+            flush_peer_connection(*connection);
+        }
+        uring_engine_submit(torrent.io_uring); // One submit for every send and write queued this iteration
+        if(torrent.utp) utp_context_tick(*torrent.utp); // Retransmissions, and ACKs no data packet carried
+
+        tune_socket_buffers(torrent.socket_tuning, torrent.connections);
+        update_pipeline_depths(torrent);
+        update_swarm_interest(torrent);
+        send_peer_exchange(torrent);
+
+        expire_peer_attempts(torrent);
+        reap_closed_connections(torrent);
+        refresh_tracker_peers(torrent);
+
+        if(peer_dial_deadline_passed(torrent)) {
+            std::cerr << "No peer completed a handshake within " << torrent.dialer.config.dial_timeout_ms << " ms ("
+                      << torrent.dialer.attempts << " attempts)." << std::endl;
+            break;
         }
-        output_file.write(piece_buffer, piece_length);
-        output_file.close();
+
+        // Replace peers that failed or timed out with queued ones, including any peer exchange just told us of
+        dial_peer_candidates(torrent);
+    }
+
+    if(torrent.metadata.active) {
+        return torrent.metadata.complete;
+    }
+    if(torrent.pieces_remaining > 0) {
+        std::cerr << "Download stopped with " << torrent.pieces_remaining << " pieces missing (" << torrent.dialer.failures << " of " << torrent.dialer.attempts << " peer attempts failed)." << std::endl;
     }
 
-    // Cleanup
-    delete[] piece_buffer; // Free the buffer
-    return true; // Download successful
+    return torrent.pieces_remaining == 0;
 }
 
-// The main complete_handshake function
-void complete_piece_download(const std::string& ip, int port, const std::string& info_hash, const std::string& peer_id, int piece_index, int piece_length, const std::string& expected_hash, const std::string& download_filename, bool download) {
-    // Establish the connection
-    int client_socket = establish_connection(ip, port);
-    if (client_socket == -1) return;  // Connection failed
+// Function to make 'filename' the download's storage so blocks land in the file's page cache with no write step.
+// Where the file can't be mapped, verified pieces are written through io_uring if available, else all at the end.
+// The data goes to '<filename>.part', which replaces 'filename' only once the download succeeds.
+void open_torrent_output(TorrentDownload& torrent, const std::string& filename) {
+    struct stat status;
+    if(stat(filename.c_str(), &status) == 0 && !S_ISREG(status.st_mode)) {
+        return; // Pipes and devices can't be mapped or renamed over
+    }
+
+    std::string partial_filename = filename + ".part";
+    int output_fd = open(partial_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(output_fd == -1) return;
 
-    // Now perform the handshake
-    if (!perform_handshake(client_socket, info_hash, peer_id, download)) {
-        close(client_socket);
+    if(ftruncate(output_fd, torrent.storage_length) == -1) {
+        close(output_fd);
+        unlink(partial_filename.c_str());
         return;
     }
 
-    // Step 7: Receive and handle the bitfield message
-    if (!handle_bitfield_message(client_socket)) {
-        return; // Failure to handle bitfield message
+    torrent.output_fd = output_fd;
+    torrent.output_filename = filename;
+
+    void* mapped = mmap(nullptr, torrent.storage_length, PROT_READ | PROT_WRITE, MAP_SHARED, output_fd, 0);
+    if(mapped != MAP_FAILED) {
+        munmap(torrent.storage, torrent.storage_length); // Still empty: nothing has been received yet
+        torrent.storage = static_cast<char*>(mapped);
+        torrent.storage_file_backed = true;
+        return;
     }
 
-    // Step 8: Send the interested message
-    if (!send_interested_message(client_socket)) {
-        return; // Failure to send interested message
+    if(!uring_engine_register_output(torrent.io_uring, output_fd, torrent.storage, torrent.storage_length)) {
+        close(output_fd);
+        unlink(partial_filename.c_str());
+        torrent.output_fd = -1;
     }
+}
 
-    // Step 9: Wait for the unchoke message
-    if (!wait_for_unchoke(client_socket)) {
-        return; // Failure to wait for unchoke message
+// Function to make sure the downloaded storage is in 'filename'
+bool save_torrent_download(TorrentDownload& torrent, const std::string& filename) {
+    if(torrent.output_fd != -1 && torrent.output_filename == filename) {
+        bool written = torrent.storage_file_backed || uring_engine_wait_writes(torrent.io_uring);
+        if(!written || rename((filename + ".part").c_str(), filename.c_str()) == -1) {
+            std::cerr << "Failed to write output file: " << filename << std::endl;
+            return false; // finish_torrent_download removes the partial file
+        }
+
+        close(torrent.output_fd);
+        torrent.output_fd = -1;
+        return true;
     }
 
-    // Handshake is complete; now proceed to download a piece
-    if (!download_piece(client_socket, piece_index, piece_length, expected_hash, download_filename)) {
-        close(client_socket);
-        return;
-    }  
-    
-    // Cleanup
-    close(client_socket);
-}
\ No newline at end of file
+    std::ofstream output_file(filename, std::ios::binary);
+    if (!output_file) {
+        std::cerr << "Failed to open output file: " << filename << std::endl;
+        return false;
+    }
+
+    output_file.write(torrent.storage, torrent.storage_length);
+    return true;
+}
+
+// Function to close every connection and release the event loop
+void finish_torrent_download(TorrentDownload& torrent) {
+    for(auto& connection : torrent.connections) {
+        collect_connection_stats(torrent, *connection);
+        if(!torrent.pool || !release_pooled_connection(*torrent.pool, connection)) {
+            close_peer_connection(*connection);
+        }
+    }
+    torrent.connections.clear();
+
+    destroy_uring_engine(torrent.io_uring);
+    torrent.io_uring = nullptr;
+
+    if(torrent.utp) {
+        torrent.stats.utp_packets_sent += torrent.utp->packets_sent;
+        torrent.stats.utp_packets_resent += torrent.utp->packets_resent;
+        destroy_utp_context(torrent.utp);
+        torrent.utp = nullptr;
+    }
+
+    if(torrent.storage) {
+        munmap(torrent.storage, torrent.storage_length);
+        torrent.storage = nullptr;
+    }
+
+    // A partial file that was never saved belongs to a failed download
+    if(torrent.output_fd != -1) {
+        close(torrent.output_fd);
+        unlink((torrent.output_filename + ".part").c_str());
+        torrent.output_fd = -1;
+    }
+
+    destroy_event_loop(torrent.loop);
+}
+
+// Function to download one piece from whichever peers connect first (or pooled connections) and write it to 'download_filename'
+bool complete_piece_download(const std::vector<PeerEndpoint>& peers, const std::string& info_hash, const std::string& peer_id, const std::vector<std::string>& piece_hashes,
+                             int64_t piece_length, int64_t file_length, int piece_index, const std::string& download_filename,
+                             PeerConnectionPool* pool, const DownloadOptions& options) {
+    TorrentDownload torrent;
+    torrent.pool = pool;
+    torrent.options = options;
+    torrent.dialer.config.prefer_utp = options.prefer_utp;
+    if(!init_torrent_download(torrent, info_hash, peer_id, piece_hashes, piece_length, file_length, {piece_index})) {
+        return false;
+    }
+
+    open_torrent_output(torrent, download_filename);
+
+    // Write the piece to disk
+    add_peer_candidates(torrent, peers);
+    bool success = run_torrent_download(torrent) && save_torrent_download(torrent, download_filename);
+    finish_torrent_download(torrent);
+    print_download_stats(torrent);
+
+    return success;
+}
+
+// Function to print transfer counters for the finished download
+void print_download_stats(const TorrentDownload& torrent) {
+    double megabytes = torrent.stats.bytes_received / (1024.0 * 1024.0);
+    std::cerr << "Received " << torrent.stats.bytes_received << " bytes in " << torrent.stats.read_calls << " reads";
+    if(megabytes > 0) {
+        std::cerr << " (" << torrent.stats.read_calls / megabytes << " reads per MiB, "
+                  << 100.0 * torrent.stats.direct_bytes / torrent.stats.bytes_received << "% received straight into storage)";
+    }
+    std::cerr << std::endl;
+    std::cerr << "Sent " << torrent.stats.bytes_sent << " bytes in " << torrent.stats.write_calls << " sends" << std::endl;
+    std::cerr << "Request pipeline depth " << torrent.options.pipeline_depth;
+    if(torrent.options.adaptive_pipeline) {
+        std::cerr << ", adapted per peer within " << torrent.options.min_pipeline_depth << "-" << torrent.options.max_pipeline_depth;
+    }
+    std::cerr << " (at most " << torrent.stats.max_requests_outstanding << " requests in flight to one peer)" << std::endl;
+    if(torrent.stats.endgame_requests > 0) {
+        std::cerr << "Endgame: " << torrent.stats.endgame_requests << " duplicate requests, " << torrent.stats.cancels_sent << " cancelled" << std::endl;
+    }
+    if(torrent.stats.requests_rejected > 0) {
+        std::cerr << "Peers rejected " << torrent.stats.requests_rejected << " requests; each was re-routed" << std::endl;
+    }
+    if(torrent.stats.pex_peers_received > 0 || torrent.stats.pex_messages_sent > 0) {
+        std::cerr << "Peer exchange: " << torrent.stats.pex_peers_received << " new peers learned, " << torrent.stats.pex_messages_sent << " messages sent" << std::endl;
+    }
+    if(torrent.stats.duplicate_bytes > 0) {
+        std::cerr << "Discarded " << torrent.stats.duplicate_bytes << " bytes of blocks already received from another peer" << std::endl;
+    }
+    if(torrent.stats.utp_packets_sent > 0) {
+        std::cerr << "uTP: " << torrent.stats.utp_packets_sent << " packets sent, " << torrent.stats.utp_packets_resent << " retransmitted" << std::endl;
+    }
+    print_peer_tuning(torrent.peer_tuning);
+}
@@ -0,0 +1,88 @@
+#include "EventLoopFunctions.h"
+#include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const int MAX_EVENTS_PER_WAIT = 256;
+
+// Helper function to switch a descriptor to non-blocking mode
+bool set_non_blocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if(flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        std::cerr << "Failed to make descriptor non-blocking: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Function to create the epoll instance behind an event loop
+bool create_event_loop(EventLoop& loop) {
+    loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(loop.epoll_fd == -1) {
+        std::cerr << "Failed to create epoll instance: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void destroy_event_loop(EventLoop& loop) {
+    if(loop.epoll_fd != -1) {
+        close(loop.epoll_fd);
+        loop.epoll_fd = -1;
+    }
+    loop.registrations.clear();
+    loop.token_by_fd.clear();
+}
+
+// Function to register a descriptor; 'events' is combined with EPOLLET
+bool event_loop_add(EventLoop& loop, int fd, uint32_t events, EventHandler handler) {
+    uint64_t token = loop.next_token++;
+
+    epoll_event event = {};
+    event.events = events | EPOLLET;
+    event.data.u64 = token;
+
+    if(epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        std::cerr << "Failed to register descriptor with epoll: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    loop.registrations[token] = {fd, std::move(handler)};
+    loop.token_by_fd[fd] = token;
+    return true;
+}
+
+// Function to unregister a descriptor; must be called before the descriptor is closed
+void event_loop_remove(EventLoop& loop, int fd) {
+    auto found = loop.token_by_fd.find(fd);
+    if(found == loop.token_by_fd.end()) return;
+
+    epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    loop.registrations.erase(found->second);
+    loop.token_by_fd.erase(found);
+}
+
+// Function to wait up to 'timeout_ms' and dispatch every ready event; returns the number dispatched
+int run_event_loop_once(EventLoop& loop, int timeout_ms) {
+    epoll_event events[MAX_EVENTS_PER_WAIT];
+
+    int ready = epoll_wait(loop.epoll_fd, events, MAX_EVENTS_PER_WAIT, timeout_ms);
+    if(ready == -1) {
+        if(errno != EINTR) {
+            std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+        }
+        return 0;
+    }
+
+    for(int i = 0; i < ready; ++i) {
+        // A handler earlier in this batch may have removed this registration
+        auto found = loop.registrations.find(events[i].data.u64);
+        if(found == loop.registrations.end()) continue;
+
+        EventHandler handler = found->second.handler; // Copy: the handler may unregister itself
+        handler(events[i].events);
+    }
+
+    return ready;
+}
@@ -0,0 +1,81 @@
+#include "ExtensionFunctions.h"
+#include "PeerConnectionFunctions.h"
+
+static const uint8_t EXTENDED_MESSAGE_ID = 20;
+static const uint8_t EXTENSION_HANDSHAKE_ID = 0;
+
+// Function to check the extension protocol bit (reserved byte 5, 0x10) in a peer's handshake
+bool peer_supports_extensions(const char* reserved) {
+    return (static_cast<uint8_t>(reserved[5]) & 0x10) != 0;
+}
+
+// Function to check the Fast extension bit (reserved byte 7, 0x04) in a peer's handshake
+bool peer_supports_fast_extension(const char* reserved) {
+    return (static_cast<uint8_t>(reserved[7]) & 0x04) != 0;
+}
+
+// Function to queue an extended message (id 20): the ID the receiver assigned to the extension, then its payload
+void queue_extended_message(PeerConnection& connection, uint8_t extended_id, const std::string& payload) {
+    std::string message(6, '\0');
+    uint32_t message_length = htonl(2 + payload.size());
+    memcpy(message.data(), &message_length, sizeof(message_length));
+    message[4] = EXTENDED_MESSAGE_ID;
+    message[5] = extended_id;
+    message += payload;
+
+    queue_peer_bytes(connection, message.data(), message.size());
+}
+
+// Function to queue our extension handshake; 'reqq' tells the peer how many requests we will queue from it.
+// We can always take ut_metadata messages, but never state a metadata_size: we don't serve the info dictionary.
+void queue_extension_handshake(PeerConnection& connection, uint32_t request_limit) {
+    json handshake = {{"m", {{"ut_metadata", UT_METADATA_ID}, {"ut_pex", UT_PEX_ID}}}, {"reqq", request_limit}, {"v", "bittorrent-cpp"}};
+    queue_extended_message(connection, EXTENSION_HANDSHAKE_ID, bencode(handshake));
+}
+
+// Function to record what a peer's extended message (id 20) says; returns false if it isn't a valid handshake
+bool handle_extension_handshake(PeerConnection& connection, const char* payload, uint32_t payload_length) {
+    if(payload_length < 1 || payload[0] != EXTENSION_HANDSHAKE_ID) {
+        return true; // Extension messages we didn't announce are ignored
+    }
+
+    json handshake;
+    try {
+        std::string encoded(payload + 1, payload_length - 1);
+        int position = 0;
+        handshake = decode_bencoded_value(encoded, position);
+    }
+    catch(const std::exception&) {
+        return false;
+    }
+
+    if(!handshake.is_object()) {
+        return false;
+    }
+
+    PeerExtensions& extensions = connection.extensions;
+    extensions.handshake_received = true;
+    if(handshake.contains("reqq") && handshake["reqq"].is_number_integer() && handshake["reqq"].get<int64_t>() > 0) {
+        extensions.request_limit = static_cast<uint32_t>(std::min<int64_t>(handshake["reqq"].get<int64_t>(), UINT32_MAX));
+    }
+    if(handshake.contains("v") && handshake["v"].is_string()) {
+        extensions.client = handshake["v"].get<std::string>();
+    }
+
+    // 'm' maps extension names to the peer's IDs; a later handshake may change them, and ID 0 disables one
+    if(handshake.contains("m") && handshake["m"].is_object()) {
+        const json& ids = handshake["m"];
+        if(ids.contains("ut_metadata") && ids["ut_metadata"].is_number_integer()) {
+            int64_t id = ids["ut_metadata"].get<int64_t>();
+            extensions.metadata_id = id > 0 && id <= 255 ? static_cast<uint8_t>(id) : 0;
+        }
+        if(ids.contains("ut_pex") && ids["ut_pex"].is_number_integer()) {
+            int64_t id = ids["ut_pex"].get<int64_t>();
+            extensions.pex_id = id > 0 && id <= 255 ? static_cast<uint8_t>(id) : 0;
+        }
+    }
+    if(handshake.contains("metadata_size") && handshake["metadata_size"].is_number_integer() && handshake["metadata_size"].get<int64_t>() > 0) {
+        extensions.metadata_size = handshake["metadata_size"].get<int64_t>();
+    }
+    return true;
+}
@@ -2,19 +2,6 @@
 #include "PeerFunctions.h"
 #include "HandshakeFunctions.h"
 
-//Helper function to split peer's IP and port
-void split_ip_and_port(const std::string& peer, std::string& ip, int& port) {
-    size_t colon_index = peer.find(':');
-
-    if(colon_index == std::string::npos) {
-        std::cerr << "Invalid peer address format." << std::endl;
-        return;
-    }
-
-    ip = peer.substr(0, colon_index);
-    port = std::stoi(peer.substr(colon_index + 1));
-}
-
 // Helper function to receive exactly 'len' bytes from the socket
 ssize_t recv_all(int socket, char* buffer, size_t length) {
     ssize_t total_received = 0;
@@ -35,50 +22,58 @@ ssize_t recv_all(int socket, char* buffer, size_t length) {
 
 
 // Helper function to create a socket
-int create_socket() {
-    int client_socket = socket(AF_INET, SOCK_STREAM, 0);
+int create_socket(int family) {
+    int client_socket = socket(family, SOCK_STREAM, 0);
     if (client_socket == -1) {
         std::cerr << "Failed to create a socket." << std::endl;
     }
     return client_socket;
 }
 
-// Helper function to set up the server address
-bool setup_server_address(const std::string& ip, int port, sockaddr_in& server_address) {
-    memset(&server_address, 0, sizeof(server_address)); // Clear the structure
-    server_address.sin_family = AF_INET;                // IPv4
-    server_address.sin_port = htons(port);              // Convert to network byte order
-    if (inet_pton(AF_INET, ip.c_str(), &server_address.sin_addr) <= 0) {
-        std::cerr << "Invalid IP address." << std::endl;
+// Helper function to connect to the server, giving up after 'timeout_ms' instead of the kernel's SYN retry limit
+bool connect_to_server(int client_socket, const PeerEndpoint& peer, int timeout_ms) {
+    int flags = fcntl(client_socket, F_GETFL, 0);
+    if (flags == -1 || fcntl(client_socket, F_SETFL, flags | O_NONBLOCK) == -1) {
+        std::cerr << "Failed to make socket non-blocking: " << strerror(errno) << std::endl;
         return false;
     }
-    return true;
-}
 
-// Helper function to connect to the server
-bool connect_to_server(int client_socket, const sockaddr_in& server_address) {
-    if (connect(client_socket, (struct sockaddr*)&server_address, sizeof(server_address)) == -1) {
-        std::cerr << "Failed to connect to server." << std::endl;
+    int error = 0;
+    if (connect(client_socket, peer.sockaddr_ptr(), peer.length()) == -1) {
+        if (errno != EINPROGRESS) {
+            error = errno;
+        } else {
+            pollfd poll_fd = {client_socket, POLLOUT, 0};
+            int ready = poll(&poll_fd, 1, timeout_ms);
+            if (ready == 0) {
+                error = ETIMEDOUT;
+            } else if (ready < 0) {
+                error = errno;
+            } else {
+                socklen_t error_length = sizeof(error);
+                getsockopt(client_socket, SOL_SOCKET, SO_ERROR, &error, &error_length);
+            }
+        }
+    }
+
+    if (error != 0) {
+        std::cerr << "Failed to connect to " << format_peer_endpoint(peer) << ": " << strerror(error) << std::endl;
         return false;
     }
+
+    // The handshake command reads and writes with blocking calls
+    fcntl(client_socket, F_SETFL, flags);
     return true;
 }
 
 // Helper function to establish a connection to a server
-int establish_connection(const std::string& ip, int port) {
-    // Step 1: Create a socket
-    int client_socket = create_socket();
+int establish_connection(const PeerEndpoint& peer) {
+    // Step 1: Create a socket for the peer's address family
+    int client_socket = create_socket(peer.family());
     if (client_socket == -1) return -1;
 
-    // Step 2: Set up server address
-    sockaddr_in server_address;
-    if (!setup_server_address(ip, port, server_address)) {
-        close(client_socket);
-        return -1;
-    }
-
-    // Step 3: Connect to the server
-    if (!connect_to_server(client_socket, server_address)) {
+    // Step 2: Connect to the server
+    if (!connect_to_server(client_socket, peer)) {
         close(client_socket);
         return -1;
     }
@@ -87,9 +82,13 @@ int establish_connection(const std::string& ip, int port) {
     return client_socket;
 }
 
-// Helper function to prepare the handshake message
+// Helper function to prepare the handshake message; the reserved bytes advertise the extension protocol (BEP 10)
+// and the Fast extension (BEP 6)
 std::string prepare_handshake_message(const std::string& info_hash, const std::string& peer_id) {
-    return "\x13" + std::string("BitTorrent protocol") + std::string(8, '\0') + hex_to_binary(info_hash) + peer_id;
+    std::string reserved(8, '\0');
+    reserved[5] = 0x10;
+    reserved[7] = 0x04;
+    return "\x13" + std::string("BitTorrent protocol") + reserved + hex_to_binary(info_hash) + peer_id;
 }
 
 // Helper function to send a message
@@ -154,9 +153,9 @@ bool perform_handshake(int client_socket, const std::string& info_hash, const st
 }
 
 // The main complete_handshake function
-void complete_handshake(const std::string& ip, int port, const std::string& info_hash, const std::string& peer_id, bool download) {
+void complete_handshake(const PeerEndpoint& peer, const std::string& info_hash, const std::string& peer_id, bool download) {
     // Establish the connection
-    int client_socket = establish_connection(ip, port);
+    int client_socket = establish_connection(peer);
     if (client_socket == -1) return;  // Connection failed
 
     // Now perform the handshake
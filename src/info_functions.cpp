@@ -60,10 +60,15 @@ std::string bencode(const json& obj) {
 
 // Function to calculate the SHA-1 hash of an input string
 std::string sha1(const std::string& input) {
+    return sha1(input.data(), input.size());
+}
+
+// Function to calculate the SHA-1 hash of a buffer in place, e.g. a piece in download storage
+std::string sha1(const char* data, size_t length) {
     unsigned char hash[SHA_DIGEST_LENGTH]; // Array to hold the hash
 
     // Calculate SHA-1 hash
-    SHA1(reinterpret_cast<const unsigned char*>(input.c_str()), input.length(), hash);
+    SHA1(reinterpret_cast<const unsigned char*>(data), length, hash);
 
     std::ostringstream hex_stream;
 
@@ -75,6 +80,57 @@ std::string sha1(const std::string& input) {
     return hex_stream.str(); // Return the hexadecimal hash
 }
 
+// Function to read the file length, piece length and piece hashes out of an info dictionary, which comes from a
+// torrent file or from peers (ut_metadata); throws if a key is missing
+void read_info_dictionary(const json& info_dict, int64_t& file_length, int64_t& piece_length, std::vector<std::string>& pieces_hashes) {
+    // Extract and display the file length
+    if(info_dict.contains("length")) {
+        file_length = info_dict["length"].get<int64_t>();
+    }
+    else {
+        throw std::runtime_error("Error: Missing 'length' key in dictionary.");
+    }
+
+    //Extract and display the piece length
+    if(info_dict.contains("piece length")) {
+        piece_length = info_dict["piece length"].get<std::int64_t>();
+    }
+    else {
+        throw std::runtime_error("Error: Missing 'piece length' key in dictionary.");
+    }
+    
+    // Check if the "pieces" key exists, which contains concatenated SHA-1 hashes (20 bytes each) for the file's pieces.
+    if(info_dict.contains("pieces")) {
+        // Extract the "pieces" key, which is a concatenated string of 20-byte SHA-1 hashes
+        json pieces = info_dict["pieces"];
+
+        // Convert the json pieces to a string
+        std::string pieces_string = pieces.get<std::string>();
+
+        // Each piece hash is 20 bytes
+        int64_t pieces_size = pieces_string.size();
+        int64_t piece_size = 20;
+
+        // Iterate over the pieces_string, taking chunks of 20 bytes and converting to hexadecimal
+        for(int i = 0; i < pieces_size / piece_size; ++i) {
+            // Extract the 20-byte SHA-1 hash for each piece
+            std::string piece_hash = pieces_string.substr(i * piece_size, piece_size);
+
+            // Convert the piece hash into hexadecimal format for output
+            std::ostringstream oss;
+            for (unsigned char c : piece_hash) {
+                oss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(c);
+            }
+
+            // Push the hexadecimal hash of the piece into the vector
+            pieces_hashes.push_back(oss.str());
+        }
+    }
+    else {
+        throw std::runtime_error("Error: Missing 'pieces' key in dictionary.");
+    }
+}
+
 // Function to handle the info command for reading a torrent file
 void get_info(const std::string& filename, std::string& tracker_url, int64_t& file_length, std::string& info_hash, int64_t& piece_length, 
                       std::vector<std::string>& pieces_hashes) {
@@ -104,56 +160,11 @@ void get_info(const std::string& filename, std::string& tracker_url, int64_t& fi
         if(decoded_value.contains("info")) {
             json info_dict = decoded_value["info"];
 
-            // Extract and display the file length
-            if(info_dict.contains("length")) {
-                file_length = info_dict["length"].get<int64_t>();
-            }
-            else {
-                throw std::runtime_error("Error: Missing 'length' key in dictionary.");
-            }
-
             // Bencode the info dictionary and calculate its SHA-1 hash
             std::string bencoded_info = bencode(info_dict);
             info_hash = sha1(bencoded_info);
 
-            //Extract and display the piece length
-            if(info_dict.contains("piece length")) {
-                piece_length = info_dict["piece length"].get<std::int64_t>();
-            }
-            else {
-                throw std::runtime_error("Error: Missing 'piece length' key in dictionary.");
-            }
-            
-            // Check if the "pieces" key exists, which contains concatenated SHA-1 hashes (20 bytes each) for the file's pieces.
-            if(info_dict.contains("pieces")) {
-                // Extract the "pieces" key, which is a concatenated string of 20-byte SHA-1 hashes
-                json pieces = info_dict["pieces"];
-
-                // Convert the json pieces to a string
-                std::string pieces_string = pieces.get<std::string>();
-
-                // Each piece hash is 20 bytes
-                int64_t pieces_size = pieces_string.size();
-                int64_t piece_size = 20;
-
-                // Iterate over the pieces_string, taking chunks of 20 bytes and converting to hexadecimal
-                for(int i = 0; i < pieces_size / piece_size; ++i) {
-                    // Extract the 20-byte SHA-1 hash for each piece
-                    std::string piece_hash = pieces_string.substr(i * piece_size, piece_size);
-
-                    // Convert the piece hash into hexadecimal format for output
-                    std::ostringstream oss;
-                    for (unsigned char c : piece_hash) {
-                        oss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(c);
-                    }
-
-                    // Push the hexadecimal hash of the piece into the vector
-                    pieces_hashes.push_back(oss.str());
-                }
-            }
-            else {
-                throw std::runtime_error("Error: Missing 'pieces' key in dictionary.");
-            }
+            read_info_dictionary(info_dict, file_length, piece_length, pieces_hashes);
         }
         else {
             throw std::runtime_error("Error: Missing 'info' dictionary in torrent file.");
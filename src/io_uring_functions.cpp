@@ -0,0 +1,533 @@
+#include "IoUringFunctions.h"
+#include "DownloadPieceFunctions.h"
+
+#ifdef BITTORRENT_USE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+static const unsigned RING_ENTRIES = 256;
+static const unsigned RECV_BUFFER_COUNT = 256; // Must be a power of two
+static const unsigned RECV_BUFFER_SIZE = 64 * 1024;
+static const int RECV_BUFFER_GROUP = 1;
+static const int OUTPUT_FILE_INDEX = 0;        // Slot in the registered file table
+static const int STORAGE_BUFFER_INDEX = 0;     // Slot in the registered buffer table
+
+// The low byte of user_data says which operation completed, the rest is a connection or write id
+enum UringOperation : uint64_t {
+    UringRecv = 1,
+    UringSend = 2,
+    UringWrite = 3,
+    UringCancel = 4
+};
+
+struct PendingSend {
+    std::string data;
+    size_t offset = 0;
+};
+
+struct PendingWrite {
+    const char* data = nullptr;
+    size_t length = 0;
+    int64_t file_offset = 0;
+};
+
+// The rings shared with the kernel, mapped from the ring fd. Head and tail words are written by one side and read
+// by the other, so they are only accessed atomically; everything else is set up once.
+struct UringQueues {
+    int ring_fd = -1;
+    void* sq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    void* cq_ring = MAP_FAILED;  // Same mapping as sq_ring on kernels with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned sqe_tail = 0;       // Entries handed out so far; published to sq_tail on submit
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+struct IoUringEngine {
+    UringQueues ring;
+    io_uring_buf_ring* buffer_ring = nullptr;
+    size_t buffer_ring_size = 0;
+    char* buffer_memory = nullptr;
+    int event_fd = -1;
+    EventLoop* loop = nullptr;
+
+    uint64_t next_connection_id = 1;
+    std::unordered_map<uint64_t, PeerConnection*> connections;
+    std::unordered_map<uint64_t, PendingSend> sends;   // Kept until the kernel is done with the bytes
+
+    bool output_registered = false;
+    uint64_t next_write_id = 1;
+    std::unordered_map<uint64_t, PendingWrite> writes;
+    bool write_failed = false;
+};
+
+// Helper function to make an io_uring_register call; returns 0 or a negative errno like the kernel
+static int ring_register(UringQueues& ring, unsigned opcode, const void* argument, unsigned count) {
+    int result = static_cast<int>(syscall(__NR_io_uring_register, ring.ring_fd, opcode, argument, count));
+    return result < 0 ? -errno : result;
+}
+
+// Helper function to create the ring and map its submission queue, completion queue and submission entries
+static int setup_ring_queues(UringQueues& ring, unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring.ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if(ring.ring_fd < 0) {
+        ring.ring_fd = -1;
+        return -errno;
+    }
+
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mapping = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mapping) {
+        ring.sq_ring_size = ring.cq_ring_size = std::max(ring.sq_ring_size, ring.cq_ring_size);
+    }
+
+    ring.sq_ring = mmap(nullptr, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.ring_fd, IORING_OFF_SQ_RING);
+    if(ring.sq_ring == MAP_FAILED) return -errno;
+    ring.cq_ring = single_mapping ? ring.sq_ring
+                                  : mmap(nullptr, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.ring_fd, IORING_OFF_CQ_RING);
+    if(ring.cq_ring == MAP_FAILED) return -errno;
+    ring.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring.sqes = static_cast<io_uring_sqe*>(mmap(nullptr, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.ring_fd, IORING_OFF_SQES));
+    if(ring.sqes == MAP_FAILED) return -errno;
+
+    char* sq = static_cast<char*>(ring.sq_ring);
+    ring.sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    ring.sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    ring.sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    ring.sq_entries = params.sq_entries;
+    ring.sqe_tail = *ring.sq_tail;
+
+    // Slot i of the queue always names entry i, so the index array is filled once
+    unsigned* sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for(unsigned index = 0; index < params.sq_entries; ++index) {
+        sq_array[index] = index;
+    }
+
+    char* cq = static_cast<char*>(ring.cq_ring);
+    ring.cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    ring.cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    ring.cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    ring.cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return 0;
+}
+
+// Helper function to unmap the queues and close the ring; the kernel cancels whatever is still in flight
+static void close_ring_queues(UringQueues& ring) {
+    if(ring.sqes != MAP_FAILED) munmap(ring.sqes, ring.sqes_size);
+    if(ring.cq_ring != MAP_FAILED && ring.cq_ring != ring.sq_ring) munmap(ring.cq_ring, ring.cq_ring_size);
+    if(ring.sq_ring != MAP_FAILED) munmap(ring.sq_ring, ring.sq_ring_size);
+    if(ring.ring_fd != -1) close(ring.ring_fd);
+    ring = UringQueues{};
+}
+
+// Helper function to publish the prepared entries and enter the kernel, optionally waiting for completions
+static int submit_ring(UringQueues& ring, unsigned wait_for) {
+    std::atomic_ref<unsigned>(*ring.sq_tail).store(ring.sqe_tail, std::memory_order_release);
+    unsigned pending = ring.sqe_tail - std::atomic_ref<unsigned>(*ring.sq_head).load(std::memory_order_acquire);
+    if(pending == 0 && wait_for == 0) {
+        return 0;
+    }
+
+    unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int result = static_cast<int>(syscall(__NR_io_uring_enter, ring.ring_fd, pending, wait_for, flags, nullptr, 0));
+    return result < 0 ? -errno : result;
+}
+
+// Helper function to make a provided buffer the kernel's to fill again
+static void recycle_recv_buffer(IoUringEngine* engine, unsigned buffer_id) {
+    std::atomic_ref<__u16> tail(engine->buffer_ring->tail);
+    __u16 position = tail.load(std::memory_order_relaxed);
+    // Not buffer_ring->bufs: compiled as C++, the header's flexible array sits after a 1-byte empty struct, 8 bytes
+    // past where the kernel reads. Entry 0 starts at the ring itself, its last bytes doubling as the tail.
+    io_uring_buf& buffer = reinterpret_cast<io_uring_buf*>(engine->buffer_ring)[position & (RECV_BUFFER_COUNT - 1)];
+    buffer.addr = reinterpret_cast<uint64_t>(engine->buffer_memory + static_cast<size_t>(buffer_id) * RECV_BUFFER_SIZE);
+    buffer.len = RECV_BUFFER_SIZE;
+    buffer.bid = static_cast<__u16>(buffer_id);
+    tail.store(position + 1, std::memory_order_release);
+}
+
+// Helper function to map and register the provided buffer ring the multishot receives pick buffers from
+static bool setup_buffer_ring(IoUringEngine* engine) {
+    engine->buffer_ring_size = RECV_BUFFER_COUNT * sizeof(io_uring_buf);
+    void* ring_memory = mmap(nullptr, engine->buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ring_memory == MAP_FAILED) return false;
+    engine->buffer_ring = static_cast<io_uring_buf_ring*>(ring_memory);
+
+    io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<uint64_t>(ring_memory);
+    registration.ring_entries = RECV_BUFFER_COUNT;
+    registration.bgid = RECV_BUFFER_GROUP;
+    if(ring_register(engine->ring, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) return false;
+
+    for(unsigned buffer_id = 0; buffer_id < RECV_BUFFER_COUNT; ++buffer_id) {
+        recycle_recv_buffer(engine, buffer_id);
+    }
+    return true;
+}
+
+// Helper function to pack an operation and its id into a completion's user_data
+static uint64_t make_user_data(uint64_t id, UringOperation operation) {
+    return (id << 8) | operation;
+}
+
+// Helper function to get a cleared submission entry, submitting the queued ones if the ring is full
+static io_uring_sqe* get_submission(IoUringEngine* engine) {
+    UringQueues& ring = engine->ring;
+    if(ring.sqe_tail - std::atomic_ref<unsigned>(*ring.sq_head).load(std::memory_order_acquire) >= ring.sq_entries) {
+        submit_ring(ring, 0);
+        if(ring.sqe_tail - std::atomic_ref<unsigned>(*ring.sq_head).load(std::memory_order_acquire) >= ring.sq_entries) {
+            return nullptr;
+        }
+    }
+
+    io_uring_sqe* sqe = &ring.sqes[ring.sqe_tail & ring.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++ring.sqe_tail;
+    return sqe;
+}
+
+// Helper function to arm one multishot receive that keeps filling provided buffers
+static bool submit_recv(IoUringEngine* engine, PeerConnection& connection) {
+    io_uring_sqe* sqe = get_submission(engine);
+    if(!sqe) return false;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = connection.socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_BUFFER_GROUP;
+    sqe->user_data = make_user_data(connection.uring_id, UringRecv);
+    return true;
+}
+
+// Helper function to (re)submit the unsent part of a connection's in-flight send
+static bool submit_send(IoUringEngine* engine, PeerConnection& connection, PendingSend& pending) {
+    io_uring_sqe* sqe = get_submission(engine);
+    if(!sqe) return false;
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = connection.socket;
+    sqe->addr = reinterpret_cast<uint64_t>(pending.data.data() + pending.offset);
+    sqe->len = static_cast<uint32_t>(pending.data.size() - pending.offset);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = make_user_data(connection.uring_id, UringSend);
+    ++connection.write_calls;
+    return true;
+}
+
+// Helper function to (re)submit a piece write from registered storage to the registered output file
+static bool submit_write(IoUringEngine* engine, uint64_t write_id, const PendingWrite& write) {
+    io_uring_sqe* sqe = get_submission(engine);
+    if(!sqe) return false;
+
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = OUTPUT_FILE_INDEX;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = reinterpret_cast<uint64_t>(write.data);
+    sqe->len = static_cast<uint32_t>(write.length);
+    sqe->off = write.file_offset;
+    sqe->buf_index = STORAGE_BUFFER_INDEX;
+    sqe->user_data = make_user_data(write_id, UringWrite);
+    return true;
+}
+
+// Helper function to handle data (or the end of data) from a multishot receive. The kernel picks the buffer, so
+// piece payloads can't land in storage directly: append_peer_inbound copies them out of the provided buffer into
+// the pending direct block. That is one memcpy per block, traded for not re-arming a receive per message.
+static void handle_recv_completion(IoUringEngine* engine, uint64_t connection_id, const io_uring_cqe* cqe) {
+    auto found = engine->connections.find(connection_id);
+    PeerConnection* connection = found == engine->connections.end() ? nullptr : found->second;
+
+    if(cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if(connection && cqe->res > 0) {
+            append_peer_inbound(*connection, engine->buffer_memory + static_cast<size_t>(buffer_id) * RECV_BUFFER_SIZE, cqe->res);
+        }
+        recycle_recv_buffer(engine, buffer_id);
+    }
+
+    if(!connection) return; // Completion for a connection that has been closed meanwhile
+
+    bool peer_closed = cqe->res == 0;
+    process_peer_inbound(*connection, peer_closed);
+    if(connection->state == PeerConnectionState::Closed || (cqe->flags & IORING_CQE_F_MORE)) return;
+
+    // The multishot receive ended: re-arm it if it only ran out of buffers, otherwise the socket failed
+    if(cqe->res == -ENOBUFS || cqe->res > 0) {
+        if(!submit_recv(engine, *connection)) close_peer_connection(*connection, "io_uring submission queue full");
+    }
+    else if(cqe->res < 0) {
+        close_peer_connection(*connection, std::string("recv failed: ") + strerror(-cqe->res));
+    }
+}
+
+// Helper function to continue or finish a connection's send
+static void handle_send_completion(IoUringEngine* engine, uint64_t connection_id, const io_uring_cqe* cqe) {
+    auto pending = engine->sends.find(connection_id);
+    if(pending == engine->sends.end()) return;
+
+    auto found = engine->connections.find(connection_id);
+    PeerConnection* connection = found == engine->connections.end() ? nullptr : found->second;
+
+    if(cqe->res < 0 || !connection) {
+        engine->sends.erase(pending);
+        if(connection) close_peer_connection(*connection, std::string("send failed: ") + strerror(-cqe->res));
+        return;
+    }
+
+    pending->second.offset += cqe->res;
+    connection->bytes_sent += cqe->res;
+    if(pending->second.offset < pending->second.data.size()) {
+        if(!submit_send(engine, *connection, pending->second)) close_peer_connection(*connection, "io_uring submission queue full");
+        return;
+    }
+
+    // Everything went out; bytes queued meanwhile go in the next send
+    engine->sends.erase(pending);
+    uring_engine_flush_connection(engine, *connection);
+}
+
+// Helper function to account for a finished piece write
+static void handle_write_completion(IoUringEngine* engine, uint64_t write_id, const io_uring_cqe* cqe) {
+    auto found = engine->writes.find(write_id);
+    if(found == engine->writes.end()) return;
+
+    if(cqe->res <= 0) {
+        std::cerr << "Failed to write to output file: " << strerror(cqe->res == 0 ? EIO : -cqe->res) << std::endl;
+        engine->write_failed = true;
+        engine->writes.erase(found);
+        return;
+    }
+
+    PendingWrite& write = found->second;
+    if(static_cast<size_t>(cqe->res) < write.length) {
+        write.data += cqe->res;
+        write.length -= cqe->res;
+        write.file_offset += cqe->res;
+        if(submit_write(engine, write_id, write)) return;
+        engine->write_failed = true;
+    }
+
+    engine->writes.erase(found);
+}
+
+// Helper function to dispatch every completion currently in the ring
+static void process_completions(IoUringEngine* engine) {
+    UringQueues& ring = engine->ring;
+    std::atomic_ref<unsigned> cq_head(*ring.cq_head);
+    unsigned head = cq_head.load(std::memory_order_relaxed);
+    unsigned tail = std::atomic_ref<unsigned>(*ring.cq_tail).load(std::memory_order_acquire);
+
+    for(; head != tail; ++head) {
+        const io_uring_cqe* cqe = &ring.cqes[head & ring.cq_mask];
+        uint64_t user_data = cqe->user_data;
+        uint64_t id = user_data >> 8;
+
+        switch(user_data & 0xff) {
+            case UringRecv: handle_recv_completion(engine, id, cqe); break;
+            case UringSend: handle_send_completion(engine, id, cqe); break;
+            case UringWrite: handle_write_completion(engine, id, cqe); break;
+            default: break; // Cancellation results
+        }
+    }
+
+    cq_head.store(head, std::memory_order_release);
+}
+
+// Function to set up a ring with a provided receive buffer ring, completions signalled through the event loop.
+// Returns nullptr (and the caller keeps using epoll) if the kernel lacks io_uring or buffer rings.
+IoUringEngine* create_uring_engine(EventLoop& loop) {
+    auto engine = new IoUringEngine();
+    engine->loop = &loop;
+
+    int result = setup_ring_queues(engine->ring, RING_ENTRIES);
+    if(result < 0) {
+        std::cerr << "io_uring unavailable (" << strerror(-result) << "); using epoll." << std::endl;
+        destroy_uring_engine(engine);
+        return nullptr;
+    }
+
+    size_t buffer_memory_length = static_cast<size_t>(RECV_BUFFER_COUNT) * RECV_BUFFER_SIZE;
+    void* buffer_memory = mmap(nullptr, buffer_memory_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    engine->buffer_memory = buffer_memory == MAP_FAILED ? nullptr : static_cast<char*>(buffer_memory);
+    engine->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if(!engine->buffer_memory || !setup_buffer_ring(engine) || engine->event_fd == -1 ||
+       ring_register(engine->ring, IORING_REGISTER_EVENTFD, &engine->event_fd, 1) < 0) {
+        std::cerr << "io_uring provided buffers unavailable; using epoll." << std::endl;
+        destroy_uring_engine(engine);
+        return nullptr;
+    }
+
+    IoUringEngine* engine_ptr = engine;
+    if(!event_loop_add(loop, engine->event_fd, EPOLLIN, [engine_ptr](uint32_t) {
+        uint64_t count;
+        while(read(engine_ptr->event_fd, &count, sizeof(count)) > 0) {}
+        process_completions(engine_ptr);
+    })) {
+        close(engine->event_fd);
+        engine->event_fd = -1;
+        destroy_uring_engine(engine);
+        return nullptr;
+    }
+
+    return engine;
+}
+
+// Function to tear the ring down; closing it releases the buffer ring and registrations, and cancels what's in flight
+void destroy_uring_engine(IoUringEngine* engine) {
+    if(!engine) return;
+
+    if(engine->event_fd != -1) {
+        event_loop_remove(*engine->loop, engine->event_fd);
+        close(engine->event_fd);
+    }
+
+    close_ring_queues(engine->ring);
+    if(engine->buffer_ring) munmap(engine->buffer_ring, engine->buffer_ring_size);
+    if(engine->buffer_memory) munmap(engine->buffer_memory, static_cast<size_t>(RECV_BUFFER_COUNT) * RECV_BUFFER_SIZE);
+    delete engine;
+}
+
+// Function to move a connected socket from epoll readiness to io_uring completions
+bool uring_engine_attach_connection(IoUringEngine* engine, PeerConnection& connection) {
+    if(!engine) return false;
+
+    connection.uring_id = engine->next_connection_id++;
+    if(!submit_recv(engine, connection)) return false;
+
+    event_loop_remove(*connection.loop, connection.socket);
+    engine->connections[connection.uring_id] = &connection;
+    connection.uses_io_uring = true;
+
+    uring_engine_flush_connection(engine, connection);
+    return true;
+}
+
+// Function to stop delivering completions to a connection that is being closed
+void uring_engine_detach_connection(IoUringEngine* engine, PeerConnection& connection) {
+    engine->connections.erase(connection.uring_id);
+
+    // The in-flight receive holds its own file reference, so the socket can be closed right after this
+    io_uring_sqe* sqe = get_submission(engine);
+    if(sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = make_user_data(connection.uring_id, UringRecv);
+        sqe->user_data = make_user_data(connection.uring_id, UringCancel);
+    }
+    connection.uses_io_uring = false;
+}
+
+// Function to hand a connection's queued bytes to the ring; one send per connection is in flight at a time
+void uring_engine_flush_connection(IoUringEngine* engine, PeerConnection& connection) {
+    if(connection.outbound.size() == connection.outbound_offset || engine->sends.count(connection.uring_id)) {
+        return;
+    }
+
+    PendingSend& pending = engine->sends[connection.uring_id];
+    pending.data.swap(connection.outbound);
+    pending.offset = connection.outbound_offset;
+    connection.outbound.clear();
+    connection.outbound_offset = 0;
+
+    if(!submit_send(engine, connection, pending)) {
+        engine->sends.erase(connection.uring_id);
+        close_peer_connection(connection, "io_uring submission queue full");
+    }
+}
+
+// Function to register the download storage and output file so piece writes skip per-I/O page pinning and fd lookups
+bool uring_engine_register_output(IoUringEngine* engine, int file_fd, char* storage, size_t storage_length) {
+    if(!engine) return false;
+
+    iovec storage_buffer = {storage, storage_length};
+    if(ring_register(engine->ring, IORING_REGISTER_BUFFERS, &storage_buffer, 1) < 0) {
+        return false; // Usually RLIMIT_MEMLOCK; the caller writes the file at the end instead
+    }
+
+    if(ring_register(engine->ring, IORING_REGISTER_FILES, &file_fd, 1) < 0) {
+        ring_register(engine->ring, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+        return false;
+    }
+
+    engine->output_registered = true;
+    return true;
+}
+
+// Function to queue a write of verified storage bytes to the registered output file
+bool uring_engine_write(IoUringEngine* engine, const char* data, size_t length, int64_t file_offset) {
+    if(!engine || !engine->output_registered) return false;
+
+    uint64_t write_id = engine->next_write_id++;
+    PendingWrite& write = engine->writes[write_id] = {data, length, file_offset};
+    if(!submit_write(engine, write_id, write)) {
+        engine->writes.erase(write_id);
+        return false;
+    }
+    return true;
+}
+
+// Function to submit everything prepared during this loop iteration with a single syscall
+void uring_engine_submit(IoUringEngine* engine) {
+    if(engine) submit_ring(engine->ring, 0);
+}
+
+// Function to wait until every queued piece write has reached the file
+bool uring_engine_wait_writes(IoUringEngine* engine) {
+    if(!engine) return true;
+
+    while(!engine->writes.empty()) {
+        int result = submit_ring(engine->ring, 1);
+        if(result < 0 && result != -EINTR) {
+            std::cerr << "io_uring wait failed: " << strerror(-result) << std::endl;
+            return false;
+        }
+        process_completions(engine);
+    }
+
+    return !engine->write_failed;
+}
+
+#else
+
+// Built without io_uring: report it unavailable so every caller stays on the epoll path
+IoUringEngine* create_uring_engine(EventLoop&) { return nullptr; }
+void destroy_uring_engine(IoUringEngine*) {}
+bool uring_engine_attach_connection(IoUringEngine*, PeerConnection&) { return false; }
+void uring_engine_detach_connection(IoUringEngine*, PeerConnection&) {}
+void uring_engine_flush_connection(IoUringEngine*, PeerConnection&) {}
+bool uring_engine_register_output(IoUringEngine*, int, char*, size_t) { return false; }
+bool uring_engine_write(IoUringEngine*, const char*, size_t, int64_t) { return false; }
+void uring_engine_submit(IoUringEngine*) {}
+bool uring_engine_wait_writes(IoUringEngine*) { return true; }
+
+#endif
@@ -0,0 +1,161 @@
+#include "MagnetFunctions.h"
+#include <algorithm>
+
+// Helper function to percent-decode a magnet link parameter ('+' is a space, as in a query string)
+static std::string url_decode(std::string value) {
+    std::replace(value.begin(), value.end(), '+', ' ');
+
+    CURL *curl = curl_easy_init();
+    std::string result = "";
+
+    if(curl) {
+        int length = 0;
+        char *output = curl_easy_unescape(curl, value.c_str(), value.length(), &length);
+        if (output) {
+            result.assign(output, length);
+            curl_free(output);
+        }
+        curl_easy_cleanup(curl);
+    }
+
+    return result;
+}
+
+// Helper function to convert a base32 info hash (32 characters, RFC 4648 alphabet) into hexadecimal
+static bool base32_to_hex(const std::string& base32, std::string& hex) {
+    static const char* digits = "0123456789abcdef";
+    std::string binary;
+    uint32_t buffer = 0;
+    int bits = 0;
+
+    for(char c : base32) {
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        int value;
+        if(c >= 'A' && c <= 'Z') value = c - 'A';
+        else if(c >= '2' && c <= '7') value = c - '2' + 26;
+        else return false;
+
+        buffer = (buffer << 5) | value;
+        bits += 5;
+        if(bits >= 8) {
+            bits -= 8;
+            binary.push_back(static_cast<char>((buffer >> bits) & 0xff));
+        }
+    }
+
+    hex.clear();
+    for(unsigned char byte : binary) {
+        hex.push_back(digits[byte >> 4]);
+        hex.push_back(digits[byte & 0x0f]);
+    }
+    return binary.size() == 20;
+}
+
+// Function to parse a magnet link (magnet:?xt=urn:btih:<info hash>&dn=...&tr=...&x.pe=...). The info hash may be
+// 40 hexadecimal or 32 base32 characters; unknown parameters are ignored, and peers that don't parse are skipped.
+bool parse_magnet_link(const std::string& uri, MagnetLink& magnet) {
+    const std::string prefix = "magnet:?";
+    if(uri.compare(0, prefix.size(), prefix) != 0) {
+        std::cerr << "Invalid magnet link: it must start with " << prefix << std::endl;
+        return false;
+    }
+
+    magnet = MagnetLink{};
+    std::stringstream parameters(uri.substr(prefix.size()));
+    std::string parameter;
+    while(std::getline(parameters, parameter, '&')) {
+        size_t equals = parameter.find('=');
+        if(equals == std::string::npos) continue;
+
+        std::string key = parameter.substr(0, equals);
+        std::string value = url_decode(parameter.substr(equals + 1));
+
+        if(key == "xt" && value.compare(0, 9, "urn:btih:") == 0) {
+            std::string hash = value.substr(9);
+            if(hash.size() == 40 && std::all_of(hash.begin(), hash.end(), [](unsigned char c) { return std::isxdigit(c); })) {
+                std::transform(hash.begin(), hash.end(), hash.begin(), [](unsigned char c) { return std::tolower(c); });
+                magnet.info_hash = hash;
+            }
+            else if(hash.size() != 32 || !base32_to_hex(hash, magnet.info_hash)) {
+                std::cerr << "Invalid info hash in magnet link: " << hash << std::endl;
+                return false;
+            }
+        }
+        else if(key == "dn") {
+            magnet.display_name = value;
+        }
+        else if(key == "tr") {
+            magnet.trackers.push_back(value);
+        }
+        else if(key == "x.pe") {
+            PeerEndpoint peer;
+            if(parse_peer_endpoint(value, peer)) {
+                magnet.peers.push_back(peer);
+            }
+        }
+    }
+
+    if(magnet.info_hash.empty()) {
+        std::cerr << "Magnet link has no BitTorrent info hash (xt=urn:btih:...)." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Function to fetch the info dictionary of 'info_hash' from the given peers (ut_metadata, BEP 9) and check it against
+// the hash. With a pool, the connections are kept open for the download that follows.
+bool fetch_torrent_metadata(const std::vector<PeerEndpoint>& peers, const std::string& info_hash, const std::string& peer_id, std::string& metadata,
+                            PeerConnectionPool* pool, const DownloadOptions& options) {
+    TorrentDownload torrent;
+    torrent.pool = pool;
+    torrent.options = options;
+    torrent.dialer.config.prefer_utp = options.prefer_utp;
+    if(!init_metadata_download(torrent, info_hash, peer_id)) {
+        return false;
+    }
+
+    add_peer_candidates(torrent, peers);
+    bool success = run_torrent_download(torrent);
+    finish_torrent_download(torrent);
+
+    if(!success) {
+        std::cerr << "Failed to fetch the metadata (" << torrent.dialer.failures << " of " << torrent.dialer.attempts << " peer attempts failed)." << std::endl;
+        return false;
+    }
+
+    std::cerr << "Fetched " << torrent.metadata.size << " bytes of metadata in " << torrent.metadata.received.size() << " pieces" << std::endl;
+    metadata = std::move(torrent.metadata.data);
+    return true;
+}
+
+// Function to download the file a magnet link names: the metadata first, then every piece over the same connections
+bool complete_magnet_download(const std::vector<PeerEndpoint>& peers, const std::string& info_hash, const std::string& peer_id, const std::string& download_filename,
+                              int64_t& file_length, const DownloadOptions& options) {
+    // Step 1: Fetch the info dictionary; it was checked against the info hash, so it is the torrent's
+    PeerConnectionPool pool;
+    std::string metadata;
+    if(!fetch_torrent_metadata(peers, info_hash, peer_id, metadata, &pool, options)) {
+        close_pooled_connections(pool);
+        return false;
+    }
+
+    // Step 2: Read the piece layout out of it
+    int64_t piece_length = 0;
+    std::vector<std::string> piece_hashes;
+    try {
+        int position = 0;
+        json info_dict = decode_bencoded_value(metadata, position);
+        read_info_dictionary(info_dict, file_length, piece_length, piece_hashes);
+    }
+    catch(const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        close_pooled_connections(pool);
+        return false;
+    }
+
+    // Step 3: Download the pieces, resuming the connections the metadata came over
+    bool success = complete_file_download(peers, info_hash, peer_id, piece_hashes, piece_length, file_length, download_filename, &pool, options);
+    close_pooled_connections(pool);
+    return success;
+}
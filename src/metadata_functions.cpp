@@ -0,0 +1,188 @@
+#include "MetadataFunctions.h"
+#include "DownloadPieceFunctions.h"
+#include <algorithm>
+
+static const size_t METADATA_REQUESTS_PER_PEER = 2;
+static const int MAX_METADATA_HASH_FAILURES = 3;
+
+static const int METADATA_REQUEST = 0;
+static const int METADATA_DATA = 1;
+static const int METADATA_REJECT = 2;
+
+// Function to set up a download that only fetches the info dictionary: no pieces and no storage until it's known
+bool init_metadata_download(TorrentDownload& torrent, const std::string& info_hash, const std::string& peer_id) {
+    torrent.info_hash = info_hash;
+    torrent.peer_id = peer_id;
+    torrent.metadata = MetadataDownload{};
+    torrent.metadata.active = true;
+    init_bitfield(torrent.finished_pieces, 0);
+    init_piece_picker(torrent.picker, {});
+
+    return create_event_loop(torrent.loop);
+}
+
+// Helper function to queue a ut_metadata message without data (a request or a reject) for one piece
+static void queue_metadata_message(PeerConnection& connection, int message_type, int64_t piece) {
+    json message = {{"msg_type", message_type}, {"piece", piece}};
+    queue_extended_message(connection, connection.extensions.metadata_id, bencode(message));
+}
+
+// Function to ask the peer for metadata pieces, up to a few at once. Pieces nobody has been asked for come first,
+// so each peer fetches different ones; a piece already asked of another peer is only requested again by an idle
+// peer (and from no more peers than an endgame block), so one that never answers can't stall the fetch.
+void request_metadata_pieces(TorrentDownload& torrent, PeerConnection& connection) {
+    MetadataDownload& metadata = torrent.metadata;
+    if(!metadata.active || metadata.complete || metadata.size == 0 || connection.state != PeerConnectionState::Active ||
+       connection.extensions.metadata_id == 0 || connection.metadata_rejected) {
+        return;
+    }
+    if(connection.extensions.metadata_size != 0 && connection.extensions.metadata_size != metadata.size) {
+        return; // It would send pieces of a different dictionary
+    }
+
+    while(connection.metadata_requests.size() < METADATA_REQUESTS_PER_PEER) {
+        int best = -1;
+        for(int piece = 0; piece < static_cast<int>(metadata.received.size()); ++piece) {
+            if(metadata.received[piece] || (best != -1 && metadata.requests[piece] >= metadata.requests[best])) continue;
+            if(std::find(connection.metadata_requests.begin(), connection.metadata_requests.end(), piece) != connection.metadata_requests.end()) continue;
+            best = piece;
+        }
+        if(best == -1 || (metadata.requests[best] > 0 && !connection.metadata_requests.empty()) ||
+           metadata.requests[best] >= torrent.options.endgame_max_requests) {
+            return;
+        }
+
+        queue_metadata_message(connection, METADATA_REQUEST, best);
+        connection.metadata_requests.push_back(best);
+        ++metadata.requests[best];
+    }
+}
+
+// Function called after a peer's extension handshake while the metadata is fetched. The first peer to state a
+// metadata_size sizes the fetch, and every connection that supports ut_metadata then gets its first requests.
+void on_metadata_peer_handshake(TorrentDownload& torrent, PeerConnection& connection) {
+    MetadataDownload& metadata = torrent.metadata;
+    int64_t size = connection.extensions.metadata_size;
+    if(!metadata.active || metadata.size != 0 || connection.extensions.metadata_id == 0 || size <= 0 || size > MAX_METADATA_SIZE) {
+        request_metadata_pieces(torrent, connection);
+        return;
+    }
+
+    size_t pieces = (size + METADATA_PIECE_SIZE - 1) / METADATA_PIECE_SIZE;
+    metadata.size = size;
+    metadata.data.assign(size, '\0');
+    metadata.received.assign(pieces, 0);
+    metadata.requests.assign(pieces, 0);
+    metadata.pieces_remaining = static_cast<int>(pieces);
+
+    for(auto& other : torrent.connections) {
+        request_metadata_pieces(torrent, *other);
+    }
+}
+
+// Helper function to check the assembled metadata against the info hash; on a mismatch every piece is fetched again
+static void verify_metadata(TorrentDownload& torrent) {
+    MetadataDownload& metadata = torrent.metadata;
+    if(sha1(metadata.data) == torrent.info_hash) {
+        metadata.complete = true;
+        return;
+    }
+
+    ++metadata.hash_failures;
+    std::cerr << "Metadata doesn't match the info hash";
+    if(metadata.hash_failures >= MAX_METADATA_HASH_FAILURES) {
+        std::cerr << "; giving up after " << metadata.hash_failures << " attempts." << std::endl;
+        return;
+    }
+    std::cerr << "; fetching it again." << std::endl;
+
+    std::fill(metadata.received.begin(), metadata.received.end(), 0);
+    metadata.pieces_remaining = static_cast<int>(metadata.received.size());
+    for(auto& connection : torrent.connections) {
+        request_metadata_pieces(torrent, *connection);
+    }
+}
+
+// Function to handle a ut_metadata message: a bencoded dictionary, followed by the piece's bytes for data messages.
+// Requests from the peer are rejected, since we never state a metadata_size; a reject stops us asking that peer.
+void handle_metadata_message(TorrentDownload& torrent, PeerConnection& connection, const char* payload, uint32_t payload_length) {
+    json message;
+    int position = 0;
+    try {
+        message = decode_bencoded_value(std::string(payload, payload_length), position);
+    }
+    catch(const std::exception&) {
+        close_peer_connection(connection, "invalid ut_metadata message");
+        return;
+    }
+
+    if(!message.is_object() || !message.contains("msg_type") || !message["msg_type"].is_number_integer() ||
+       !message.contains("piece") || !message["piece"].is_number_integer()) {
+        close_peer_connection(connection, "invalid ut_metadata message");
+        return;
+    }
+
+    int64_t message_type = message["msg_type"].get<int64_t>();
+    int64_t piece = message["piece"].get<int64_t>();
+    if(message_type == METADATA_REQUEST) {
+        if(connection.extensions.metadata_id != 0) queue_metadata_message(connection, METADATA_REJECT, piece);
+        return;
+    }
+    if(message_type != METADATA_DATA && message_type != METADATA_REJECT) {
+        return; // Unknown types are ignored
+    }
+
+    auto request = std::find(connection.metadata_requests.begin(), connection.metadata_requests.end(), piece);
+    if(request == connection.metadata_requests.end()) {
+        return; // Not asked of this peer (or asked during an earlier download)
+    }
+    connection.metadata_requests.erase(request);
+
+    MetadataDownload& metadata = torrent.metadata;
+    --metadata.requests[piece];
+    if(message_type == METADATA_REJECT) {
+        connection.metadata_rejected = true;
+        for(auto& other : torrent.connections) {
+            if(other.get() != &connection) request_metadata_pieces(torrent, *other);
+        }
+        return;
+    }
+
+    int64_t offset = piece * METADATA_PIECE_SIZE;
+    int64_t length = std::min(METADATA_PIECE_SIZE, metadata.size - offset);
+    if(!message.contains("total_size") || !message["total_size"].is_number_integer() || message["total_size"].get<int64_t>() != metadata.size ||
+       static_cast<int64_t>(payload_length) - position != length) {
+        close_peer_connection(connection, "ut_metadata piece of the wrong size");
+        return;
+    }
+
+    if(!metadata.received[piece]) {
+        memcpy(metadata.data.data() + offset, payload + position, length);
+        metadata.received[piece] = 1;
+        if(--metadata.pieces_remaining == 0) {
+            verify_metadata(torrent);
+        }
+    }
+    request_metadata_pieces(torrent, connection);
+}
+
+// Function to make a closing connection's unanswered metadata pieces requestable by the other peers
+void release_metadata_requests(TorrentDownload& torrent, PeerConnection& connection) {
+    if(connection.metadata_requests.empty()) {
+        return;
+    }
+
+    for(int piece : connection.metadata_requests) {
+        --torrent.metadata.requests[piece];
+    }
+    connection.metadata_requests.clear();
+
+    for(auto& other : torrent.connections) {
+        if(other.get() != &connection) request_metadata_pieces(torrent, *other);
+    }
+}
+
+// Function to check whether the metadata fetch is over: verified, or given up after repeated hash mismatches
+bool metadata_download_done(const TorrentDownload& torrent) {
+    return torrent.metadata.complete || torrent.metadata.hash_failures >= MAX_METADATA_HASH_FAILURES;
+}
@@ -0,0 +1,432 @@
+#include "PeerConnectionFunctions.h"
+#include "DownloadPieceFunctions.h"
+#include "IoUringFunctions.h"
+#include <algorithm>
+#include <string_view>
+#include <sys/uio.h>
+
+static const size_t HANDSHAKE_LENGTH = 68;
+static const size_t READ_CHUNK_SIZE = 64 * 1024;
+static const uint32_t MAX_PEER_MESSAGE_LENGTH = 4 * 1024 * 1024; // Anything larger is a broken or hostile peer
+
+// Function to start a non-blocking connect and queue the handshake to go out once it completes.
+// A non-zero 'receive_buffer' is set before connecting, so the window scale can cover it.
+bool start_peer_connection(PeerConnection& connection, EventLoop& loop, const std::string& handshake_message, int receive_buffer) {
+    connection.loop = &loop;
+    connection.socket = create_socket(connection.endpoint.family());
+    if(connection.socket == -1) {
+        connection.state = PeerConnectionState::Closed;
+        return false;
+    }
+
+    // Requests are batched per loop iteration, so Nagle would only hold each batch back for an ACK
+    int no_delay = 1;
+    setsockopt(connection.socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    if(receive_buffer > 0) {
+        set_connect_receive_buffer(connection.socket, receive_buffer);
+    }
+
+    if(!set_non_blocking(connection.socket) ||
+       (connect(connection.socket, connection.endpoint.sockaddr_ptr(), connection.endpoint.length()) == -1 && errno != EINPROGRESS)) {
+        std::cerr << "Failed to connect to " << format_peer_endpoint(connection.endpoint) << ": " << strerror(errno) << std::endl;
+        close(connection.socket);
+        connection.socket = -1;
+        connection.state = PeerConnectionState::Closed;
+        return false;
+    }
+
+    connection.state = PeerConnectionState::Connecting;
+    connection.connect_started = std::chrono::steady_clock::now();
+    queue_peer_bytes(connection, handshake_message.data(), handshake_message.size());
+
+    PeerConnection* connection_ptr = &connection;
+    if(!event_loop_add(loop, connection.socket, EPOLLIN | EPOLLOUT | EPOLLRDHUP, [connection_ptr](uint32_t events) {
+        handle_peer_connection_events(*connection_ptr, events);
+    })) {
+        close(connection.socket);
+        connection.socket = -1;
+        connection.state = PeerConnectionState::Closed;
+        return false;
+    }
+
+    return true;
+}
+
+// Helper function to run the connect-completion step shared by TCP and uTP: the queued handshake goes out now
+static void on_peer_connected(PeerConnection& connection) {
+    connection.state = PeerConnectionState::Handshaking;
+    connection.handshake_sent = std::chrono::steady_clock::now();
+    record_rtt_sample(connection.tuning, std::chrono::duration<double, std::milli>(connection.handshake_sent - connection.connect_started).count());
+}
+
+// Function to start a uTP connect over the download's shared UDP socket. The peer-wire layer sees the same
+// byte stream as over TCP: received payload is fed through append_peer_inbound and flushes go to utp_write.
+bool start_utp_peer_connection(PeerConnection& connection, EventLoop& loop, UtpContext& context, const std::string& handshake_message) {
+    connection.loop = &loop;
+    connection.over_utp = true;
+    connection.utp = utp_connect(context, connection.endpoint);
+    if(!connection.utp) {
+        connection.state = PeerConnectionState::Closed;
+        return false;
+    }
+
+    connection.state = PeerConnectionState::Connecting;
+    connection.connect_started = std::chrono::steady_clock::now();
+    queue_peer_bytes(connection, handshake_message.data(), handshake_message.size());
+
+    PeerConnection* connection_ptr = &connection;
+    connection.utp->on_connect = [connection_ptr]() {
+        on_peer_connected(*connection_ptr);
+        flush_peer_connection(*connection_ptr);
+    };
+    connection.utp->on_data = [connection_ptr](const char* data, size_t length) {
+        append_peer_inbound(*connection_ptr, data, length);
+        process_peer_inbound(*connection_ptr, false);
+    };
+    connection.utp->on_close = [connection_ptr](const std::string& reason) {
+        connection_ptr->utp = nullptr; // The context frees it
+        if(reason.empty()) {
+            process_peer_inbound(*connection_ptr, true);
+        }
+        else {
+            close_peer_connection(*connection_ptr, reason);
+        }
+    };
+
+    return true;
+}
+
+// Function to unregister and close a connection; the owner reaps it after the current loop iteration
+void close_peer_connection(PeerConnection& connection, const std::string& reason) {
+    if(connection.state == PeerConnectionState::Closed) return;
+
+    if(!reason.empty()) {
+        std::cerr << "Closing connection to " << format_peer_endpoint(connection.endpoint) << ": " << reason << std::endl;
+    }
+
+    if(connection.utp) {
+        utp_close(*connection.utp);
+        connection.utp = nullptr;
+    }
+
+    if(connection.socket != -1) {
+        if(connection.uses_io_uring) {
+            uring_engine_detach_connection(connection.torrent->io_uring, connection);
+        }
+        else {
+            event_loop_remove(*connection.loop, connection.socket);
+        }
+        close(connection.socket);
+        connection.socket = -1;
+    }
+
+    connection.state = PeerConnectionState::Closed;
+}
+
+// Function to append bytes to the outbound queue; they are sent by the next flush
+void queue_peer_bytes(PeerConnection& connection, const char* data, size_t length) {
+    connection.outbound.append(data, length);
+}
+
+// Helper function to hold partial segments back while the queue is backlogged and push them out once it drains
+static void set_peer_cork(PeerConnection& connection, bool cork) {
+    int enabled = cork ? 1 : 0;
+    setsockopt(connection.socket, IPPROTO_TCP, TCP_CORK, &enabled, sizeof(enabled));
+    connection.corked = cork;
+}
+
+// Function to send queued bytes until the queue is empty or the socket would block. The event loop owner calls
+// this once per connection per iteration, so everything queued while handling that iteration's messages
+// leaves in a single send. With edge-triggered epoll a blocked socket reports EPOLLOUT again once it drains.
+bool flush_peer_connection(PeerConnection& connection) {
+    if(connection.state == PeerConnectionState::Connecting || connection.state == PeerConnectionState::Closed) {
+        return true;
+    }
+
+    if(connection.uses_io_uring) {
+        uring_engine_flush_connection(connection.torrent->io_uring, connection);
+        return connection.state != PeerConnectionState::Closed;
+    }
+
+    if(connection.over_utp) {
+        if(connection.outbound_offset < connection.outbound.size()) {
+            utp_write(*connection.utp, connection.outbound.data() + connection.outbound_offset, connection.outbound.size() - connection.outbound_offset);
+            ++connection.write_calls;
+            connection.bytes_sent += connection.outbound.size() - connection.outbound_offset;
+        }
+        connection.outbound.clear();
+        connection.outbound_offset = 0;
+        return true;
+    }
+
+    while(connection.outbound_offset < connection.outbound.size()) {
+        ssize_t bytes_sent = send(connection.socket, connection.outbound.data() + connection.outbound_offset,
+                                  connection.outbound.size() - connection.outbound_offset, MSG_NOSIGNAL);
+        if(bytes_sent < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if(errno == EINTR) continue;
+
+            close_peer_connection(connection, std::string("send failed: ") + strerror(errno));
+            return false;
+        }
+        ++connection.write_calls;
+        connection.bytes_sent += bytes_sent;
+        connection.outbound_offset += bytes_sent;
+    }
+
+    bool backlogged = connection.outbound_offset < connection.outbound.size();
+    connection.want_write = backlogged;
+    if(backlogged != connection.corked) {
+        set_peer_cork(connection, backlogged);
+    }
+
+    if(!backlogged) {
+        connection.outbound.clear();
+        connection.outbound_offset = 0;
+    }
+
+    return true;
+}
+
+// Function to make room for at least 'min_free' bytes after the unparsed ones, moving or growing the buffer
+void reserve_peer_read_space(PeerReadBuffer& buffer, size_t min_free) {
+    if(buffer.capacity - buffer.end >= min_free) return;
+
+    size_t pending = buffer.end - buffer.start;
+    if(buffer.capacity - pending >= min_free) {
+        memmove(buffer.data.get(), buffer.data.get() + buffer.start, pending);
+    }
+    else {
+        size_t new_capacity = std::max(buffer.capacity * 2, pending + min_free);
+        auto data = std::make_unique_for_overwrite<char[]>(new_capacity);
+        if(pending > 0) memcpy(data.get(), buffer.data.get() + buffer.start, pending);
+        buffer.data = std::move(data);
+        buffer.capacity = new_capacity;
+    }
+
+    buffer.start = 0;
+    buffer.end = pending;
+}
+
+// Helper function to account for bytes that landed in the direct block, finishing it once complete
+static void advance_direct_block(PeerConnection& connection, size_t length) {
+    DirectBlock& block = connection.direct_block;
+    block.destination += length;
+    block.remaining -= length;
+    connection.direct_bytes += length;
+
+    if(block.remaining == 0) {
+        DirectBlock finished = block;
+        block = DirectBlock();
+        on_piece_block_received(*connection.torrent, connection, finished.piece_index, finished.block_offset, finished.block_length);
+    }
+}
+
+// Function to add bytes received outside handle_readable (the io_uring engine); a pending direct block is filled first
+void append_peer_inbound(PeerConnection& connection, const char* data, size_t length) {
+    ++connection.read_calls;
+    connection.bytes_received += length;
+
+    size_t direct_length = std::min(length, connection.direct_block.remaining);
+    if(direct_length > 0) {
+        memcpy(connection.direct_block.destination, data, direct_length);
+        advance_direct_block(connection, direct_length);
+        data += direct_length;
+        length -= direct_length;
+    }
+
+    reserve_peer_read_space(connection.inbound, length);
+    memcpy(connection.inbound.data.get() + connection.inbound.end, data, length);
+    connection.inbound.end += length;
+}
+
+// Helper function to let the rest of a piece message's payload be received straight into download storage
+static bool start_direct_block(PeerConnection& connection, const char* header, uint32_t length, size_t available) {
+    if(static_cast<uint8_t>(header[4]) != 7 || available < 9) {
+        return false; // Not a piece message, or its index and offset haven't arrived yet
+    }
+
+    uint32_t piece_index, block_offset;
+    memcpy(&piece_index, header + 5, sizeof(piece_index));
+    memcpy(&block_offset, header + 9, sizeof(block_offset));
+    piece_index = ntohl(piece_index);
+    block_offset = ntohl(block_offset);
+    uint32_t block_length = length - 9;
+
+    char* destination = piece_block_destination(*connection.torrent, connection, piece_index, block_offset, block_length);
+    if(!destination) {
+        return false;
+    }
+
+    size_t buffered = available - 9;
+    memcpy(destination, header + 13, buffered);
+    connection.direct_block = {destination + buffered, block_length - buffered, piece_index, block_offset, block_length};
+    return true;
+}
+
+// Helper function to check the peer's handshake and move the connection to the message phase
+static void process_handshake(PeerConnection& connection) {
+    PeerReadBuffer& buffer = connection.inbound;
+    if(buffer.end - buffer.start < HANDSHAKE_LENGTH) {
+        return; // Wait for more bytes
+    }
+
+    std::string_view response(buffer.data.get() + buffer.start, HANDSHAKE_LENGTH);
+    if(static_cast<unsigned char>(response[0]) != 19 || response.substr(1, 19) != "BitTorrent protocol") {
+        close_peer_connection(connection, "invalid handshake");
+        return;
+    }
+
+    if(response.substr(28, 20) != hex_to_binary(connection.torrent->info_hash)) {
+        close_peer_connection(connection, "info hash mismatch");
+        return;
+    }
+
+    connection.remote_peer_id = response.substr(48, 20);
+    connection.extensions.supported = peer_supports_extensions(response.data() + 20);
+    connection.extensions.fast = peer_supports_fast_extension(response.data() + 20);
+    buffer.start += HANDSHAKE_LENGTH;
+    connection.state = PeerConnectionState::Active;
+
+    // The handshake went out when the connect completed, so its reply took about one round trip
+    auto now = std::chrono::steady_clock::now();
+    record_rtt_sample(connection.tuning, std::chrono::duration<double, std::milli>(now - connection.handshake_sent).count());
+    if(connection.socket != -1) read_socket_buffers(connection.socket, connection.tuning);
+    connection.tuning.last_tune = now;
+    connection.tuning.last_tune_bytes = connection.bytes_received;
+
+    on_peer_handshake(*connection.torrent, connection);
+}
+
+// Helper function to frame and dispatch every complete message in the inbound buffer.
+// Payloads are handed out in place; an ignored message that isn't complete yet is dropped as it arrives.
+static void process_messages(PeerConnection& connection) {
+    PeerReadBuffer& buffer = connection.inbound;
+
+    size_t dropped = std::min(buffer.skip, buffer.end - buffer.start);
+    buffer.start += dropped;
+    buffer.skip -= dropped;
+
+    while(connection.state == PeerConnectionState::Active && buffer.end - buffer.start >= 4) {
+        const char* header = buffer.data.get() + buffer.start;
+        size_t available = buffer.end - buffer.start - 4;
+
+        uint32_t length;
+        memcpy(&length, header, sizeof(length));
+        length = ntohl(length);
+
+        if(length > MAX_PEER_MESSAGE_LENGTH) {
+            close_peer_connection(connection, "oversized message");
+            return;
+        }
+
+        if(available < length) {
+            if(start_direct_block(connection, header, length, available)) {
+                buffer.start = buffer.end;
+            }
+            else if(available > 0 && connection.state == PeerConnectionState::Active && peer_message_ignored(static_cast<uint8_t>(header[4]))) {
+                buffer.skip = length - available;
+                buffer.start = buffer.end;
+            }
+            break; // Incomplete message; wait for more bytes
+        }
+
+        buffer.start += 4 + length;
+        if(length > 0) { // Zero length is a keep-alive
+            handle_peer_message(*connection.torrent, connection, static_cast<uint8_t>(header[4]), header + 5, length - 1);
+        }
+    }
+
+    if(buffer.start == buffer.end) {
+        buffer.start = buffer.end = 0; // Next read starts at the front without a move
+    }
+}
+
+// Helper function to read into the free tail of the buffer and parse after every read, until the socket drains.
+// While a piece payload is pending, one readv puts its rest in download storage and what follows in the buffer.
+// A short read means the socket had nothing more, unless the peer also hung up and the EOF is still unread.
+static void handle_readable(PeerConnection& connection, bool hangup) {
+    PeerReadBuffer& buffer = connection.inbound;
+
+    while(connection.state != PeerConnectionState::Closed) {
+        reserve_peer_read_space(buffer, READ_CHUNK_SIZE);
+
+        iovec targets[2];
+        int target_count = 0;
+        if(connection.direct_block.remaining > 0) {
+            targets[target_count++] = {connection.direct_block.destination, connection.direct_block.remaining};
+        }
+        targets[target_count++] = {buffer.data.get() + buffer.end, buffer.capacity - buffer.end};
+        size_t space = connection.direct_block.remaining + buffer.capacity - buffer.end;
+
+        ssize_t bytes_received = readv(connection.socket, targets, target_count);
+        ++connection.read_calls;
+        if(bytes_received < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if(errno == EINTR) continue;
+
+            close_peer_connection(connection, std::string("recv failed: ") + strerror(errno));
+            return;
+        }
+
+        connection.bytes_received += bytes_received;
+        size_t direct_length = std::min<size_t>(bytes_received, connection.direct_block.remaining);
+        if(direct_length > 0) {
+            advance_direct_block(connection, direct_length);
+        }
+        buffer.end += bytes_received - direct_length;
+
+        // Parse everything that arrived, even if the peer closed right after sending it
+        process_peer_inbound(connection, bytes_received == 0);
+        if(static_cast<size_t>(bytes_received) < space && !hangup) break;
+    }
+}
+
+// Function to run the handshake or message parser over the unparsed bytes
+void process_peer_inbound(PeerConnection& connection, bool peer_closed) {
+    if(connection.state == PeerConnectionState::Handshaking) {
+        process_handshake(connection);
+    }
+
+    if(connection.state == PeerConnectionState::Active) {
+        process_messages(connection);
+    }
+
+    if(peer_closed) {
+        close_peer_connection(connection, "connection closed by peer");
+    }
+}
+
+// Function to run the connection's state machine for one epoll notification
+void handle_peer_connection_events(PeerConnection& connection, uint32_t events) {
+    bool connected = false;
+    if(connection.state == PeerConnectionState::Connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        int error = 0;
+        socklen_t error_length = sizeof(error);
+        getsockopt(connection.socket, SOL_SOCKET, SO_ERROR, &error, &error_length);
+
+        if(error != 0) {
+            close_peer_connection(connection, std::string("connect failed: ") + strerror(error));
+            return;
+        }
+
+        on_peer_connected(connection);
+        connected = true;
+
+        // With an io_uring engine, reads and writes from here on are completions instead of epoll readiness
+        if(uring_engine_attach_connection(connection.torrent->io_uring, connection)) {
+            return;
+        }
+    }
+
+    if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        handle_readable(connection, events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR));
+    }
+
+    // Replies to what was just read wait for the owner's end-of-iteration flush. EPOLLOUT comes with nearly every
+    // read event on a writable socket, so it only sends from here when it means something: the connect completed
+    // (the handshake is queued), or a previous send hit EAGAIN and the send buffer has room again.
+    if(connection.state != PeerConnectionState::Closed && (connected || ((events & EPOLLOUT) && connection.want_write))) {
+        flush_peer_connection(connection);
+    }
+}
@@ -0,0 +1,91 @@
+#include "PeerDialerFunctions.h"
+#include "DownloadPieceFunctions.h"
+#include <algorithm>
+
+using Clock = std::chrono::steady_clock;
+
+// Helper function to check whether a connection is still connecting or handshaking
+static bool is_half_open(const PeerConnection& connection) {
+    return connection.state == PeerConnectionState::Connecting || connection.state == PeerConnectionState::Handshaking;
+}
+
+// Function to queue tracker (or peer exchange) peers for dialing; the overall dial deadline starts with the first batch
+void add_peer_candidates(TorrentDownload& torrent, const std::vector<PeerEndpoint>& peers) {
+    PeerDialer& dialer = torrent.dialer;
+    if(dialer.known_peers.empty()) {
+        dialer.deadline = Clock::now() + std::chrono::milliseconds(dialer.config.dial_timeout_ms);
+    }
+
+    for(const PeerEndpoint& peer : peers) {
+        if(dialer.known_peers.insert(make_peer_key(peer)).second) {
+            dialer.candidates.push_back(peer);
+        }
+    }
+}
+
+// Function to start connects to queued peers while under the half-open and connection caps
+void dial_peer_candidates(TorrentDownload& torrent) {
+    PeerDialer& dialer = torrent.dialer;
+    size_t half_open = std::count_if(torrent.connections.begin(), torrent.connections.end(), [](const std::unique_ptr<PeerConnection>& connection) {
+        return is_half_open(*connection);
+    });
+
+    while(!dialer.candidates.empty() && half_open < dialer.config.max_half_open && torrent.connections.size() < dialer.config.max_connections) {
+        PeerEndpoint peer = dialer.candidates.front();
+        dialer.candidates.pop_front();
+        ++dialer.attempts;
+
+        bool over_utp = dialer.config.prefer_utp && !dialer.tcp_only.count(make_peer_key(peer));
+        if(!add_peer_connection(torrent, peer, over_utp)) {
+            ++dialer.failures; // Immediate failures (e.g. unreachable network) don't occupy a slot
+            continue;
+        }
+
+        int timeout_ms = over_utp ? dialer.config.utp_attempt_timeout_ms : dialer.config.attempt_timeout_ms;
+        torrent.connections.back()->attempt_deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+        ++half_open;
+    }
+}
+
+// Function to queue a peer whose uTP attempt failed to be dialed again over TCP, ahead of untried peers.
+// Returns false if the connection wasn't a failed uTP attempt.
+bool retry_peer_over_tcp(TorrentDownload& torrent, const PeerConnection& connection) {
+    if(!connection.over_utp || !connection.remote_peer_id.empty()) {
+        return false;
+    }
+
+    torrent.dialer.tcp_only.insert(make_peer_key(connection.endpoint));
+    torrent.dialer.candidates.push_front(connection.endpoint);
+    return true;
+}
+
+// Function to close connects and handshakes that overran their attempt timeout
+void expire_peer_attempts(TorrentDownload& torrent) {
+    Clock::time_point now = Clock::now();
+
+    for(auto& connection : torrent.connections) {
+        if(is_half_open(*connection) && now >= connection->attempt_deadline) {
+            close_peer_connection(*connection, connection->state == PeerConnectionState::Connecting ? "connect timed out" : "handshake timed out");
+        }
+    }
+}
+
+// Function to check whether the dial phase ran out of time without a single handshake
+bool peer_dial_deadline_passed(const TorrentDownload& torrent) {
+    return !torrent.dialer.any_handshake && Clock::now() >= torrent.dialer.deadline;
+}
+
+// Function to get how long the event loop may wait before the next attempt deadline needs checking
+int dial_wait_timeout_ms(const TorrentDownload& torrent, int max_timeout_ms) {
+    Clock::time_point now = Clock::now();
+    int64_t timeout_ms = max_timeout_ms;
+
+    for(const auto& connection : torrent.connections) {
+        if(is_half_open(*connection)) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(connection->attempt_deadline - now).count();
+            timeout_ms = std::min<int64_t>(timeout_ms, std::max<int64_t>(remaining + 1, 0));
+        }
+    }
+
+    return static_cast<int>(timeout_ms);
+}
@@ -1,4 +1,6 @@
 #include "PeerFunctions.h"
+#include "UdpTrackerFunctions.h"
+#include <cstring>
 
 // Function to convert a hexadecimal string to a binary (byte) string
 std::string hex_to_binary(const std::string& hex) {
@@ -38,86 +40,271 @@ std::string url_encode(const std::string& value) {
     return result;
 }
 
-//Callback function to capture the response data
-static size_t write_callback(void* content, size_t size, size_t nmemb, std::string* response) {
+//Callback function to capture the response data (shared by every curl request)
+size_t write_callback(void* content, size_t size, size_t nmemb, std::string* response) {
     size_t total_size = size * nmemb;
     response->append(static_cast<char*>(content), total_size);
     return total_size;
 }
 
-// Function to send the GET request to the tracker
-std::vector<std::string> get_peers(const std::string& tracker_url, const std::string info_hash, const std::string& peer_id, int port, int64_t uploaded, 
-                              int64_t downloaded, int64_t left, bool compact) {
-    // Initialize libcurl
-    CURL *curl = curl_easy_init();
+// Helper function to convert compact peers (6 bytes per IPv4 peer, 18 per IPv6 peer) into endpoints
+bool parse_compact_peers(const char* peers, size_t length, int family, std::vector<PeerEndpoint>& peers_arr) {
+    size_t address_size = family == AF_INET6 ? 16 : 4;
+    size_t entry_size = address_size + 2;
 
-    std::string response; // String to strore response
-    std::vector<std::string> peers_arr = {}; // Array to store peers
+    if(length % entry_size != 0) {
+        std::cerr << "Error: Invalid peers string length." << std::endl;
+        return false;
+    }
 
-    if(curl) {
-        // Construct the URL with all the required parameters
-        std::ostringstream url;
-        url << tracker_url
-            << "?info_hash=" << url_encode(hex_to_binary(info_hash))
-            << "&peer_id=" << peer_id
-            << "&port=" << port
-            << "&uploaded=" << uploaded
-            << "&downloaded=" << downloaded
-            << "&left=" << left
-            << "&compact=" << compact;
-
-        // Set the URL
-        curl_easy_setopt(curl, CURLOPT_URL, url.str().c_str());
-
-        //Set the callback function to capture response into the 'response' string
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-
-        // Send the request and capture the response
-        CURLcode res = curl_easy_perform(curl);
-
-        //Check for the errors
-        if(res != CURLE_OK) {
-            std::cerr << "Error in curl_easy_perform(): " << curl_easy_strerror(res) << std::endl;
+    peers_arr.reserve(peers_arr.size() + length / entry_size);
+
+    for(size_t i = 0; i < length; i += entry_size) {
+        PeerEndpoint endpoint = {};
+        uint16_t port;
+        memcpy(&port, peers + i + address_size, sizeof(port)); // Already in network byte order
+
+        if(family == AF_INET6) {
+            endpoint.address.v6.sin6_family = AF_INET6;
+            endpoint.address.v6.sin6_port = port;
+            memcpy(&endpoint.address.v6.sin6_addr, peers + i, address_size);
         }
         else {
-            int start_position = 0;
-            json decoded_response = decode_bencoded_value(response, start_position);
+            endpoint.address.v4.sin_family = AF_INET;
+            endpoint.address.v4.sin_port = port;
+            memcpy(&endpoint.address.v4.sin_addr, peers + i, address_size);
+        }
 
-            if(decoded_response.contains("peers")) {
-                std::string peers = decoded_response["peers"].get<std::string>();
+        peers_arr.push_back(endpoint);
+    }
 
-                if(peers.size() % 6 != 0) {
-                    throw std::runtime_error("Error: Invalid peers string length.");
-                }
+    return true;
+}
 
-                    for(size_t i = 0; i < peers.size(); i += 6) {
-                        std::string ip = std::to_string(static_cast<uint8_t>(peers[i])) + "." +
-                                         std::to_string(static_cast<uint8_t>(peers[i + 1])) + "." +
-                                         std::to_string(static_cast<uint8_t>(peers[i + 2])) + "." +
-                                         std::to_string(static_cast<uint8_t>(peers[i + 3]));
+// Helper function to parse "a.b.c.d:port" or "[v6]:port" into an endpoint
+bool parse_peer_endpoint(const std::string& peer, PeerEndpoint& endpoint) {
+    size_t colon_index = peer.rfind(':');
+
+    if(colon_index == std::string::npos) {
+        std::cerr << "Invalid peer address format." << std::endl;
+        return false;
+    }
+
+    std::string ip = peer.substr(0, colon_index);
+    if(ip.size() >= 2 && ip.front() == '[' && ip.back() == ']') {
+        ip = ip.substr(1, ip.size() - 2);
+    }
+
+    int port = std::atoi(peer.c_str() + colon_index + 1);
+    if(port <= 0 || port > 65535) {
+        std::cerr << "Invalid peer port." << std::endl;
+        return false;
+    }
+
+    endpoint = {};
+    if(inet_pton(AF_INET, ip.c_str(), &endpoint.address.v4.sin_addr) == 1) {
+        endpoint.address.v4.sin_family = AF_INET;
+        endpoint.address.v4.sin_port = htons(port);
+    }
+    else if(inet_pton(AF_INET6, ip.c_str(), &endpoint.address.v6.sin6_addr) == 1) {
+        endpoint.address.v6.sin6_family = AF_INET6;
+        endpoint.address.v6.sin6_port = htons(port);
+    }
+    else {
+        std::cerr << "Invalid IP address." << std::endl;
+        return false;
+    }
 
-                        std::string port = std::to_string((static_cast<uint8_t>(peers[i + 4]) << 8) | static_cast<uint8_t>(peers[i + 5]));
+    return true;
+}
+
+// Helper function to format an endpoint as "a.b.c.d:port" or "[v6]:port" for display
+std::string format_peer_endpoint(const PeerEndpoint& endpoint) {
+    char ip[INET6_ADDRSTRLEN] = {0};
+
+    if(endpoint.family() == AF_INET6) {
+        inet_ntop(AF_INET6, &endpoint.address.v6.sin6_addr, ip, sizeof(ip));
+        return "[" + std::string(ip) + "]:" + std::to_string(ntohs(endpoint.address.v6.sin6_port));
+    }
+
+    inet_ntop(AF_INET, &endpoint.address.v4.sin_addr, ip, sizeof(ip));
+    return std::string(ip) + ":" + std::to_string(ntohs(endpoint.address.v4.sin_port));
+}
+
+// Function to build the binary key of an endpoint, so lookups don't format addresses as text
+PeerKey make_peer_key(const PeerEndpoint& endpoint) {
+    PeerKey key;
+    key.family = static_cast<uint8_t>(endpoint.family());
+    if(endpoint.family() == AF_INET6) {
+        memcpy(key.address.data(), &endpoint.address.v6.sin6_addr, 16);
+        key.port = ntohs(endpoint.address.v6.sin6_port);
+    }
+    else {
+        memcpy(key.address.data(), &endpoint.address.v4.sin_addr, 4);
+        key.port = ntohs(endpoint.address.v4.sin_port);
+    }
+    return key;
+}
+
+// Helper function to read the non-compact peer list form: a list of {ip, port} dictionaries
+static bool parse_peer_dictionaries(const json& peers, std::vector<PeerEndpoint>& peers_arr) {
+    for(const auto& peer : peers) {
+        if(!peer.contains("ip") || !peer.contains("port")) {
+            std::cerr << "Error: Peer entry without 'ip' or 'port'." << std::endl;
+            return false;
+        }
+
+        PeerEndpoint endpoint;
+        std::string ip = peer["ip"].get<std::string>();
+        std::string port = std::to_string(peer["port"].get<int64_t>());
+        if(parse_peer_endpoint(ip.find(':') == std::string::npos ? ip + ":" + port : "[" + ip + "]:" + port, endpoint)) {
+            peers_arr.push_back(endpoint);
+        }
+    }
+
+    return true;
+}
+
+// Function to send the announce GET request to an HTTP tracker; a 'timeout_ms' above 0 bounds the whole request
+bool http_announce(const AnnounceRequest& request, AnnounceResponse& response, long timeout_ms) {
+    // Initialize libcurl
+    CURL *curl = curl_easy_init();
 
-                        peers_arr.push_back(ip + ':' + port);
-                    }
+    if(!curl) {
+        std::cerr << "Failed to initialize CURL" << std::endl;
+        return false;
+    }
+
+    std::string body; // String to store the raw response
+    bool success = false;
+
+    // Construct the URL with all the required parameters
+    std::ostringstream url;
+    url << request.tracker_url
+        << (request.tracker_url.find('?') == std::string::npos ? "?" : "&")
+        << "info_hash=" << url_encode(hex_to_binary(request.info_hash))
+        << "&peer_id=" << url_encode(request.peer_id)
+        << "&port=" << request.port
+        << "&uploaded=" << request.uploaded
+        << "&downloaded=" << request.downloaded
+        << "&left=" << request.left
+        << "&compact=" << request.compact;
+
+    if(request.event == AnnounceEvent::Started) {
+        url << "&event=started";
+    }
+    else if(request.event == AnnounceEvent::Completed) {
+        url << "&event=completed";
+    }
+    else if(request.event == AnnounceEvent::Stopped) {
+        url << "&event=stopped";
+    }
+
+    if(request.num_want >= 0) {
+        url << "&numwant=" << request.num_want;
+    }
+
+    // Set the URL
+    curl_easy_setopt(curl, CURLOPT_URL, url.str().c_str());
+
+    //Set the callback function to capture response into the 'body' string
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+
+    if(timeout_ms > 0) {
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L); // The timeout must not rely on SIGALRM during name resolution
+    }
+
+    // Send the request and capture the response
+    CURLcode res = curl_easy_perform(curl);
+
+    //Check for the errors
+    if(res != CURLE_OK) {
+        std::cerr << "Error in curl_easy_perform(): " << curl_easy_strerror(res) << std::endl;
+    }
+    else {
+        try {
+            int start_position = 0;
+            json decoded_response = decode_bencoded_value(body, start_position);
+
+            if(decoded_response.contains("failure reason")) {
+                response.failure_reason = decoded_response["failure reason"].get<std::string>();
+                std::cerr << "Tracker failure: " << response.failure_reason << std::endl;
+            }
+            else if(decoded_response.contains("peers")) {
+                if(decoded_response.contains("interval")) {
+                    response.interval = decoded_response["interval"].get<int64_t>();
+                }
+                if(decoded_response.contains("min interval")) {
+                    response.min_interval = decoded_response["min interval"].get<int64_t>();
+                }
+                if(decoded_response.contains("complete")) {
+                    response.seeders = decoded_response["complete"].get<int64_t>();
+                }
+                if(decoded_response.contains("incomplete")) {
+                    response.leechers = decoded_response["incomplete"].get<int64_t>();
+                }
+
+                const json& peers = decoded_response["peers"];
+                if(peers.is_string()) {
+                    const std::string& compact_peers = peers.get_ref<const std::string&>();
+                    success = parse_compact_peers(compact_peers.data(), compact_peers.size(), AF_INET, response.peers);
+                }
+                else {
+                    success = parse_peer_dictionaries(peers, response.peers);
+                }
+
+                // IPv6 peers arrive in a separate key (BEP 7)
+                if(success && decoded_response.contains("peers6")) {
+                    const std::string& compact_peers6 = decoded_response["peers6"].get_ref<const std::string&>();
+                    success = parse_compact_peers(compact_peers6.data(), compact_peers6.size(), AF_INET6, response.peers);
+                }
             }
             else {
                 std::cerr << "Error: Missing 'peers' key in dictionary." << std::endl;
             }
         }
-
-        curl_easy_cleanup(curl);
+        catch(const std::exception& e) {
+            std::cerr << "Error: Invalid tracker response: " << e.what() << std::endl;
+        }
     }
-    else {
-        std::cerr << "Failed to initialize CURL" << std::endl;
+
+    curl_easy_cleanup(curl);
+
+    return success;
+}
+
+// Function to announce to a tracker, picking the protocol from the announce URL scheme
+bool announce_to_tracker(const AnnounceRequest& request, AnnounceResponse& response) {
+    if(request.tracker_url.rfind("udp://", 0) == 0) {
+        return udp_announce(request, response);
     }
 
-    return peers_arr;
+    return http_announce(request, response);
+}
+
+// Function to announce to the tracker and return the peers it lists
+std::vector<PeerEndpoint> get_peers(const std::string& tracker_url, const std::string info_hash, const std::string& peer_id, int port, int64_t uploaded, 
+                              int64_t downloaded, int64_t left, bool compact) {
+    AnnounceRequest request;
+    request.tracker_url = tracker_url;
+    request.info_hash = info_hash;
+    request.peer_id = peer_id;
+    request.port = port;
+    request.uploaded = uploaded;
+    request.downloaded = downloaded;
+    request.left = left;
+    request.compact = compact;
+
+    AnnounceResponse response;
+    announce_to_tracker(request, response);
+
+    return response.peers;
 }
 
-void print_peers(const std::vector<std::string>& peers) {
+void print_peers(const std::vector<PeerEndpoint>& peers) {
     for(const auto& peer : peers) {
-        std::cout << peer << std::endl;
+        std::cout << format_peer_endpoint(peer) << std::endl;
     }
 }
\ No newline at end of file
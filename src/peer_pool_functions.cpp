@@ -0,0 +1,93 @@
+#include "PeerPoolFunctions.h"
+#include "DownloadPieceFunctions.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Helper function to close a connection that no longer belongs to an event loop
+static void close_idle_connection(PeerConnection& connection) {
+    if(connection.socket != -1) {
+        close(connection.socket);
+        connection.socket = -1;
+    }
+    connection.state = PeerConnectionState::Closed;
+}
+
+// Helper function to check that an idle socket hasn't been closed or reset by the peer while pooled
+static bool idle_connection_alive(const PeerConnection& connection) {
+    char byte;
+    ssize_t peeked = recv(connection.socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return peeked > 0 || (peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+// Helper function to close idle connections that have been pooled for too long
+static void expire_idle_connections(PeerConnectionPool& pool) {
+    Clock::time_point oldest = Clock::now() - std::chrono::milliseconds(pool.config.idle_timeout_ms);
+    std::erase_if(pool.idle, [oldest](auto& entry) {
+        if(entry.second.released >= oldest) return false;
+        close_idle_connection(*entry.second.connection);
+        return true;
+    });
+}
+
+// Function to take over a connection from a finishing download instead of closing it. Only established epoll
+// connections with no block payload pending qualify; the socket leaves the download's event loop, and any
+// bytes that arrive meanwhile wait in the kernel (or the read buffer) for the next download to parse.
+bool release_pooled_connection(PeerConnectionPool& pool, std::unique_ptr<PeerConnection>& connection) {
+    if(connection->state != PeerConnectionState::Active || connection->uses_io_uring || connection->over_utp || connection->direct_block.remaining > 0) {
+        return false;
+    }
+
+    expire_idle_connections(pool);
+    auto key = std::make_pair(connection->torrent->info_hash, make_peer_key(connection->endpoint));
+    if(pool.idle.size() >= pool.config.max_idle || pool.idle.count(key)) {
+        return false;
+    }
+
+    event_loop_remove(*connection->loop, connection->socket);
+    connection->loop = nullptr;
+    connection->torrent = nullptr;
+
+    // A block still in flight is dropped on arrival unless the next download asks for exactly that block
+    connection->requests.clear();
+    connection->piece_index = -1;
+    connection->metadata_requests.clear(); // Answers to a finished metadata fetch are ignored
+
+    // Counters were added to the finished download's stats; the next download starts its own
+    connection->read_calls = connection->bytes_received = connection->direct_bytes = 0;
+    connection->write_calls = connection->bytes_sent = 0;
+    connection->tuning.last_tune_bytes = 0;
+    connection->max_requests_outstanding = 0;
+
+    pool.idle[key] = {std::move(connection), Clock::now()};
+    ++pool.released;
+    return true;
+}
+
+// Function to hand out a pooled connection to 'endpoint' for the torrent, or nullptr if none is alive
+std::unique_ptr<PeerConnection> take_pooled_connection(PeerConnectionPool& pool, const std::string& info_hash, const PeerEndpoint& endpoint) {
+    expire_idle_connections(pool);
+
+    auto found = pool.idle.find(std::make_pair(info_hash, make_peer_key(endpoint)));
+    if(found == pool.idle.end()) {
+        return nullptr;
+    }
+
+    std::unique_ptr<PeerConnection> connection = std::move(found->second.connection);
+    pool.idle.erase(found);
+
+    if(!idle_connection_alive(*connection)) {
+        close_idle_connection(*connection);
+        return nullptr; // The caller dials the peer again
+    }
+
+    ++pool.reused;
+    return connection;
+}
+
+// Function to close every idle connection
+void close_pooled_connections(PeerConnectionPool& pool) {
+    for(auto& [key, pooled] : pool.idle) {
+        close_idle_connection(*pooled.connection);
+    }
+    pool.idle.clear();
+}
@@ -0,0 +1,155 @@
+#include "PexFunctions.h"
+#include "DownloadPieceFunctions.h"
+#include <algorithm>
+
+using Clock = std::chrono::steady_clock;
+
+// Flags sent per added peer ('added.f')
+static const uint8_t PEX_FLAG_SEED = 0x02;
+static const uint8_t PEX_FLAG_UTP = 0x04;
+static const uint8_t PEX_FLAG_REACHABLE = 0x10; // We connected out to it, so it accepts connections
+
+// Helper function to append a peer in compact form: 4 or 16 address bytes, then the port, in network byte order
+static void append_compact_peer(std::string& compact, const PeerEndpoint& peer) {
+    if(peer.family() == AF_INET6) {
+        compact.append(reinterpret_cast<const char*>(&peer.address.v6.sin6_addr), 16);
+        compact.append(reinterpret_cast<const char*>(&peer.address.v6.sin6_port), 2);
+    }
+    else {
+        compact.append(reinterpret_cast<const char*>(&peer.address.v4.sin_addr), 4);
+        compact.append(reinterpret_cast<const char*>(&peer.address.v4.sin_port), 2);
+    }
+}
+
+// Helper function to read one family's added peers out of a ut_pex message; returns false if the list is malformed
+static bool read_pex_peers(const json& message, const char* key, int family, std::vector<PeerEndpoint>& peers) {
+    if(!message.contains(key)) {
+        return true;
+    }
+    if(!message[key].is_string()) {
+        return false;
+    }
+
+    std::string compact = message[key].get<std::string>();
+    size_t entry_size = family == AF_INET6 ? 18 : 6;
+    if(compact.size() % entry_size != 0) {
+        return false;
+    }
+
+    // A message may list more than a minute's worth; the excess is dropped rather than queued
+    compact.resize(std::min(compact.size(), PEX_MAX_ADDED * entry_size));
+    std::vector<PeerEndpoint> added;
+    parse_compact_peers(compact.data(), compact.size(), family, added);
+    for(const PeerEndpoint& peer : added) {
+        uint16_t port = family == AF_INET6 ? peer.address.v6.sin6_port : peer.address.v4.sin_port;
+        if(port != 0) peers.push_back(peer);
+    }
+    return true;
+}
+
+// Function to take the peers a ut_pex message adds as dial candidates; the dialer drops ones it has seen before.
+// Dropped peers are only checked: the sender disconnecting from one says nothing about whether we can reach it.
+void handle_pex_message(TorrentDownload& torrent, PeerConnection& connection, const char* payload, uint32_t payload_length) {
+    json message;
+    int position = 0;
+    try {
+        message = decode_bencoded_value(std::string(payload, payload_length), position);
+    }
+    catch(const std::exception&) {
+        close_peer_connection(connection, "invalid ut_pex message");
+        return;
+    }
+
+    std::vector<PeerEndpoint> peers;
+    if(!message.is_object() || !read_pex_peers(message, "added", AF_INET, peers) || !read_pex_peers(message, "added6", AF_INET6, peers) ||
+       (message.contains("dropped") && !message["dropped"].is_string()) || (message.contains("dropped6") && !message["dropped6"].is_string())) {
+        close_peer_connection(connection, "invalid ut_pex message");
+        return;
+    }
+
+    // A peer sending more often than the cadence allows is flooding; its extra messages are ignored
+    auto now = Clock::now();
+    if(now < connection.pex.next_accepted) {
+        return;
+    }
+    connection.pex.next_accepted = now + std::chrono::seconds(PEX_INTERVAL_S / 2);
+
+    size_t known = torrent.dialer.known_peers.size();
+    add_peer_candidates(torrent, peers);
+    torrent.stats.pex_peers_received += torrent.dialer.known_peers.size() - known;
+}
+
+// Helper function to queue the changes to our connected peers since this connection was last told: up to
+// PEX_MAX_ADDED new peers per family with their flags, and every peer we told it about that is gone since
+static void queue_pex_message(TorrentDownload& torrent, PeerConnection& connection, const std::map<PeerKey, const PeerConnection*>& connected) {
+    std::string added, added_flags, added6, added6_flags, dropped, dropped6;
+    size_t added_count = 0, added6_count = 0;
+
+    for(const auto& [key, peer] : connected) {
+        if(peer == &connection || connection.pex.advertised.count(key)) continue;
+
+        bool v6 = peer->endpoint.family() == AF_INET6;
+        size_t& count = v6 ? added6_count : added_count;
+        if(count == PEX_MAX_ADDED) continue;
+        ++count;
+
+        uint8_t flags = PEX_FLAG_REACHABLE;
+        if(peer->over_utp) flags |= PEX_FLAG_UTP;
+        if(peer->peer_pieces.size > 0 && bitfield_count(peer->peer_pieces) == peer->peer_pieces.size) flags |= PEX_FLAG_SEED;
+
+        append_compact_peer(v6 ? added6 : added, peer->endpoint);
+        (v6 ? added6_flags : added_flags).push_back(static_cast<char>(flags));
+        connection.pex.advertised[key] = peer->endpoint;
+    }
+
+    for(auto advertised = connection.pex.advertised.begin(); advertised != connection.pex.advertised.end();) {
+        if(connected.count(advertised->first)) {
+            ++advertised;
+            continue;
+        }
+        append_compact_peer(advertised->second.family() == AF_INET6 ? dropped6 : dropped, advertised->second);
+        advertised = connection.pex.advertised.erase(advertised);
+    }
+
+    if(added.empty() && added6.empty() && dropped.empty() && dropped6.empty()) {
+        return;
+    }
+
+    json message = {{"added", added}, {"added.f", added_flags}, {"dropped", dropped}};
+    if(!added6.empty()) {
+        message["added6"] = added6;
+        message["added6.f"] = added6_flags;
+    }
+    if(!dropped6.empty()) {
+        message["dropped6"] = dropped6;
+    }
+
+    queue_extended_message(connection, connection.extensions.pex_id, bencode(message));
+    ++torrent.stats.pex_messages_sent;
+}
+
+// Function to send ut_pex messages to the connections that are due one: the first soon after its extension
+// handshake, then one a minute. Only peers past the handshake are shared, since others may not be BitTorrent peers.
+void send_peer_exchange(TorrentDownload& torrent) {
+    auto now = Clock::now();
+    bool any_due = std::any_of(torrent.connections.begin(), torrent.connections.end(), [now](const std::unique_ptr<PeerConnection>& connection) {
+        return connection->state == PeerConnectionState::Active && connection->extensions.pex_id != 0 && now >= connection->pex.next_send;
+    });
+    if(!any_due) {
+        return;
+    }
+
+    std::map<PeerKey, const PeerConnection*> connected;
+    for(const auto& connection : torrent.connections) {
+        if(connection->state == PeerConnectionState::Active && !connection->remote_peer_id.empty()) {
+            connected[make_peer_key(connection->endpoint)] = connection.get();
+        }
+    }
+
+    for(auto& connection : torrent.connections) {
+        if(connection->state != PeerConnectionState::Active || connection->extensions.pex_id == 0 || now < connection->pex.next_send) continue;
+
+        queue_pex_message(torrent, *connection, connected);
+        connection->pex.next_send = now + std::chrono::seconds(PEX_INTERVAL_S);
+    }
+}
@@ -0,0 +1,117 @@
+#include "PiecePickerFunctions.h"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+
+static const size_t NOT_LISTED = SIZE_MAX;   // Priority 0
+static const size_t REMOVED = SIZE_MAX - 1;  // Verified; never listed again
+
+// Helper function to swap two listed pieces and keep their positions right
+static void swap_pieces(PiecePicker& picker, PickerLevel& level, size_t a, size_t b) {
+    std::swap(level.pieces[a], level.pieces[b]);
+    picker.position[level.pieces[a]] = a;
+    picker.position[level.pieces[b]] = b;
+}
+
+// Helper function to add empty buckets at the top until availability 'count - 1' has one
+static void ensure_buckets(PickerLevel& level, size_t count) {
+    while(level.bucket_start.size() < count + 1) {
+        level.bucket_start.push_back(level.pieces.size());
+    }
+}
+
+// Helper function to list a piece in its priority's level: appended to the top bucket, then moved down one
+// bucket edge at a time to its own, and swapped with a random piece there
+static void insert_piece(PiecePicker& picker, int piece_index) {
+    PickerLevel& level = picker.levels[picker.priority[piece_index]];
+    uint32_t availability = picker.availability[piece_index];
+    ensure_buckets(level, availability + 1);
+
+    level.pieces.push_back(piece_index);
+    ++level.bucket_start.back();
+    size_t position = level.pieces.size() - 1;
+    picker.position[piece_index] = position;
+
+    for(size_t bucket = level.bucket_start.size() - 2; bucket > availability; --bucket) {
+        swap_pieces(picker, level, position, level.bucket_start[bucket]);
+        position = level.bucket_start[bucket]++;
+    }
+
+    std::uniform_int_distribution<size_t> pick(level.bucket_start[availability], level.bucket_start[availability + 1] - 1);
+    swap_pieces(picker, level, position, pick(picker.random));
+}
+
+// Function to list every piece with a non-zero priority, all at availability zero in random order
+void init_piece_picker(PiecePicker& picker, const std::vector<uint8_t>& priorities) {
+    picker.availability.assign(priorities.size(), 0);
+    picker.priority = priorities;
+    picker.position.assign(priorities.size(), NOT_LISTED);
+    for(PickerLevel& level : picker.levels) {
+        level.pieces.clear();
+        level.bucket_start.assign(1, 0);
+    }
+
+    for(size_t piece_index = 0; piece_index < priorities.size(); ++piece_index) {
+        picker.priority[piece_index] = std::min<uint8_t>(priorities[piece_index], PIECE_PRIORITY_LEVELS - 1);
+        if(picker.priority[piece_index] > 0) {
+            insert_piece(picker, piece_index);
+        }
+    }
+}
+
+// Function to count one more peer with a piece: it becomes the first of the next bucket up, O(1)
+void piece_picker_increment(PiecePicker& picker, int piece_index) {
+    uint32_t availability = picker.availability[piece_index]++;
+    size_t position = picker.position[piece_index];
+    if(position >= REMOVED) return;
+
+    PickerLevel& level = picker.levels[picker.priority[piece_index]];
+    ensure_buckets(level, availability + 2);
+    swap_pieces(picker, level, position, level.bucket_start[availability + 1] - 1);
+    --level.bucket_start[availability + 1];
+}
+
+// Function to count one peer fewer with a piece: it becomes the last of the next bucket down, O(1)
+void piece_picker_decrement(PiecePicker& picker, int piece_index) {
+    if(picker.availability[piece_index] == 0) return;
+
+    uint32_t availability = picker.availability[piece_index]--;
+    size_t position = picker.position[piece_index];
+    if(position >= REMOVED) return;
+
+    PickerLevel& level = picker.levels[picker.priority[piece_index]];
+    swap_pieces(picker, level, position, level.bucket_start[availability]);
+    ++level.bucket_start[availability];
+}
+
+// Function to add (delta 1) or take away (delta -1) a peer's pieces, one O(1) update per piece it has
+void piece_picker_add_peer(PiecePicker& picker, const Bitfield& pieces, int delta) {
+    for(size_t word_index = 0; word_index < pieces.words.size(); ++word_index) {
+        for(uint64_t word = pieces.words[word_index]; word != 0; word &= word - 1) {
+            // Bits are in wire order, so the lowest set bit is the highest piece index in the word
+            int piece_index = static_cast<int>(word_index * 64 + 63 - std::countr_zero(word));
+            if(piece_index >= static_cast<int>(picker.availability.size())) continue;
+            if(delta > 0) piece_picker_increment(picker, piece_index);
+            else piece_picker_decrement(picker, piece_index);
+        }
+    }
+}
+
+// Function to unlist a piece that no longer needs picking (it was verified). It is moved up across each
+// bucket edge to the very end and popped, so the cost is the number of distinct availabilities above it.
+void piece_picker_remove(PiecePicker& picker, int piece_index) {
+    size_t position = picker.position[piece_index];
+    if(position >= REMOVED) return;
+
+    PickerLevel& level = picker.levels[picker.priority[piece_index]];
+    size_t top = level.bucket_start.size() - 2;
+    for(size_t bucket = picker.availability[piece_index]; bucket < top; ++bucket) {
+        swap_pieces(picker, level, position, level.bucket_start[bucket + 1] - 1);
+        position = --level.bucket_start[bucket + 1];
+    }
+
+    swap_pieces(picker, level, position, level.pieces.size() - 1);
+    level.pieces.pop_back();
+    --level.bucket_start.back();
+    picker.position[piece_index] = REMOVED;
+}
@@ -0,0 +1,127 @@
+#include "ScrapeFunctions.h"
+#include "UdpTrackerFunctions.h"
+#include <cstring>
+
+static const size_t HTTP_MAX_SCRAPE_HASHES = 64; // Keeps the query string under common 8 KiB URL limits
+
+// Function to derive the scrape URL from an announce URL (".../announce?x" -> ".../scrape?x").
+// UDP trackers scrape through the same endpoint they announce on.
+bool scrape_url_from_announce(const std::string& announce_url, std::string& scrape_url) {
+    if(announce_url.rfind("udp://", 0) == 0) {
+        scrape_url = announce_url;
+        return true;
+    }
+
+    size_t slash_index = announce_url.rfind('/');
+    if(slash_index == std::string::npos || announce_url.compare(slash_index + 1, 8, "announce") != 0) {
+        std::cerr << "Tracker does not support scrape: " << announce_url << std::endl;
+        return false;
+    }
+
+    scrape_url = announce_url.substr(0, slash_index + 1) + "scrape" + announce_url.substr(slash_index + 1 + 8);
+    return true;
+}
+
+// Function to scrape many info hashes from an HTTP tracker, up to 64 hashes per request
+bool http_scrape(const std::string& scrape_url, const std::vector<std::string>& info_hashes, std::vector<ScrapeStats>& stats) {
+    CURL *curl = curl_easy_init();
+
+    if(!curl) {
+        std::cerr << "Failed to initialize CURL" << std::endl;
+        return false;
+    }
+
+    bool success = true;
+
+    for(size_t first_hash = 0; first_hash < info_hashes.size(); first_hash += HTTP_MAX_SCRAPE_HASHES) {
+        // Construct the URL with one info_hash parameter per torrent
+        std::ostringstream url;
+        url << scrape_url;
+
+        char separator = scrape_url.find('?') == std::string::npos ? '?' : '&';
+        for(size_t i = first_hash; i < std::min(info_hashes.size(), first_hash + HTTP_MAX_SCRAPE_HASHES); ++i) {
+            url << separator << "info_hash=" << url_encode(hex_to_binary(info_hashes[i]));
+            separator = '&';
+        }
+
+        std::string body;
+        curl_easy_setopt(curl, CURLOPT_URL, url.str().c_str());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+
+        CURLcode res = curl_easy_perform(curl);
+        if(res != CURLE_OK) {
+            std::cerr << "Error in curl_easy_perform(): " << curl_easy_strerror(res) << std::endl;
+            success = false;
+            continue;
+        }
+
+        try {
+            int start_position = 0;
+            json decoded_response = decode_bencoded_value(body, start_position);
+
+            if(decoded_response.contains("failure reason")) {
+                std::cerr << "Tracker failure: " << decoded_response["failure reason"].get<std::string>() << std::endl;
+                success = false;
+                continue;
+            }
+
+            if(!decoded_response.contains("files")) {
+                std::cerr << "Error: Missing 'files' key in scrape response." << std::endl;
+                success = false;
+                continue;
+            }
+
+            // "files" maps each 20-byte binary info hash to its swarm counters
+            for(const auto& [info_hash, file] : decoded_response["files"].items()) {
+                if(info_hash.size() != 20) continue;
+
+                ScrapeStats entry_stats;
+                memcpy(entry_stats.info_hash.data(), info_hash.data(), entry_stats.info_hash.size());
+                if(file.contains("complete")) entry_stats.seeders = file["complete"].get<int64_t>();
+                if(file.contains("downloaded")) entry_stats.completed = file["downloaded"].get<int64_t>();
+                if(file.contains("incomplete")) entry_stats.leechers = file["incomplete"].get<int64_t>();
+                stats.push_back(entry_stats);
+            }
+        }
+        catch(const std::exception& e) {
+            std::cerr << "Error: Invalid scrape response: " << e.what() << std::endl;
+            success = false;
+        }
+    }
+
+    curl_easy_cleanup(curl);
+
+    return success;
+}
+
+// Function to scrape many info hashes from the tracker behind an announce URL
+bool scrape_tracker(const std::string& announce_url, const std::vector<std::string>& info_hashes, std::vector<ScrapeStats>& stats) {
+    std::string scrape_url;
+    if(!scrape_url_from_announce(announce_url, scrape_url)) {
+        return false;
+    }
+
+    if(scrape_url.rfind("udp://", 0) == 0) {
+        return udp_scrape(scrape_url, info_hashes, stats);
+    }
+
+    return http_scrape(scrape_url, info_hashes, stats);
+}
+
+// Helper function to format a scrape counter, which the tracker may have left out
+static std::string format_scrape_count(int64_t count) {
+    return count < 0 ? "unknown" : std::to_string(count);
+}
+
+void print_scrape_stats(const std::vector<ScrapeStats>& stats) {
+    for(const auto& entry : stats) {
+        std::ostringstream oss;
+        for(unsigned char c : entry.info_hash) {
+            oss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(c);
+        }
+
+        std::cout << oss.str() << " seeders: " << format_scrape_count(entry.seeders) << " completed: " << format_scrape_count(entry.completed)
+                  << " leechers: " << format_scrape_count(entry.leechers) << std::endl;
+    }
+}
@@ -0,0 +1,153 @@
+#include "SocketTuningFunctions.h"
+#include "PeerConnectionFunctions.h"
+#include <algorithm>
+#include <fstream>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+// Function to fold an RTT sample in; the minimum is used because request-to-block samples include queueing
+void record_rtt_sample(SocketTuning& tuning, double rtt_ms) {
+    if(tuning.min_rtt_ms == 0 || rtt_ms < tuning.min_rtt_ms) {
+        tuning.min_rtt_ms = std::max(rtt_ms, 0.01);
+    }
+}
+
+// Function to read the sizes the kernel is actually using (it doubles SO_RCVBUF/SO_SNDBUF and autotunes them)
+void read_socket_buffers(int socket, SocketTuning& tuning) {
+    socklen_t length = sizeof(int);
+    getsockopt(socket, SOL_SOCKET, SO_RCVBUF, &tuning.receive_buffer, &length);
+    length = sizeof(int);
+    getsockopt(socket, SOL_SOCKET, SO_SNDBUF, &tuning.send_buffer, &length);
+
+    int notsent_lowat = 0;
+    length = sizeof(notsent_lowat);
+    getsockopt(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &notsent_lowat, &length);
+    tuning.notsent_lowat = notsent_lowat > 0 ? notsent_lowat : 0; // Unset reads back as UINT_MAX
+}
+
+// Helper function to update the smoothed receive rate from the bytes received since the last tune
+static void update_receive_rate(PeerConnection& connection, Clock::time_point now) {
+    SocketTuning& tuning = connection.tuning;
+    double elapsed_s = std::chrono::duration<double>(now - tuning.last_tune).count();
+    double sample = (connection.bytes_received - tuning.last_tune_bytes) / elapsed_s;
+
+    tuning.receive_rate = tuning.receive_rate == 0 ? sample : (tuning.receive_rate + sample) / 2;
+    tuning.last_tune = now;
+    tuning.last_tune_bytes = connection.bytes_received;
+}
+
+// Helper function to read the most the kernel autotunes a receive buffer to (the third tcp_rmem value)
+static int64_t receive_autotune_ceiling() {
+    static int64_t ceiling = [] {
+        std::ifstream tcp_rmem("/proc/sys/net/ipv4/tcp_rmem");
+        int64_t min = 0, initial = 0, max = 0;
+        return tcp_rmem >> min >> initial >> max ? max : 6 * 1024 * 1024; // The kernel default
+    }();
+    return ceiling;
+}
+
+// Helper function to read the most SO_RCVBUF may ask for without CAP_NET_ADMIN (net.core.rmem_max); the kernel
+// clamps larger requests to it, then doubles the value for its bookkeeping
+static int64_t receive_buffer_limit() {
+    static int64_t limit = [] {
+        std::ifstream rmem_max("/proc/sys/net/core/rmem_max");
+        int64_t max = 0;
+        return rmem_max >> max ? max : 208 * 1024; // The usual default
+    }();
+    return limit;
+}
+
+// Helper function to check once whether SO_RCVBUFFORCE works here, i.e. the process has CAP_NET_ADMIN
+static bool can_force_receive_buffer() {
+    static bool allowed = [] {
+        int probe = socket(AF_INET, SOCK_STREAM, 0);
+        int size = 64 * 1024;
+        bool forced = probe != -1 && setsockopt(probe, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == 0;
+        if(probe != -1) close(probe);
+        return forced;
+    }();
+    return allowed;
+}
+
+// Helper function to get a connection's bandwidth-delay product in bytes, 0 until it has been measured
+static double connection_bdp(const SocketTuning& tuning) {
+    return tuning.receive_rate * tuning.min_rtt_ms / 1000.0;
+}
+
+// Function to choose the receive buffer (the effective size, as read back) for a TCP socket about to connect, or 0
+// to leave it to autotuning. A buffer set after connect() turns autotuning off and can't raise the window scale, so
+// it is only ever set up front. Nothing is known about the new peer yet: the size is a guess from the swarm, twice the
+// largest bandwidth-delay product measured on this download's other connections. It is only chosen when that is
+// beyond what autotuning reaches (tcp_rmem's maximum) and the kernel will grant it: with CAP_NET_ADMIN, or when
+// rmem_max allows it; otherwise setting it would clamp the window below what autotuning gives.
+int choose_connect_receive_buffer(const SocketTuningConfig& config, const std::vector<std::unique_ptr<PeerConnection>>& connections) {
+    double bdp = 0;
+    int64_t total_receive_buffers = 0;
+    for(const auto& connection : connections) {
+        if(connection->socket == -1) continue; // uTP sizes its own window
+        bdp = std::max(bdp, connection_bdp(connection->tuning));
+        total_receive_buffers += connection->tuning.receive_buffer;
+    }
+
+    int64_t target = std::min<int64_t>(2 * bdp, config.max_buffer);
+    target = std::min(target, config.total_buffer_limit - total_receive_buffers);
+    if(target <= receive_autotune_ceiling() || (!can_force_receive_buffer() && target / 2 > receive_buffer_limit())) {
+        return 0;
+    }
+    return static_cast<int>(target);
+}
+
+// Function to give a socket about to connect the receive buffer choose_connect_receive_buffer picked, past rmem_max
+// where the process may
+void set_connect_receive_buffer(int socket, int receive_buffer) {
+    int requested = receive_buffer / 2; // The kernel doubles it
+    if(setsockopt(socket, SOL_SOCKET, SO_RCVBUFFORCE, &requested, sizeof(requested)) == -1) {
+        setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &requested, sizeof(requested));
+    }
+}
+
+// Function to update each active connection's receive rate and, from its bandwidth-delay product (rate x min RTT),
+// its TCP_NOTSENT_LOWAT, so requests don't queue behind a full send buffer. That is the only per-peer adaptation:
+// SO_RCVBUF is left to the kernel's autotuning after connect (setting it would switch autotuning off for the socket),
+// and SO_SNDBUF isn't sized at all, since every peer stays choked and the send side only ever carries requests.
+void tune_socket_buffers(const SocketTuningConfig& config, std::vector<std::unique_ptr<PeerConnection>>& connections) {
+    Clock::time_point now = Clock::now();
+
+    for(auto& connection : connections) {
+        SocketTuning& tuning = connection->tuning;
+        if(connection->state != PeerConnectionState::Active || now - tuning.last_tune < std::chrono::milliseconds(config.retune_interval_ms)) {
+            continue;
+        }
+
+        update_receive_rate(*connection, now);
+        if(connection->socket == -1) continue; // uTP sizes its own window; the rate still drives the request pipeline
+        read_socket_buffers(connection->socket, tuning);
+
+        if(tuning.min_rtt_ms == 0 || tuning.receive_rate == 0) continue;
+
+        int notsent_lowat = std::max(config.min_notsent_lowat, static_cast<int>(connection_bdp(tuning) / 4));
+        int difference = std::abs(notsent_lowat - tuning.notsent_lowat);
+        if(tuning.notsent_lowat != 0 && difference <= tuning.notsent_lowat / 4) continue; // Not worth a syscall
+
+        setsockopt(connection->socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &notsent_lowat, sizeof(notsent_lowat));
+        tuning.notsent_lowat = notsent_lowat;
+    }
+}
+
+// Function to capture a connection's tuning for the download summary
+PeerTuningSummary summarize_socket_tuning(const PeerConnection& connection) {
+    const SocketTuning& tuning = connection.tuning;
+    return {format_peer_endpoint(connection.endpoint), tuning.min_rtt_ms, tuning.receive_rate,
+            tuning.receive_buffer, tuning.send_buffer, tuning.notsent_lowat, connection.bytes_received, connection.request_target};
+}
+
+// Function to print the measured RTT and rate, the buffer sizes in use and the request pipeline depth for each peer
+void print_peer_tuning(const std::vector<PeerTuningSummary>& peers) {
+    for(const PeerTuningSummary& peer : peers) {
+        std::cerr << "  " << peer.endpoint << ": " << peer.bytes_received << " bytes, min RTT " << peer.min_rtt_ms << " ms, "
+                  << peer.receive_rate / 1024 << " KiB/s, SO_RCVBUF " << peer.receive_buffer << ", SO_SNDBUF " << peer.send_buffer
+                  << ", TCP_NOTSENT_LOWAT " << (peer.notsent_lowat ? std::to_string(peer.notsent_lowat) : "unset")
+                  << ", " << peer.request_target << " requests in flight" << std::endl;
+    }
+}
@@ -0,0 +1,501 @@
+#include "UdpTrackerFunctions.h"
+#include <algorithm>
+#include <random>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+
+static const uint64_t UDP_TRACKER_PROTOCOL_ID = 0x41727101980ULL; // Magic constant for connect requests
+static const int32_t UDP_ACTION_CONNECT = 0;
+static const int32_t UDP_ACTION_ANNOUNCE = 1;
+static const int32_t UDP_ACTION_SCRAPE = 2;
+static const int32_t UDP_ACTION_ERROR = 3;
+static const size_t UDP_MAX_SCRAPE_HASHES = 74; // Keeps a scrape request within a safe datagram size
+
+// Connection ID handed out by a tracker, valid until 'expires'
+struct UdpTrackerConnection {
+    uint64_t connection_id = 0;
+    std::chrono::steady_clock::time_point expires;
+};
+
+// Per-tracker state while a batch is running
+struct UdpTrackerTarget {
+    std::string key; // "host:port", also the connection cache key
+    sockaddr_storage address = {};
+    socklen_t address_length = 0;
+    int socket = -1;
+    bool needs_connect = false;
+    bool connecting = false;
+    uint32_t transaction_id = 0;
+    int attempts = 0;
+    std::chrono::steady_clock::time_point deadline;
+    bool failed = false;
+};
+
+// Per-job retransmission state while a batch is running
+struct UdpTrackerExchange {
+    size_t target = 0;
+    bool sent = false;
+    uint32_t transaction_id = 0;
+    int attempts = 0;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+// Connection IDs survive across batches so repeated announces skip the connect round trip
+static std::unordered_map<std::string, UdpTrackerConnection>& connection_cache() {
+    static std::unordered_map<std::string, UdpTrackerConnection> cache;
+    return cache;
+}
+
+UdpTrackerConfig& udp_tracker_config() {
+    static UdpTrackerConfig config;
+    return config;
+}
+
+static uint32_t random_uint32() {
+    static std::mt19937 generator(std::random_device{}());
+    return generator();
+}
+
+// Helper functions to write big-endian integers into a packet
+static void append_uint16(std::string& packet, uint16_t value) {
+    packet.push_back(static_cast<char>(value >> 8));
+    packet.push_back(static_cast<char>(value));
+}
+
+static void append_uint32(std::string& packet, uint32_t value) {
+    append_uint16(packet, static_cast<uint16_t>(value >> 16));
+    append_uint16(packet, static_cast<uint16_t>(value));
+}
+
+static void append_uint64(std::string& packet, uint64_t value) {
+    append_uint32(packet, static_cast<uint32_t>(value >> 32));
+    append_uint32(packet, static_cast<uint32_t>(value));
+}
+
+// Helper functions to read big-endian integers from a packet
+static uint32_t read_uint32(const char* data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return ntohl(value);
+}
+
+static uint64_t read_uint64(const char* data) {
+    return (static_cast<uint64_t>(read_uint32(data)) << 32) | read_uint32(data + 4);
+}
+
+// Function to split "udp://host:port/announce" into host and port
+bool parse_udp_tracker_url(const std::string& url, std::string& host, std::string& port) {
+    if(url.rfind("udp://", 0) != 0) {
+        return false;
+    }
+
+    std::string authority = url.substr(6, url.find('/', 6) - 6);
+    size_t colon_index;
+
+    if(!authority.empty() && authority[0] == '[') {
+        // IPv6 literal, e.g. udp://[::1]:6969
+        size_t bracket_index = authority.find(']');
+        if(bracket_index == std::string::npos) {
+            return false;
+        }
+        host = authority.substr(1, bracket_index - 1);
+        colon_index = authority.find(':', bracket_index);
+    }
+    else {
+        colon_index = authority.rfind(':');
+        host = authority.substr(0, colon_index);
+    }
+
+    if(colon_index == std::string::npos || host.empty()) {
+        return false;
+    }
+
+    port = authority.substr(colon_index + 1);
+    return !port.empty();
+}
+
+// Helper function to resolve a tracker and bind it to the batch socket of its address family
+static bool resolve_udp_target(const std::string& url, UdpTrackerTarget& target, std::string& error) {
+    std::string host, port;
+    if(!parse_udp_tracker_url(url, host, port)) {
+        error = "Invalid UDP tracker URL: " + url;
+        return false;
+    }
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    addrinfo* result = nullptr;
+    int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+    if(status != 0 || !result) {
+        error = "Failed to resolve tracker " + host + ": " + gai_strerror(status);
+        return false;
+    }
+
+    memcpy(&target.address, result->ai_addr, result->ai_addrlen);
+    target.address_length = result->ai_addrlen;
+    target.key = host + ":" + port;
+    freeaddrinfo(result);
+
+    return true;
+}
+
+// Helper function to get (or lazily open) the non-blocking socket for an address family
+static int batch_socket(std::unordered_map<int, int>& sockets, int family) {
+    auto it = sockets.find(family);
+    if(it != sockets.end()) {
+        return it->second;
+    }
+
+    int udp_socket = socket(family, SOCK_DGRAM, 0);
+    if(udp_socket == -1) {
+        std::cerr << "Failed to create a UDP socket: " << strerror(errno) << std::endl;
+    }
+    else {
+        fcntl(udp_socket, F_SETFL, fcntl(udp_socket, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    sockets[family] = udp_socket;
+    return udp_socket;
+}
+
+static std::chrono::milliseconds retransmit_timeout(const UdpTrackerConfig& config, int attempts) {
+    return std::chrono::milliseconds(static_cast<int64_t>(config.base_timeout_ms) << attempts);
+}
+
+static void fail_job(UdpTrackerJob& job, const std::string& error) {
+    job.done = true;
+    job.success = false;
+    job.error = error;
+}
+
+// Function to run many connect/request exchanges through one socket per address family.
+// Jobs to the same tracker share one connect, and connection IDs are cached for later batches.
+// 'config' sets how long to wait: udp_tracker_config() by default, or a shorter budget where a caller can't block long.
+void run_udp_tracker_batch(std::vector<UdpTrackerJob>& jobs, const UdpTrackerConfig& config) {
+    using clock = std::chrono::steady_clock;
+
+    auto& cache = connection_cache();
+
+    std::unordered_map<int, int> sockets; // Address family -> socket
+    std::vector<UdpTrackerTarget> targets;
+    std::unordered_map<std::string, size_t> target_by_url;
+    std::vector<UdpTrackerExchange> exchanges(jobs.size());
+
+    // Transaction ID -> (is connect, target or job index)
+    std::unordered_map<uint32_t, std::pair<bool, size_t>> transactions;
+
+    // Step 1: Resolve each distinct tracker once
+    for(size_t i = 0; i < jobs.size(); ++i) {
+        auto found = target_by_url.find(jobs[i].tracker_url);
+        if(found != target_by_url.end()) {
+            exchanges[i].target = found->second;
+            jobs[i].family = targets[found->second].address.ss_family;
+            continue;
+        }
+
+        UdpTrackerTarget target;
+        std::string error;
+        if(!resolve_udp_target(jobs[i].tracker_url, target, error)) {
+            target.failed = true;
+            fail_job(jobs[i], error);
+        }
+        else {
+            target.socket = batch_socket(sockets, target.address.ss_family);
+            target.failed = target.socket == -1;
+        }
+
+        jobs[i].family = target.address.ss_family;
+        exchanges[i].target = targets.size();
+        target_by_url[jobs[i].tracker_url] = targets.size();
+        targets.push_back(target);
+    }
+
+    // Step 2: Drive every exchange until it completes, fails or runs out of retransmits
+    while(true) {
+        auto now = clock::now();
+        auto next_deadline = now + std::chrono::hours(1);
+        bool pending = false;
+
+        for(size_t i = 0; i < jobs.size(); ++i) {
+            UdpTrackerJob& job = jobs[i];
+            UdpTrackerExchange& exchange = exchanges[i];
+            UdpTrackerTarget& target = targets[exchange.target];
+
+            if(job.done) continue;
+            if(target.failed) {
+                fail_job(job, "Tracker " + job.tracker_url + " is unreachable.");
+                continue;
+            }
+
+            pending = true;
+
+            if(exchange.sent && now < exchange.deadline) {
+                next_deadline = std::min(next_deadline, exchange.deadline);
+                continue;
+            }
+
+            if(exchange.sent) {
+                // The previous transmission timed out
+                if(++exchange.attempts > config.max_retransmits) {
+                    transactions.erase(exchange.transaction_id);
+                    fail_job(job, "Tracker " + job.tracker_url + " timed out.");
+                    continue;
+                }
+            }
+
+            auto cached = cache.find(target.key);
+            if(cached == cache.end() || cached->second.expires <= now) {
+                // Need a fresh connection ID before (re)sending
+                exchange.sent = false;
+                target.needs_connect = true;
+                continue;
+            }
+
+            if(!exchange.sent) {
+                exchange.transaction_id = random_uint32();
+                transactions[exchange.transaction_id] = {false, i};
+            }
+
+            std::string packet;
+            append_uint64(packet, cached->second.connection_id);
+            append_uint32(packet, job.action);
+            append_uint32(packet, exchange.transaction_id);
+            packet += job.body;
+
+            sendto(target.socket, packet.data(), packet.size(), 0, reinterpret_cast<sockaddr*>(&target.address), target.address_length);
+
+            exchange.sent = true;
+            exchange.deadline = now + retransmit_timeout(config, exchange.attempts);
+            next_deadline = std::min(next_deadline, exchange.deadline);
+        }
+
+        for(size_t t = 0; t < targets.size(); ++t) {
+            UdpTrackerTarget& target = targets[t];
+            if(!target.needs_connect || target.failed) continue;
+
+            if(target.connecting && now < target.deadline) {
+                next_deadline = std::min(next_deadline, target.deadline);
+                continue;
+            }
+
+            if(target.connecting && ++target.attempts > config.max_retransmits) {
+                transactions.erase(target.transaction_id);
+                target.failed = true;
+                pending = true; // Let the job loop mark the waiting jobs failed
+                next_deadline = now;
+                continue;
+            }
+
+            if(!target.connecting) {
+                target.transaction_id = random_uint32();
+                transactions[target.transaction_id] = {true, t};
+            }
+
+            std::string packet;
+            append_uint64(packet, UDP_TRACKER_PROTOCOL_ID);
+            append_uint32(packet, UDP_ACTION_CONNECT);
+            append_uint32(packet, target.transaction_id);
+
+            sendto(target.socket, packet.data(), packet.size(), 0, reinterpret_cast<sockaddr*>(&target.address), target.address_length);
+
+            target.connecting = true;
+            target.deadline = now + retransmit_timeout(config, target.attempts);
+            next_deadline = std::min(next_deadline, target.deadline);
+        }
+
+        if(!pending) break;
+
+        // Step 3: Wait for replies on any batch socket until the nearest retransmit deadline
+        std::vector<pollfd> poll_fds;
+        for(const auto& [family, udp_socket] : sockets) {
+            if(udp_socket != -1) poll_fds.push_back({udp_socket, POLLIN, 0});
+        }
+
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next_deadline - clock::now()).count();
+        if(poll(poll_fds.data(), poll_fds.size(), static_cast<int>(std::max<int64_t>(wait, 0))) <= 0) {
+            continue;
+        }
+
+        // Step 4: Drain every datagram that is ready and match it to its transaction
+        char datagram[65536];
+        for(const pollfd& poll_fd : poll_fds) {
+            if(!(poll_fd.revents & POLLIN)) continue;
+
+            while(true) {
+                ssize_t received = recv(poll_fd.fd, datagram, sizeof(datagram), MSG_DONTWAIT);
+                if(received < 0) break;
+                if(received < 8) continue;
+
+                int32_t action = static_cast<int32_t>(read_uint32(datagram));
+                uint32_t transaction_id = read_uint32(datagram + 4);
+
+                auto owner = transactions.find(transaction_id);
+                if(owner == transactions.end()) continue; // Late or unknown reply
+                auto [is_connect, index] = owner->second;
+                transactions.erase(owner);
+
+                if(is_connect) {
+                    UdpTrackerTarget& target = targets[index];
+                    target.connecting = false;
+                    target.needs_connect = false;
+                    target.attempts = 0;
+
+                    if(action == UDP_ACTION_CONNECT && received >= 16) {
+                        UdpTrackerConnection& connection = cache[target.key];
+                        connection.connection_id = read_uint64(datagram + 8);
+                        connection.expires = clock::now() + std::chrono::seconds(config.connection_id_lifetime_s);
+                    }
+                    else {
+                        std::cerr << "Tracker " << target.key << " rejected connect: " << std::string(datagram + 8, received - 8) << std::endl;
+                        target.failed = true;
+                    }
+                    continue;
+                }
+
+                UdpTrackerJob& job = jobs[index];
+                job.done = true;
+                if(action == UDP_ACTION_ERROR) {
+                    job.error = std::string(datagram + 8, received - 8);
+                }
+                else if(action == job.action) {
+                    job.reply.assign(datagram + 8, received - 8);
+                    job.success = true;
+                }
+                else {
+                    job.error = "Unexpected action " + std::to_string(action) + " in tracker reply.";
+                }
+            }
+        }
+    }
+
+    for(const auto& [family, udp_socket] : sockets) {
+        if(udp_socket != -1) close(udp_socket);
+    }
+}
+
+// Function to build the announce request body (everything after the 16-byte header)
+std::string build_udp_announce_body(const AnnounceRequest& request) {
+    static const uint32_t key = random_uint32(); // Lets the tracker recognise us across IP changes
+
+    std::string body = hex_to_binary(request.info_hash);
+
+    std::string peer_id = request.peer_id;
+    peer_id.resize(20, '\0');
+    body += peer_id;
+
+    append_uint64(body, request.downloaded);
+    append_uint64(body, request.left);
+    append_uint64(body, request.uploaded);
+    append_uint32(body, static_cast<uint32_t>(request.event));
+    append_uint32(body, 0); // IP address: let the tracker use the sender address
+    append_uint32(body, key);
+    append_uint32(body, static_cast<uint32_t>(request.num_want));
+    append_uint16(body, static_cast<uint16_t>(request.port));
+
+    return body;
+}
+
+// Function to parse an announce reply (everything after action and transaction_id).
+// Trackers reached over IPv6 return 18-byte IPv6 peer entries instead of 6-byte IPv4 ones.
+bool parse_udp_announce_reply(const std::string& reply, int family, AnnounceResponse& response) {
+    if(reply.size() < 12) {
+        std::cerr << "Error: Truncated UDP announce reply." << std::endl;
+        return false;
+    }
+
+    response.interval = read_uint32(reply.data());
+    response.leechers = read_uint32(reply.data() + 4);
+    response.seeders = read_uint32(reply.data() + 8);
+
+    return parse_compact_peers(reply.data() + 12, reply.size() - 12, family, response.peers);
+}
+
+// Function to announce many torrents at once; one result flag per request
+std::vector<bool> udp_announce_batch(const std::vector<AnnounceRequest>& requests, std::vector<AnnounceResponse>& responses,
+                                     const UdpTrackerConfig& config) {
+    std::vector<UdpTrackerJob> jobs(requests.size());
+    for(size_t i = 0; i < requests.size(); ++i) {
+        jobs[i].tracker_url = requests[i].tracker_url;
+        jobs[i].action = UDP_ACTION_ANNOUNCE;
+        jobs[i].body = build_udp_announce_body(requests[i]);
+    }
+
+    run_udp_tracker_batch(jobs, config);
+
+    responses.assign(requests.size(), AnnounceResponse());
+    std::vector<bool> results(requests.size(), false);
+
+    for(size_t i = 0; i < jobs.size(); ++i) {
+        if(jobs[i].success) {
+            results[i] = parse_udp_announce_reply(jobs[i].reply, jobs[i].family, responses[i]);
+        }
+        else {
+            responses[i].failure_reason = jobs[i].error;
+        }
+    }
+
+    return results;
+}
+
+// Function to announce a single torrent to a UDP tracker
+bool udp_announce(const AnnounceRequest& request, AnnounceResponse& response) {
+    std::vector<AnnounceResponse> responses;
+    bool success = udp_announce_batch({request}, responses)[0];
+    response = responses[0];
+
+    if(!success) {
+        std::cerr << "UDP announce failed: " << response.failure_reason << std::endl;
+    }
+
+    return success;
+}
+
+// Function to scrape many info hashes from a UDP tracker, packing up to 74 hashes per request
+bool udp_scrape(const std::string& tracker_url, const std::vector<std::string>& info_hashes, std::vector<ScrapeStats>& stats) {
+    std::vector<UdpTrackerJob> jobs;
+
+    for(size_t i = 0; i < info_hashes.size(); i += UDP_MAX_SCRAPE_HASHES) {
+        UdpTrackerJob job;
+        job.tracker_url = tracker_url;
+        job.action = UDP_ACTION_SCRAPE;
+
+        for(size_t j = i; j < std::min(info_hashes.size(), i + UDP_MAX_SCRAPE_HASHES); ++j) {
+            job.body += hex_to_binary(info_hashes[j]);
+        }
+
+        jobs.push_back(job);
+    }
+
+    run_udp_tracker_batch(jobs);
+
+    bool success = true;
+    for(size_t i = 0; i < jobs.size(); ++i) {
+        size_t first_hash = i * UDP_MAX_SCRAPE_HASHES;
+        size_t hash_count = std::min(info_hashes.size() - first_hash, UDP_MAX_SCRAPE_HASHES);
+
+        if(!jobs[i].success || jobs[i].reply.size() < hash_count * 12) {
+            std::cerr << "UDP scrape failed: " << jobs[i].error << std::endl;
+            success = false;
+            continue;
+        }
+
+        for(size_t j = 0; j < hash_count; ++j) {
+            const char* entry = jobs[i].reply.data() + j * 12;
+
+            ScrapeStats entry_stats;
+            std::string binary_hash = hex_to_binary(info_hashes[first_hash + j]);
+            memcpy(entry_stats.info_hash.data(), binary_hash.data(), entry_stats.info_hash.size());
+            entry_stats.seeders = read_uint32(entry);
+            entry_stats.completed = read_uint32(entry + 4);
+            entry_stats.leechers = read_uint32(entry + 8);
+            stats.push_back(entry_stats);
+        }
+    }
+
+    return success;
+}
@@ -0,0 +1,836 @@
+#include "UtpFunctions.h"
+#include "EventLoopFunctions.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t HEADER_SIZE = 20;
+static const uint8_t VERSION = 1;
+static const size_t RECV_BATCH = 32;
+static const size_t MAX_DATAGRAM = 4096;   // Larger datagrams are truncated and fail to parse
+static const size_t MAX_SACK_BYTES = 32;   // Covers 256 packets past the gap
+static const size_t MTU_SEARCH_DONE = 16;  // Stop probing once floor and ceiling are this close
+static const size_t MAX_OUTGOING_PACKETS = 1024;
+
+enum UtpPacketType : uint8_t {
+    ST_DATA = 0,
+    ST_FIN = 1,
+    ST_STATE = 2,
+    ST_RESET = 3,
+    ST_SYN = 4
+};
+
+// Parsed packet header (BEP 29) plus where its payload starts
+struct UtpHeader {
+    uint8_t type = 0;
+    uint16_t connection_id = 0;
+    uint32_t timestamp_us = 0;
+    uint32_t timestamp_difference_us = 0;
+    uint32_t window = 0;
+    uint16_t seq_nr = 0;
+    uint16_t ack_nr = 0;
+    const uint8_t* sack = nullptr;
+    size_t sack_length = 0;
+    size_t payload_offset = HEADER_SIZE;
+};
+
+// Helper function to compare sequence numbers across 16-bit wraparound
+static bool seq_less(uint16_t a, uint16_t b) {
+    return static_cast<int16_t>(a - b) < 0;
+}
+
+// Helper function to get the microsecond clock that packet timestamps use; only differences matter
+static uint32_t now_micro() {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count());
+}
+
+static void put_u16(char* out, uint16_t value) { value = htons(value); memcpy(out, &value, sizeof(value)); }
+static void put_u32(char* out, uint32_t value) { value = htonl(value); memcpy(out, &value, sizeof(value)); }
+static uint16_t get_u16(const uint8_t* in) { uint16_t value; memcpy(&value, in, sizeof(value)); return ntohs(value); }
+static uint32_t get_u32(const uint8_t* in) { uint32_t value; memcpy(&value, in, sizeof(value)); return ntohl(value); }
+
+// Helper function to build the lookup key for a remote address and connection ID
+static UtpKey make_key(const sockaddr* address, uint16_t connection_id) {
+    UtpKey key;
+    key.connection_id = connection_id;
+    if(address->sa_family == AF_INET6) {
+        const sockaddr_in6* v6 = reinterpret_cast<const sockaddr_in6*>(address);
+        memcpy(key.address.data(), &v6->sin6_addr, 16);
+        key.port = ntohs(v6->sin6_port);
+    }
+    else {
+        const sockaddr_in* v4 = reinterpret_cast<const sockaddr_in*>(address);
+        key.address = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+        memcpy(key.address.data() + 12, &v4->sin_addr, 4);
+        key.port = ntohs(v4->sin_port);
+    }
+    return key;
+}
+
+// Helper function to express an endpoint in the context socket's family (IPv4 as v4-mapped on a dual-stack socket)
+static bool to_context_family(const UtpContext& context, const PeerEndpoint& endpoint, PeerEndpoint& remote) {
+    if(endpoint.family() == context.family) {
+        remote = endpoint;
+        return true;
+    }
+    if(context.family == AF_INET) {
+        return false; // IPv6 peer but no IPv6 socket
+    }
+
+    remote = {};
+    remote.address.v6.sin6_family = AF_INET6;
+    remote.address.v6.sin6_port = endpoint.address.v4.sin_port;
+    uint8_t* bytes = remote.address.v6.sin6_addr.s6_addr;
+    bytes[10] = bytes[11] = 0xff;
+    memcpy(bytes + 12, &endpoint.address.v4.sin_addr, 4);
+    return true;
+}
+
+// Helper function to parse a datagram's header and extension chain
+static bool parse_header(const uint8_t* data, size_t length, UtpHeader& header) {
+    if(length < HEADER_SIZE || (data[0] & 0x0f) != VERSION) {
+        return false;
+    }
+
+    header.type = data[0] >> 4;
+    header.connection_id = get_u16(data + 2);
+    header.timestamp_us = get_u32(data + 4);
+    header.timestamp_difference_us = get_u32(data + 8);
+    header.window = get_u32(data + 12);
+    header.seq_nr = get_u16(data + 16);
+    header.ack_nr = get_u16(data + 18);
+    if(header.type > ST_SYN) return false;
+
+    uint8_t extension = data[1];
+    size_t offset = HEADER_SIZE;
+    while(extension != 0) {
+        if(offset + 2 > length || offset + 2 + data[offset + 1] > length) return false;
+
+        uint8_t next = data[offset];
+        uint8_t extension_length = data[offset + 1];
+        if(extension == 1) { // Selective ACK
+            header.sack = data + offset + 2;
+            header.sack_length = extension_length;
+        }
+        offset += 2 + extension_length;
+        extension = next;
+    }
+
+    header.payload_offset = offset;
+    return true;
+}
+
+// Helper function to get how many out-of-order bytes we can still take, advertised as our window
+static uint32_t free_receive_window(const UtpSocket& socket) {
+    uint32_t limit = socket.context->config.receive_window;
+    return socket.reorder_bytes >= limit ? 0 : limit - socket.reorder_bytes;
+}
+
+// Helper function to fill in the fields of a header that change with every transmission
+static void write_header(UtpSocket& socket, char* out, uint8_t type, uint16_t seq_nr, uint8_t extension) {
+    out[0] = static_cast<char>((type << 4) | VERSION);
+    out[1] = static_cast<char>(extension);
+    put_u16(out + 2, type == ST_SYN ? socket.recv_id : socket.send_id);
+    put_u32(out + 4, now_micro());
+    put_u32(out + 8, socket.reply_micro);
+    put_u32(out + 12, free_receive_window(socket));
+    put_u16(out + 16, seq_nr);
+    put_u16(out + 18, socket.ack_nr);
+}
+
+// Helper function to send one datagram. Everything, probes included, goes out of the main socket with DF set;
+// a packet bigger than the path allows is retransmitted through the fragmenting socket instead of being split.
+static bool send_datagram(UtpSocket& socket, const std::string& datagram, bool allow_fragments) {
+    UtpContext& context = *socket.context;
+    int udp_socket = allow_fragments ? context.fragment_socket : context.socket;
+    ssize_t sent = sendto(udp_socket, datagram.data(), datagram.size(), 0, socket.remote.sockaddr_ptr(), socket.remote.length());
+
+    if(sent < 0 && errno == EMSGSIZE && !allow_fragments) {
+        socket.mtu_ceiling = std::min(socket.mtu_ceiling, datagram.size() - 1);
+        return send_datagram(socket, datagram, true);
+    }
+
+    ++context.packets_sent;
+    return sent >= 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS; // Those count as losses
+}
+
+// Helper function to arm the retransmission timer if it isn't already running
+static void arm_timeout(UtpSocket& socket) {
+    if(socket.timeout_deadline == Clock::time_point()) {
+        socket.timeout_deadline = Clock::now() + std::chrono::milliseconds(socket.timeout_ms);
+    }
+}
+
+// Helper function to (re)transmit a queued packet with a fresh header
+static void transmit_packet(UtpSocket& socket, UtpPacket& packet) {
+    uint8_t type = static_cast<uint8_t>(packet.datagram[0]) >> 4;
+    write_header(socket, packet.datagram.data(), type, packet.seq_nr, 0);
+
+    if(packet.transmissions > 0) ++socket.context->packets_resent;
+    ++packet.transmissions;
+    packet.sent = Clock::now();
+    packet.need_resend = false;
+    socket.bytes_in_flight += packet.datagram.size();
+    socket.need_ack = false; // Every packet carries our ack_nr
+
+    send_datagram(socket, packet.datagram, packet.datagram.size() > socket.mtu_ceiling);
+    arm_timeout(socket);
+
+    if(packet.mtu_probe && packet.datagram.size() > socket.mtu_ceiling) {
+        packet.mtu_probe = false; // Too big for the local interface; it went out fragmented
+        socket.mtu_probe_size = 0;
+    }
+}
+
+// Helper function to send a state packet acknowledging what we received, with a SACK past any gap
+static void send_ack(UtpSocket& socket) {
+    std::string datagram(HEADER_SIZE, '\0');
+    uint8_t extension = 0;
+
+    if(!socket.reorder.empty()) {
+        uint8_t mask[MAX_SACK_BYTES] = {};
+        size_t used = 0;
+        for(const auto& [seq_nr, payload] : socket.reorder) {
+            size_t bit = static_cast<uint16_t>(seq_nr - socket.ack_nr - 2); // Bit 0 is ack_nr + 2
+            if(bit >= MAX_SACK_BYTES * 8) continue;
+            mask[bit / 8] |= 1 << (bit % 8);
+            used = std::max(used, bit / 8 + 1);
+        }
+
+        if(used > 0) {
+            size_t length = (used + 3) / 4 * 4;
+            datagram.push_back(0); // No further extension
+            datagram.push_back(static_cast<char>(length));
+            datagram.append(reinterpret_cast<const char*>(mask), length);
+            extension = 1;
+        }
+    }
+
+    write_header(socket, datagram.data(), ST_STATE, socket.seq_nr, extension);
+    send_datagram(socket, datagram, false);
+    socket.need_ack = false;
+}
+
+// Helper function to get how many bytes the congestion and receive windows allow in flight
+static size_t send_window(const UtpSocket& socket) {
+    return static_cast<size_t>(std::min<double>(socket.max_window, socket.peer_window));
+}
+
+// Helper function to get the datagram size for the next data packet, starting an MTU probe when one is due
+static size_t next_datagram_size(UtpSocket& socket) {
+    bool search_open = socket.mtu_ceiling > socket.mtu_floor + MTU_SEARCH_DONE;
+    if(search_open && socket.mtu_probe_size == 0 && socket.state == UtpState::Connected) {
+        size_t probe = (socket.mtu_floor + socket.mtu_ceiling) / 2;
+        if(socket.send_pending.size() >= probe - HEADER_SIZE) {
+            socket.mtu_probe_size = probe;
+            socket.mtu_probe_seq = socket.seq_nr;
+            return probe;
+        }
+    }
+    return socket.mtu_floor;
+}
+
+// Helper function to retransmit lost packets and packetise pending bytes while the window has room (after our FIN
+// there are none left). One packet may always be in flight, so a zero window or a collapsed congestion window
+// can't stall the connection.
+static void send_packets(UtpSocket& socket) {
+    if(socket.state != UtpState::Connected && socket.state != UtpState::FinSent) return;
+
+    for(UtpPacket& packet : socket.outgoing) {
+        if(!packet.need_resend) continue;
+        if(socket.bytes_in_flight > 0 && socket.bytes_in_flight + packet.datagram.size() > send_window(socket)) return;
+        transmit_packet(socket, packet);
+    }
+
+    while(!socket.send_pending.empty() && socket.outgoing.size() < MAX_OUTGOING_PACKETS) {
+        size_t datagram_size = next_datagram_size(socket);
+        size_t payload = std::min(datagram_size - HEADER_SIZE, socket.send_pending.size());
+        if(socket.bytes_in_flight > 0 && socket.bytes_in_flight + HEADER_SIZE + payload > send_window(socket)) {
+            if(socket.mtu_probe_seq == socket.seq_nr) socket.mtu_probe_size = 0; // Probe again when there's room
+            return;
+        }
+
+        UtpPacket& packet = socket.outgoing.emplace_back();
+        packet.seq_nr = socket.seq_nr++;
+        packet.mtu_probe = socket.mtu_probe_size != 0 && packet.seq_nr == socket.mtu_probe_seq;
+        packet.datagram.resize(HEADER_SIZE);
+        packet.datagram[0] = static_cast<char>(ST_DATA << 4);
+        packet.datagram.append(socket.send_pending, 0, payload);
+        socket.send_pending.erase(0, payload);
+
+        transmit_packet(socket, packet);
+    }
+}
+
+// Helper function to react to a lost packet: a lost MTU probe only lowers the ceiling, anything else halves
+// the window once per window of data (the next cut waits until everything sent so far is acknowledged)
+static void mark_packet_lost(UtpSocket& socket, UtpPacket& packet) {
+    if(packet.need_resend || packet.sacked) return;
+
+    packet.need_resend = true;
+    socket.bytes_in_flight -= std::min(socket.bytes_in_flight, packet.datagram.size());
+
+    if(packet.mtu_probe) {
+        socket.mtu_ceiling = packet.datagram.size() - 1;
+        socket.mtu_probe_size = 0;
+        packet.mtu_probe = false;
+        return;
+    }
+
+    if(!seq_less(packet.seq_nr, socket.loss_recovery_seq)) {
+        double minimum = static_cast<double>(socket.mtu_floor);
+        socket.max_window = std::max(socket.max_window / 2, minimum);
+        socket.slow_start_threshold = socket.max_window;
+        socket.slow_start = false;
+        socket.loss_recovery_seq = socket.seq_nr;
+    }
+}
+
+// Helper function to fold a one-way delay sample (as measured by the peer) into the base delay history
+static void update_delay(UtpSocket& socket, uint32_t delay_us) {
+    Clock::time_point now = Clock::now();
+    if(now - socket.base_delay_rotated >= std::chrono::minutes(1)) {
+        socket.base_delay[1] = socket.base_delay[0];
+        socket.base_delay[0] = UINT32_MAX;
+        socket.base_delay_rotated = now;
+    }
+
+    // Delays are differences of unsynchronised clocks, so only the distance to the minimum means anything
+    uint32_t base = std::min(socket.base_delay[0], socket.base_delay[1]);
+    if(base == UINT32_MAX || static_cast<int32_t>(delay_us - base) < 0) {
+        base = delay_us;
+    }
+    if(socket.base_delay[0] == UINT32_MAX || static_cast<int32_t>(delay_us - socket.base_delay[0]) < 0) {
+        socket.base_delay[0] = delay_us;
+    }
+
+    socket.our_delay_us = delay_us - base;
+}
+
+// Helper function to apply LEDBAT: grow the window in proportion to how far the queuing delay is under
+// target (shrink it when over), scaled by the share of the window just acknowledged. Slow start doubles
+// the window per RTT until the delay reaches most of the target or a loss ends it.
+static void update_window(UtpSocket& socket, size_t bytes_acked, size_t flight_before_ack) {
+    const UtpConfig& config = socket.context->config;
+    double target = config.target_delay_us;
+    double off_target = target - static_cast<double>(socket.our_delay_us);
+    bool window_limited = flight_before_ack + socket.mtu_floor >= socket.max_window;
+
+    if(socket.slow_start && socket.our_delay_us > target * 0.9) {
+        socket.slow_start = false;
+    }
+
+    if(socket.slow_start) {
+        if(window_limited) socket.max_window += bytes_acked;
+        if(socket.slow_start_threshold > 0 && socket.max_window >= socket.slow_start_threshold) socket.slow_start = false;
+    }
+    else if(off_target < 0 || window_limited) {
+        double window_factor = static_cast<double>(bytes_acked) / std::max<double>(socket.max_window, bytes_acked);
+        socket.max_window += config.max_window_increase * (off_target / target) * window_factor;
+    }
+
+    socket.max_window = std::max(socket.max_window, static_cast<double>(socket.mtu_floor));
+}
+
+// Helper function to update the RTT estimate and retransmission timeout from a packet sent only once
+static void update_rtt(UtpSocket& socket, const UtpPacket& packet) {
+    double sample = std::chrono::duration<double, std::milli>(Clock::now() - packet.sent).count();
+    if(socket.rtt_ms == 0) {
+        socket.rtt_ms = sample;
+        socket.rtt_var_ms = sample / 2;
+    }
+    else {
+        socket.rtt_var_ms += (std::abs(socket.rtt_ms - sample) - socket.rtt_var_ms) / 4;
+        socket.rtt_ms += (sample - socket.rtt_ms) / 8;
+    }
+    socket.timeout_ms = std::max(static_cast<int>(socket.rtt_ms + 4 * socket.rtt_var_ms), socket.context->config.min_timeout_ms);
+}
+
+// Helper function to drop acknowledged packets, mark selectively acknowledged ones, and detect losses
+// from three duplicate ACKs or three packets selectively acknowledged past a gap
+static void process_acks(UtpSocket& socket, const UtpHeader& header, bool carries_data) {
+    size_t flight_before_ack = socket.bytes_in_flight;
+    size_t bytes_acked = 0;
+    bool progressed = false;
+    bool gap_filled = false;
+
+    while(!socket.outgoing.empty() && !seq_less(header.ack_nr, socket.outgoing.front().seq_nr)) {
+        UtpPacket& packet = socket.outgoing.front();
+        if(!packet.need_resend && !packet.sacked) {
+            socket.bytes_in_flight -= std::min(socket.bytes_in_flight, packet.datagram.size());
+        }
+        if(!packet.sacked) bytes_acked += packet.datagram.size();
+        gap_filled = gap_filled || packet.transmissions > 1 || packet.sacked;
+
+        // Only the packet this ACK names gives a clean sample, and only if it wasn't held up behind a lost one
+        if(packet.seq_nr == header.ack_nr && packet.transmissions == 1 && !gap_filled) {
+            update_rtt(socket, packet);
+        }
+        if(packet.mtu_probe) {
+            socket.mtu_floor = std::max(socket.mtu_floor, packet.datagram.size());
+            socket.mtu_probe_size = 0;
+        }
+        socket.outgoing.pop_front();
+        progressed = true;
+    }
+
+    int sacked_past = 0;
+    if(header.sack) {
+        for(auto packet = socket.outgoing.rbegin(); packet != socket.outgoing.rend(); ++packet) {
+            size_t bit = static_cast<uint16_t>(packet->seq_nr - header.ack_nr - 2);
+            bool sacked = bit < header.sack_length * 8 && (header.sack[bit / 8] & (1 << (bit % 8)));
+            if(sacked && !packet->sacked) {
+                if(!packet->need_resend) socket.bytes_in_flight -= std::min(socket.bytes_in_flight, packet->datagram.size());
+                bytes_acked += packet->datagram.size();
+                packet->sacked = true;
+                if(packet->mtu_probe) {
+                    socket.mtu_floor = std::max(socket.mtu_floor, packet->datagram.size());
+                    socket.mtu_probe_size = 0;
+                    packet->mtu_probe = false;
+                }
+            }
+
+            if(packet->sacked) {
+                ++sacked_past;
+            }
+            else if(sacked_past >= 3 && (packet->transmissions == 1 || Clock::now() - packet->sent > std::chrono::duration<double, std::milli>(2 * socket.rtt_ms))) {
+                mark_packet_lost(socket, *packet); // A retransmission gets two RTTs to arrive before it's presumed lost too
+            }
+        }
+    }
+
+    if(!progressed && !carries_data && header.ack_nr == socket.last_ack_received && !socket.outgoing.empty()) {
+        if(++socket.duplicate_acks == 3) {
+            mark_packet_lost(socket, socket.outgoing.front());
+        }
+    }
+    else if(progressed) {
+        socket.duplicate_acks = 0;
+    }
+    socket.last_ack_received = header.ack_nr;
+
+    if(header.timestamp_difference_us != 0) {
+        update_delay(socket, header.timestamp_difference_us);
+    }
+    if(bytes_acked > 0) {
+        update_window(socket, bytes_acked, flight_before_ack);
+    }
+
+    if(progressed) {
+        // New data got through, so the backoff ends even if only retransmissions (which give no RTT sample) were acked
+        if(socket.rtt_ms > 0) {
+            socket.timeout_ms = std::max(static_cast<int>(socket.rtt_ms + 4 * socket.rtt_var_ms), socket.context->config.min_timeout_ms);
+        }
+        socket.timeouts = 0;
+        socket.timeout_deadline = Clock::time_point();
+        if(!socket.outgoing.empty()) arm_timeout(socket);
+    }
+}
+
+// Helper function to deliver in-order payload and anything it unblocks from the reorder buffer
+static void deliver_data(UtpSocket& socket, const UtpHeader& header, const char* payload, size_t length) {
+    uint16_t distance = header.seq_nr - socket.ack_nr;
+    if(distance == 0 || distance > 0x8000) {
+        socket.need_ack = true; // Duplicate: our ACK must have been lost
+        return;
+    }
+
+    if(distance > 1) {
+        if(socket.reorder_bytes + length <= socket.context->config.receive_window && distance <= MAX_SACK_BYTES * 8 &&
+           socket.reorder.emplace(header.seq_nr, std::string(payload, length)).second) {
+            socket.reorder_bytes += length;
+        }
+        socket.need_ack = true;
+        return;
+    }
+
+    socket.ack_nr = header.seq_nr;
+    socket.need_ack = true;
+    if(length > 0 && socket.on_data) socket.on_data(payload, length);
+
+    for(auto next = socket.reorder.find(socket.ack_nr + 1); next != socket.reorder.end() && socket.state == UtpState::Connected;
+        next = socket.reorder.find(socket.ack_nr + 1)) {
+        std::string buffered = std::move(next->second);
+        socket.reorder.erase(next);
+        socket.reorder_bytes -= buffered.size();
+        socket.ack_nr = static_cast<uint16_t>(socket.ack_nr + 1);
+        if(socket.on_data) socket.on_data(buffered.data(), buffered.size());
+    }
+}
+
+// Helper function to end a connection, telling the owner unless it closed the socket itself
+static void fail_socket(UtpSocket& socket, const std::string& reason) {
+    socket.state = UtpState::Closed;
+    auto on_close = std::move(socket.on_close);
+    socket.on_data = nullptr;
+    socket.on_connect = nullptr;
+    if(on_close) on_close(reason);
+}
+
+// Helper function to check whether the peer's FIN is next in sequence and report end of stream
+static void check_fin(UtpSocket& socket) {
+    if(socket.fin_received && socket.state == UtpState::Connected && static_cast<uint16_t>(socket.ack_nr + 1) == socket.eof_seq) {
+        socket.ack_nr = socket.eof_seq;
+        send_ack(socket);
+        fail_socket(socket, "");
+    }
+}
+
+// Helper function to run one received packet through a connection
+static void process_packet(UtpSocket& socket, const UtpHeader& header, const uint8_t* data, size_t length) {
+    if(header.type == ST_RESET) {
+        fail_socket(socket, "uTP connection reset by peer");
+        return;
+    }
+
+    socket.peer_window = header.window;
+    socket.reply_micro = now_micro() - header.timestamp_us;
+
+    if(header.type == ST_SYN) {
+        socket.need_ack = true; // Our reply to the SYN was lost
+        return;
+    }
+
+    if(socket.state == UtpState::SynSent) {
+        if(header.type != ST_STATE) return;
+        socket.state = UtpState::Connected;
+        socket.ack_nr = static_cast<uint16_t>(header.seq_nr - 1); // The peer's first data packet reuses this number
+        process_acks(socket, header, false);
+        if(socket.on_connect) socket.on_connect();
+        if(socket.state == UtpState::Connected) send_packets(socket);
+        return;
+    }
+
+    process_acks(socket, header, header.type == ST_DATA);
+    if(socket.state == UtpState::FinSent && socket.outgoing.empty()) {
+        socket.state = UtpState::Closed; // The peer has our FIN and everything before it
+        return;
+    }
+
+    if(header.type == ST_DATA) {
+        deliver_data(socket, header, reinterpret_cast<const char*>(data + header.payload_offset), length - header.payload_offset);
+    }
+    else if(header.type == ST_FIN) {
+        socket.fin_received = true;
+        socket.eof_seq = header.seq_nr;
+        socket.need_ack = true;
+    }
+
+    check_fin(socket);
+    send_packets(socket);
+}
+
+// Helper function to set up the common state of a new connection
+static UtpSocket& add_socket(UtpContext& context, const PeerEndpoint& remote, uint16_t recv_id, uint16_t send_id) {
+    UtpKey key = make_key(remote.sockaddr_ptr(), recv_id);
+    auto& owned = context.sockets[key] = std::make_unique<UtpSocket>();
+
+    UtpSocket& socket = *owned;
+    socket.context = &context;
+    socket.remote = remote;
+    socket.recv_id = recv_id;
+    socket.send_id = send_id;
+    socket.mtu_floor = context.config.min_datagram;
+    bool ipv6 = remote.family() == AF_INET6 && !IN6_IS_ADDR_V4MAPPED(&remote.address.v6.sin6_addr);
+    socket.mtu_ceiling = context.config.max_datagram - (ipv6 ? 20 : 0); // IPv6 headers are 20 bytes longer
+    socket.max_window = 2.0 * socket.mtu_floor;
+    socket.peer_window = context.config.receive_window; // Until the peer tells us
+    socket.timeout_ms = std::max(1000, context.config.min_timeout_ms);
+    socket.base_delay_rotated = Clock::now();
+    return socket;
+}
+
+// Helper function to accept an incoming SYN and acknowledge it
+static void accept_connection(UtpContext& context, const sockaddr* address, const UtpHeader& header) {
+    PeerEndpoint remote = {};
+    memcpy(&remote.address, address, address->sa_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+
+    UtpSocket& socket = add_socket(context, remote, header.connection_id + 1, header.connection_id);
+    socket.state = UtpState::Connected;
+    socket.ack_nr = header.seq_nr;
+    socket.seq_nr = static_cast<uint16_t>(context.random());
+    socket.loss_recovery_seq = socket.seq_nr;
+    socket.peer_window = header.window;
+    socket.reply_micro = now_micro() - header.timestamp_us;
+
+    send_ack(socket);
+    context.on_accept(socket);
+}
+
+// Helper function to route one datagram to its connection
+static void process_datagram(UtpContext& context, const uint8_t* data, size_t length, const sockaddr* address) {
+    UtpHeader header;
+    if(!parse_header(data, length, header)) return;
+    ++context.packets_received;
+
+    // A SYN carries the initiator's receive ID, which is our send ID; our receive ID is one higher
+    uint16_t recv_id = header.type == ST_SYN ? header.connection_id + 1 : header.connection_id;
+    auto found = context.sockets.find(make_key(address, recv_id));
+
+    if(found == context.sockets.end()) {
+        if(header.type == ST_SYN && context.on_accept) {
+            accept_connection(context, address, header);
+        }
+        return;
+    }
+
+    if(found->second->state != UtpState::Closed) {
+        process_packet(*found->second, header, data, length);
+    }
+}
+
+// Helper function to read every datagram queued on one of the context's sockets; edge-triggered epoll needs it drained
+static void handle_utp_readable(UtpContext& context, int udp_socket) {
+    if(!context.receive_buffer) {
+        context.receive_buffer = std::make_unique_for_overwrite<uint8_t[]>(RECV_BATCH * MAX_DATAGRAM);
+    }
+    uint8_t* buffers = context.receive_buffer.get();
+    mmsghdr messages[RECV_BATCH];
+    iovec vectors[RECV_BATCH];
+    sockaddr_in6 addresses[RECV_BATCH];
+
+    while(true) {
+        for(size_t i = 0; i < RECV_BATCH; ++i) {
+            vectors[i] = {buffers + i * MAX_DATAGRAM, MAX_DATAGRAM};
+            messages[i] = {};
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_name = &addresses[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+        }
+
+        int received = recvmmsg(udp_socket, messages, RECV_BATCH, MSG_DONTWAIT, nullptr);
+        if(received <= 0) {
+            if(received < 0 && errno == EINTR) continue;
+            break; // EAGAIN, or an ICMP error that the per-connection timeouts deal with
+        }
+
+        for(int i = 0; i < received; ++i) {
+            if(messages[i].msg_hdr.msg_flags & MSG_TRUNC) continue;
+            process_datagram(context, buffers + i * MAX_DATAGRAM, messages[i].msg_len, reinterpret_cast<const sockaddr*>(&addresses[i]));
+        }
+
+        if(received < static_cast<int>(RECV_BATCH)) break;
+    }
+}
+
+// Helper function to open a non-blocking UDP socket on 'port' (dual-stack for AF_INET6) with the given path MTU
+// discovery mode. IP_MTU_DISCOVER is set for IPv6 sockets too, since it governs their v4-mapped traffic.
+static int open_utp_socket(int family, int port, int mtu_discovery) {
+    int udp_socket = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(udp_socket == -1) return -1;
+
+    int enable = 1;
+    setsockopt(udp_socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+    setsockopt(udp_socket, IPPROTO_IP, IP_MTU_DISCOVER, &mtu_discovery, sizeof(mtu_discovery));
+
+    int bound;
+    if(family == AF_INET6) {
+        int v6_only = 0;
+        setsockopt(udp_socket, IPPROTO_IPV6, IPV6_V6ONLY, &v6_only, sizeof(v6_only));
+        setsockopt(udp_socket, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &mtu_discovery, sizeof(mtu_discovery));
+        sockaddr_in6 address = {};
+        address.sin6_family = AF_INET6;
+        address.sin6_port = htons(port);
+        bound = bind(udp_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    }
+    else {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        bound = bind(udp_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    }
+    if(bound == -1) {
+        close(udp_socket);
+        return -1;
+    }
+
+    int buffer = 4 * 1024 * 1024; // Every connection's datagrams queue in this one socket
+    setsockopt(udp_socket, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    setsockopt(udp_socket, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+    return udp_socket;
+}
+
+// Function to open the UDP sockets every uTP connection of a download shares; IPv4-only hosts get IPv4 sockets.
+// The main socket sets DF and ignores the kernel's path MTU cache, so oversized probes are lost instead of
+// fragmented. A second socket on the same port lets packets that turned out too big for the path fragment; each
+// socket's mode is set once here rather than toggled per send. Datagrams may arrive on either, so both are read.
+UtpContext* create_utp_context(EventLoop& loop, int port) {
+    auto context = std::make_unique<UtpContext>();
+    context->loop = &loop;
+
+    context->socket = open_utp_socket(AF_INET6, port, IP_PMTUDISC_PROBE);
+    if(context->socket == -1) {
+        context->family = AF_INET;
+        context->socket = open_utp_socket(AF_INET, port, IP_PMTUDISC_PROBE);
+        if(context->socket == -1) {
+            std::cerr << "Failed to open uTP socket: " << strerror(errno) << std::endl;
+            return nullptr;
+        }
+    }
+
+    context->fragment_socket = open_utp_socket(context->family, utp_context_port(*context), IP_PMTUDISC_DONT);
+    if(context->fragment_socket == -1) {
+        context->fragment_socket = context->socket;
+        context->config.max_datagram = context->config.min_datagram; // No way to send a packet past the path MTU: don't probe
+    }
+
+    UtpContext* context_ptr = context.get();
+    int main_socket = context->socket, fragment_socket = context->fragment_socket;
+    if(!event_loop_add(loop, main_socket, EPOLLIN, [context_ptr, main_socket](uint32_t) { handle_utp_readable(*context_ptr, main_socket); }) ||
+       (fragment_socket != main_socket &&
+        !event_loop_add(loop, fragment_socket, EPOLLIN, [context_ptr, fragment_socket](uint32_t) { handle_utp_readable(*context_ptr, fragment_socket); }))) {
+        event_loop_remove(loop, main_socket);
+        close(main_socket);
+        if(fragment_socket != main_socket) close(fragment_socket);
+        return nullptr;
+    }
+
+    return context.release();
+}
+
+// Function to close the UDP sockets. Connections still open get a FIN, sent once: with the sockets gone there is
+// nothing left to retransmit it from, and the peer's own timeout ends the connection if it is lost.
+void destroy_utp_context(UtpContext* context) {
+    if(!context) return;
+
+    for(auto& [key, socket] : context->sockets) {
+        if(socket->state == UtpState::Connected) utp_close(*socket);
+    }
+
+    event_loop_remove(*context->loop, context->socket);
+    close(context->socket);
+    if(context->fragment_socket != context->socket) {
+        event_loop_remove(*context->loop, context->fragment_socket);
+        close(context->fragment_socket);
+    }
+    delete context;
+}
+
+// Function to get the local UDP port the context is bound to
+int utp_context_port(const UtpContext& context) {
+    sockaddr_in6 address = {};
+    socklen_t length = sizeof(address);
+    getsockname(context.socket, reinterpret_cast<sockaddr*>(&address), &length);
+    return ntohs(address.sin6_port); // sin_port sits at the same offset
+}
+
+// Function to start a connection; on_connect runs once the peer acknowledges the SYN
+UtpSocket* utp_connect(UtpContext& context, const PeerEndpoint& endpoint) {
+    PeerEndpoint remote;
+    if(!to_context_family(context, endpoint, remote)) {
+        return nullptr;
+    }
+
+    uint16_t recv_id = static_cast<uint16_t>(context.random());
+    while(context.sockets.count(make_key(remote.sockaddr_ptr(), recv_id))) ++recv_id;
+
+    UtpSocket& socket = add_socket(context, remote, recv_id, recv_id + 1);
+    socket.loss_recovery_seq = socket.seq_nr;
+
+    UtpPacket& syn = socket.outgoing.emplace_back();
+    syn.seq_nr = socket.seq_nr++;
+    syn.datagram.resize(HEADER_SIZE);
+    syn.datagram[0] = static_cast<char>(ST_SYN << 4);
+    transmit_packet(socket, syn);
+    return &socket;
+}
+
+// Function to queue bytes on the connection's stream; they go out as the windows allow
+void utp_write(UtpSocket& socket, const char* data, size_t length) {
+    if(socket.state == UtpState::Closed || socket.state == UtpState::FinSent) return;
+
+    socket.send_pending.append(data, length);
+    send_packets(socket);
+}
+
+// Function to close a connection from our side; no further callbacks run. Bytes not yet sent are dropped and a
+// FIN follows what is in flight. It is retransmitted like data until acknowledged (or max_timeouts pass), and the
+// socket is freed by the tick after that; until then it still acknowledges the peer's packets.
+void utp_close(UtpSocket& socket) {
+    if(socket.state == UtpState::Connected) {
+        socket.send_pending.clear();
+        UtpPacket& fin = socket.outgoing.emplace_back();
+        fin.seq_nr = socket.seq_nr++;
+        fin.datagram.resize(HEADER_SIZE);
+        fin.datagram[0] = static_cast<char>(ST_FIN << 4);
+        transmit_packet(socket, fin);
+        socket.state = UtpState::FinSent;
+    }
+    else if(socket.state != UtpState::FinSent) {
+        socket.state = UtpState::Closed;
+    }
+
+    socket.on_connect = nullptr;
+    socket.on_data = nullptr;
+    socket.on_close = nullptr;
+}
+
+// Function to run retransmission timeouts, send the ACKs owed for this loop iteration's packets (those
+// not already carried by a data packet) and free closed connections. Call once per loop iteration.
+void utp_context_tick(UtpContext& context) {
+    Clock::time_point now = Clock::now();
+
+    for(auto& [key, owned] : context.sockets) {
+        UtpSocket& socket = *owned;
+        if(socket.state == UtpState::Closed) continue;
+
+        if(socket.timeout_deadline != Clock::time_point() && now >= socket.timeout_deadline) {
+            socket.timeout_deadline = Clock::time_point();
+            if(++socket.timeouts > context.config.max_timeouts) {
+                fail_socket(socket, socket.state == UtpState::SynSent ? "uTP connect timed out" : "uTP connection timed out");
+                continue;
+            }
+
+            // Everything in flight is presumed lost: back to one packet, slow start up to half the old window
+            socket.slow_start_threshold = std::max(socket.max_window / 2, static_cast<double>(socket.mtu_floor));
+            socket.slow_start = true;
+            socket.max_window = socket.mtu_floor;
+            socket.timeout_ms = std::min(socket.timeout_ms * 2, 60000);
+            socket.bytes_in_flight = 0;
+            socket.loss_recovery_seq = socket.seq_nr;
+            for(UtpPacket& packet : socket.outgoing) {
+                if(packet.sacked) continue;
+                if(packet.mtu_probe) {
+                    socket.mtu_ceiling = packet.datagram.size() - 1;
+                    socket.mtu_probe_size = 0;
+                    packet.mtu_probe = false;
+                }
+                packet.need_resend = true;
+            }
+
+            if(socket.state == UtpState::SynSent) {
+                transmit_packet(socket, socket.outgoing.front());
+            }
+            else {
+                send_packets(socket);
+            }
+        }
+
+        if(socket.need_ack && (socket.state == UtpState::Connected || socket.state == UtpState::FinSent)) {
+            send_ack(socket);
+        }
+    }
+
+    std::erase_if(context.sockets, [](const auto& entry) { return entry.second->state == UtpState::Closed; });
+}
+
+// Function to get how long the event loop may wait before the next retransmission timeout is due
+int utp_context_timeout_ms(const UtpContext& context, int max_timeout_ms) {
+    Clock::time_point now = Clock::now();
+    int64_t timeout_ms = max_timeout_ms;
+
+    for(const auto& [key, socket] : context.sockets) {
+        if(socket->timeout_deadline != Clock::time_point()) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(socket->timeout_deadline - now).count();
+            timeout_ms = std::min<int64_t>(timeout_ms, std::max<int64_t>(remaining + 1, 0));
+        }
+    }
+
+    return static_cast<int>(timeout_ms);
+}
@@ -0,0 +1,27 @@
+#ifndef TEST_FUNCTIONS_H
+#define TEST_FUNCTIONS_H
+
+#include <iostream>
+
+// Minimal checks for the unit tests: a failed check is reported with its location and counted,
+// and each test's main returns test_result() so ctest sees the failure
+inline int test_failures = 0;
+
+#define CHECK(condition) check_condition((condition), #condition, __FILE__, __LINE__)
+
+inline bool check_condition(bool passed, const char* expression, const char* file, int line) {
+    if(!passed) {
+        std::cerr << file << ":" << line << ": check failed: " << expression << std::endl;
+        ++test_failures;
+    }
+    return passed;
+}
+
+inline int test_result() {
+    if(test_failures > 0) {
+        std::cerr << test_failures << " check(s) failed" << std::endl;
+    }
+    return test_failures == 0 ? 0 : 1;
+}
+
+#endif
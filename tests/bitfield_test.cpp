@@ -0,0 +1,71 @@
+// Tests for the word-packed bitfield kernels, checked against a plain vector<bool> reference over sizes
+// around the 64-bit word boundaries
+
+#include "TestFunctions.h"
+#include "../src/BitfieldFunctions.h"
+#include <random>
+
+// Helper function to pack a reference bitfield into wire bytes (piece 0 is the most significant bit of byte 0)
+static std::string to_wire(const std::vector<bool>& bits) {
+    std::string wire((bits.size() + 7) / 8, '\0');
+    for(size_t i = 0; i < bits.size(); ++i) {
+        if(bits[i]) wire[i / 8] |= static_cast<char>(0x80 >> (i % 8));
+    }
+    return wire;
+}
+
+static void test_against_reference() {
+    std::mt19937 random(12345);
+    for(size_t size : {0, 1, 7, 8, 63, 64, 65, 127, 128, 129, 1000}) {
+        for(int round = 0; round < 20; ++round) {
+            std::vector<bool> a(size), b(size);
+            for(size_t i = 0; i < size; ++i) {
+                a[i] = random() % 4 != 0;
+                b[i] = random() % 4 != 0 || round == 0; // Round 0: 'b' covers all of 'a'
+            }
+
+            Bitfield bits_a, bits_b;
+            CHECK(bitfield_from_wire(bits_a, to_wire(a).data(), to_wire(a).size(), size));
+            CHECK(bitfield_from_wire(bits_b, to_wire(b).data(), to_wire(b).size(), size));
+
+            size_t count = 0;
+            bool any_and_not = false;
+            bool same = true;
+            for(size_t i = 0; i < size; ++i) {
+                count += a[i];
+                any_and_not = any_and_not || (a[i] && !b[i]);
+                same = same && bitfield_test(bits_a, i) == a[i];
+            }
+            CHECK(same);
+            CHECK(!bitfield_test(bits_a, size)); // Past the end reads as clear
+            CHECK(bitfield_count(bits_a) == count);
+            CHECK(bitfield_any_and_not(bits_a, bits_b) == any_and_not);
+        }
+    }
+}
+
+static void test_init_and_set() {
+    Bitfield bitfield;
+    init_bitfield(bitfield, 70, true);
+    CHECK(bitfield_count(bitfield) == 70); // Spare bits in the last word stay clear
+
+    init_bitfield(bitfield, 70);
+    bitfield_set(bitfield, 0);
+    bitfield_set(bitfield, 69);
+    CHECK(bitfield_count(bitfield) == 2 && bitfield_test(bitfield, 0) && bitfield_test(bitfield, 69) && !bitfield_test(bitfield, 1));
+}
+
+static void test_wire_validation() {
+    Bitfield bitfield;
+    CHECK(!bitfield_from_wire(bitfield, "\xff", 1, 9));                 // Too short
+    CHECK(!bitfield_from_wire(bitfield, "\xff\x80", 2, 8));             // Too long
+    CHECK(!bitfield_from_wire(bitfield, "\xff\xc0", 2, 9));             // Spare bit set
+    CHECK(bitfield_from_wire(bitfield, "\xff\x80", 2, 9) && bitfield_count(bitfield) == 9);
+}
+
+int main() {
+    test_against_reference();
+    test_init_and_set();
+    test_wire_validation();
+    return test_result();
+}
@@ -0,0 +1,48 @@
+// Tests for magnet link parsing: hexadecimal and base32 info hashes, the optional parameters, and rejected links
+
+#include "TestFunctions.h"
+#include "../src/MagnetFunctions.h"
+
+static void test_hex_hash() {
+    MagnetLink magnet;
+    CHECK(parse_magnet_link("magnet:?xt=urn:btih:43CEBA97FCD115A566027CAE790B57B5288B6BDE&dn=sample+file%2Etxt"
+                            "&tr=udp%3A%2F%2Ftracker.example.org%3A6969&tr=http://other.example.org/announce"
+                            "&x.pe=127.0.0.1:6881&x.pe=[::1]:51413&x.pe=not-a-peer&unknown=1", magnet));
+    CHECK(magnet.info_hash == "43ceba97fcd115a566027cae790b57b5288b6bde");
+    CHECK(magnet.display_name == "sample file.txt");
+    CHECK(magnet.trackers.size() == 2);
+    if(magnet.trackers.size() == 2) {
+        CHECK(magnet.trackers[0] == "udp://tracker.example.org:6969");
+        CHECK(magnet.trackers[1] == "http://other.example.org/announce");
+    }
+    CHECK(magnet.peers.size() == 2);
+    if(magnet.peers.size() == 2) {
+        CHECK(format_peer_endpoint(magnet.peers[0]) == "127.0.0.1:6881");
+        CHECK(format_peer_endpoint(magnet.peers[1]) == "[::1]:51413");
+    }
+}
+
+static void test_base32_hash() {
+    // The same hash as above in base32, in either case
+    MagnetLink magnet;
+    CHECK(!parse_magnet_link("magnet:?xt=urn:btih:IPHLVF742EK2KZQCPSXHSC2XWUUIW2662", magnet)); // 33 characters
+    CHECK(parse_magnet_link("magnet:?xt=urn:btih:IPHLVF742EK2KZQCPSXHSC2XWUUIW266", magnet));
+    CHECK(magnet.info_hash == "43ceba97fcd115a566027cae790b57b5288b6bde");
+    CHECK(parse_magnet_link("magnet:?xt=urn:btih:iphlvf742ek2kzqcpsxhsc2xwuuiw266", magnet));
+    CHECK(magnet.info_hash == "43ceba97fcd115a566027cae790b57b5288b6bde");
+}
+
+static void test_invalid_links() {
+    MagnetLink magnet;
+    CHECK(!parse_magnet_link("http://example.org/?xt=urn:btih:43ceba97fcd115a566027cae790b57b5288b6bde", magnet));
+    CHECK(!parse_magnet_link("magnet:?dn=no+hash", magnet));
+    CHECK(!parse_magnet_link("magnet:?xt=urn:btih:43ceba97fcd115a566027cae790b57b5288b6bdz", magnet));
+    CHECK(!parse_magnet_link("magnet:?xt=urn:btih:IPHLVF742EK2KZQCPSXHSC2XWUUIW251", magnet)); // '1' isn't base32
+}
+
+int main() {
+    test_hex_hash();
+    test_base32_hash();
+    test_invalid_links();
+    return test_result();
+}
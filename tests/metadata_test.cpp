@@ -0,0 +1,112 @@
+// Tests for fetching the info dictionary over ut_metadata: pieces assembled out of order, the hash check, rejects,
+// and the cap on piece messages a peer may send before the metadata arrives
+
+#include "TestFunctions.h"
+#include "../src/DownloadPieceFunctions.h"
+#include "../src/InfoFunctions.h"
+
+// Helper function to make metadata spanning three pieces, the last one short
+static std::string make_metadata() {
+    std::string metadata = "d6:lengthi1e4:name4:test12:piece lengthi16384e6:pieces40000:";
+    for(int i = 0; i < 40000; ++i) metadata.push_back(static_cast<char>(i * 7));
+    return metadata + "e";
+}
+
+// Helper function to add an active peer that supports ut_metadata and states the metadata's size
+static PeerConnection& add_metadata_peer(TorrentDownload& torrent, int64_t metadata_size) {
+    auto connection = std::make_unique<PeerConnection>();
+    connection->state = PeerConnectionState::Active;
+    connection->extensions.metadata_id = 3;
+    connection->extensions.metadata_size = metadata_size;
+    torrent.connections.push_back(std::move(connection));
+    return *torrent.connections.back();
+}
+
+// Helper function to hand the download a ut_metadata data message for one piece
+static void deliver_piece(TorrentDownload& torrent, PeerConnection& connection, const std::string& metadata, int piece, bool corrupt = false) {
+    json header = {{"msg_type", 1}, {"piece", piece}, {"total_size", static_cast<int64_t>(metadata.size())}};
+    std::string data = metadata.substr(piece * METADATA_PIECE_SIZE, METADATA_PIECE_SIZE);
+    if(corrupt) data[0] ^= 1;
+
+    std::string payload = bencode(header) + data;
+    handle_metadata_message(torrent, connection, payload.data(), payload.size());
+}
+
+static void test_assembly() {
+    std::string metadata = make_metadata();
+    TorrentDownload torrent;
+    CHECK(init_metadata_download(torrent, sha1(metadata), "-BT0001-000000000000"));
+
+    PeerConnection& first = add_metadata_peer(torrent, metadata.size());
+    PeerConnection& second = add_metadata_peer(torrent, metadata.size());
+    on_metadata_peer_handshake(torrent, first);
+    CHECK(torrent.metadata.received.size() == 3);
+
+    // Pieces nobody was asked for go to the second peer before any are asked twice
+    CHECK((first.metadata_requests == std::vector<int>{0, 1}));
+    CHECK((second.metadata_requests == std::vector<int>{2}));
+
+    deliver_piece(torrent, second, metadata, 2);
+    deliver_piece(torrent, first, metadata, 1);
+    CHECK(!torrent.metadata.complete && torrent.metadata.pieces_remaining == 1);
+    deliver_piece(torrent, first, metadata, 0);
+
+    CHECK(torrent.metadata.complete && metadata_download_done(torrent));
+    CHECK(torrent.metadata.data == metadata);
+    finish_torrent_download(torrent);
+}
+
+static void test_hash_mismatch() {
+    std::string metadata = make_metadata();
+    TorrentDownload torrent;
+    CHECK(init_metadata_download(torrent, sha1(metadata), "-BT0001-000000000000"));
+
+    PeerConnection& peer = add_metadata_peer(torrent, metadata.size());
+    on_metadata_peer_handshake(torrent, peer);
+    deliver_piece(torrent, peer, metadata, 0, true);
+    deliver_piece(torrent, peer, metadata, 1);
+    deliver_piece(torrent, peer, metadata, 2);
+
+    // Every piece is fetched again
+    CHECK(!torrent.metadata.complete && torrent.metadata.hash_failures == 1 && torrent.metadata.pieces_remaining == 3);
+    CHECK(!peer.metadata_requests.empty());
+    finish_torrent_download(torrent);
+}
+
+static void test_reject() {
+    std::string metadata = make_metadata();
+    TorrentDownload torrent;
+    CHECK(init_metadata_download(torrent, sha1(metadata), "-BT0001-000000000000"));
+
+    PeerConnection& peer = add_metadata_peer(torrent, metadata.size());
+    on_metadata_peer_handshake(torrent, peer);
+    std::string reject = bencode(json{{"msg_type", 2}, {"piece", 0}});
+    handle_metadata_message(torrent, peer, reject.data(), reject.size());
+
+    CHECK(peer.metadata_rejected);
+    CHECK(torrent.metadata.requests[0] == 0);
+    finish_torrent_download(torrent);
+}
+
+static void test_deferred_cap() {
+    TorrentDownload torrent;
+    CHECK(init_metadata_download(torrent, std::string(40, '0'), "-BT0001-000000000000"));
+    PeerConnection& peer = add_metadata_peer(torrent, 0);
+
+    // Have messages are held until the piece count is known, but not without bound
+    const char have[4] = {0, 0, 0, 1};
+    for(int i = 0; i < 100000 && peer.state != PeerConnectionState::Closed; ++i) {
+        handle_peer_message(torrent, peer, 4, have, sizeof(have));
+    }
+    CHECK(peer.state == PeerConnectionState::Closed);
+    CHECK(peer.deferred_messages.size() > 1000 && peer.deferred_messages.size() < 100000);
+    finish_torrent_download(torrent);
+}
+
+int main() {
+    test_assembly();
+    test_hash_mismatch();
+    test_reject();
+    test_deferred_cap();
+    return test_result();
+}
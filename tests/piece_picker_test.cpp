@@ -0,0 +1,99 @@
+// Tests for the rarest-first piece picker: bucket moves on availability changes, removal and the pick order,
+// with the bucket layout checked against the availability counts after every step
+
+#include "TestFunctions.h"
+#include "../src/PiecePickerFunctions.h"
+#include <random>
+
+// Helper function to check that every listed piece sits at its recorded position, inside the bucket of its availability
+static bool picker_consistent(const PiecePicker& picker) {
+    for(const PickerLevel& level : picker.levels) {
+        if(level.bucket_start.empty() || level.bucket_start.front() != 0 || level.bucket_start.back() != level.pieces.size()) return false;
+
+        for(size_t bucket = 0; bucket + 1 < level.bucket_start.size(); ++bucket) {
+            for(size_t position = level.bucket_start[bucket]; position < level.bucket_start[bucket + 1]; ++position) {
+                int piece_index = level.pieces[position];
+                if(picker.position[piece_index] != position || picker.availability[piece_index] != bucket) return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void test_bucket_moves() {
+    const int pieces = 200;
+    PiecePicker picker;
+    init_piece_picker(picker, std::vector<uint8_t>(pieces, DEFAULT_PIECE_PRIORITY));
+    CHECK(picker_consistent(picker));
+
+    std::mt19937 random(7);
+    std::vector<bool> removed(pieces);
+    bool consistent = true;
+    for(int step = 0; step < 5000; ++step) {
+        int piece_index = static_cast<int>(random() % pieces);
+        switch(random() % 8) {
+            case 0: if(!removed[piece_index]) { piece_picker_remove(picker, piece_index); removed[piece_index] = true; } break;
+            case 1: case 2: case 3: piece_picker_decrement(picker, piece_index); break;
+            default: piece_picker_increment(picker, piece_index); break;
+        }
+        consistent = consistent && picker_consistent(picker);
+    }
+    CHECK(consistent);
+
+    size_t listed = 0;
+    for(int piece_index = 0; piece_index < pieces; ++piece_index) listed += !removed[piece_index];
+    CHECK(picker.levels[DEFAULT_PIECE_PRIORITY].pieces.size() == listed);
+}
+
+static void test_add_peer() {
+    PiecePicker picker;
+    init_piece_picker(picker, std::vector<uint8_t>(70, DEFAULT_PIECE_PRIORITY));
+
+    Bitfield pieces;
+    init_bitfield(pieces, 70);
+    bitfield_set(pieces, 0);
+    bitfield_set(pieces, 64);
+    bitfield_set(pieces, 69);
+    piece_picker_add_peer(picker, pieces, 1);
+    piece_picker_add_peer(picker, pieces, 1);
+    CHECK(picker.availability[0] == 2 && picker.availability[64] == 2 && picker.availability[69] == 2 && picker.availability[1] == 0);
+
+    piece_picker_add_peer(picker, pieces, -1);
+    CHECK(picker.availability[69] == 1 && picker_consistent(picker));
+}
+
+static void test_pick_order() {
+    // Piece 3 is unwanted (priority 0), piece 4 comes first
+    std::vector<uint8_t> priorities = {4, 4, 4, 0, 7};
+    PiecePicker picker;
+    init_piece_picker(picker, priorities);
+
+    for(int piece_index : {0, 0, 0, 1, 2, 2, 3, 4, 4, 4}) {
+        piece_picker_increment(picker, piece_index);
+    }
+    CHECK(picker_consistent(picker));
+
+    auto any = [](int) { return true; };
+    CHECK(piece_picker_pick(picker, any) == 4);
+
+    auto not_first = [](int piece_index) { return piece_index != 4; };
+    CHECK(piece_picker_pick(picker, not_first) == 1); // Rarest of the default priority
+
+    piece_picker_remove(picker, 1);
+    CHECK(piece_picker_pick(picker, not_first) == 2);
+    CHECK(picker_consistent(picker));
+
+    // A piece no peer has is never offered, since no peer could be asked for it
+    piece_picker_decrement(picker, 2);
+    piece_picker_decrement(picker, 2);
+    CHECK(piece_picker_pick(picker, not_first) == 0);
+    auto none = [](int) { return false; };
+    CHECK(piece_picker_pick(picker, none) == -1);
+}
+
+int main() {
+    test_bucket_moves();
+    test_add_peer();
+    test_pick_order();
+    return test_result();
+}
@@ -0,0 +1,40 @@
+// Tests for scrape support: deriving the scrape URL from an announce URL, and printing counters a tracker left out
+
+#include "TestFunctions.h"
+#include "../src/ScrapeFunctions.h"
+
+static void test_scrape_url() {
+    std::string scrape_url;
+    CHECK(scrape_url_from_announce("http://tracker.example.org/announce", scrape_url));
+    CHECK(scrape_url == "http://tracker.example.org/scrape");
+    CHECK(scrape_url_from_announce("http://tracker.example.org/x/announce.php?passkey=abc", scrape_url));
+    CHECK(scrape_url == "http://tracker.example.org/x/scrape.php?passkey=abc");
+    CHECK(scrape_url_from_announce("udp://tracker.example.org:6969/announce", scrape_url));
+    CHECK(scrape_url == "udp://tracker.example.org:6969/announce");
+
+    // Only a last path component starting with "announce" can be converted
+    CHECK(!scrape_url_from_announce("http://tracker.example.org/a", scrape_url));
+    CHECK(!scrape_url_from_announce("http://tracker.example.org/announce/x", scrape_url));
+}
+
+static void test_print_unknown_counters() {
+    ScrapeStats stats;
+    stats.info_hash.fill('\x01');
+    stats.seeders = 4;
+    stats.completed = 0;
+
+    std::ostringstream output;
+    std::streambuf* previous = std::cout.rdbuf(output.rdbuf());
+    print_scrape_stats({stats});
+    std::cout.rdbuf(previous);
+
+    std::string hex_hash;
+    for(int i = 0; i < 20; ++i) hex_hash += "01";
+    CHECK(output.str() == hex_hash + " seeders: 4 completed: 0 leechers: unknown\n");
+}
+
+int main() {
+    test_scrape_url();
+    test_print_unknown_counters();
+    return test_result();
+}
@@ -0,0 +1,180 @@
+// Tests for the UDP tracker client (BEP 15): URL parsing, announce packet layout and reply parsing,
+// and one connect-then-announce exchange against a scripted tracker on loopback.
+
+#include "TestFunctions.h"
+#include "../src/UdpTrackerFunctions.h"
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+
+// Helper function to read a big-endian integer of 'bytes' bytes
+static uint64_t read_big_endian(const std::string& data, size_t offset, size_t bytes) {
+    uint64_t value = 0;
+    for(size_t i = 0; i < bytes; ++i) {
+        value = (value << 8) | static_cast<uint8_t>(data[offset + i]);
+    }
+    return value;
+}
+
+// Helper function to append a big-endian integer of 'bytes' bytes
+static void append_big_endian(std::string& data, uint64_t value, size_t bytes) {
+    for(size_t i = bytes; i-- > 0;) {
+        data.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+static void test_parse_url() {
+    std::string host, port;
+    CHECK(parse_udp_tracker_url("udp://tracker.example.org:6969/announce", host, port));
+    CHECK(host == "tracker.example.org" && port == "6969");
+    CHECK(parse_udp_tracker_url("udp://[::1]:1337", host, port));
+    CHECK(host == "::1" && port == "1337");
+    CHECK(!parse_udp_tracker_url("udp://tracker.example.org/announce", host, port));
+    CHECK(!parse_udp_tracker_url("http://tracker.example.org:80/announce", host, port));
+}
+
+static void test_announce_body() {
+    AnnounceRequest request;
+    request.info_hash = "0123456789abcdef0123456789abcdef01234567";
+    request.peer_id = "-BT0001-short";
+    request.port = 51413;
+    request.uploaded = 3;
+    request.downloaded = 0x100000000LL;
+    request.left = 7;
+    request.event = AnnounceEvent::Started;
+    request.num_want = 50;
+
+    std::string body = build_udp_announce_body(request);
+    CHECK(body.size() == 82); // A 98-byte announce minus connection_id, action and transaction_id
+    CHECK(body.substr(0, 20) == hex_to_binary(request.info_hash));
+    CHECK(body.substr(20, 20) == std::string("-BT0001-short") + std::string(7, '\0'));
+    CHECK(read_big_endian(body, 40, 8) == 0x100000000ULL);
+    CHECK(read_big_endian(body, 48, 8) == 7);
+    CHECK(read_big_endian(body, 56, 8) == 3);
+    CHECK(read_big_endian(body, 64, 4) == 2);
+    CHECK(read_big_endian(body, 68, 4) == 0);
+    CHECK(read_big_endian(body, 76, 4) == 50);
+    CHECK(read_big_endian(body, 80, 2) == 51413);
+}
+
+static void test_announce_reply() {
+    std::string reply;
+    append_big_endian(reply, 1800, 4);
+    append_big_endian(reply, 3, 4);
+    append_big_endian(reply, 9, 4);
+    reply += std::string("\x7f\x00\x00\x01\x1a\xe1", 6);
+    reply += std::string("\x0a\x00\x00\x02\x00\x50", 6);
+
+    AnnounceResponse response;
+    CHECK(parse_udp_announce_reply(reply, AF_INET, response));
+    CHECK(response.interval == 1800 && response.leechers == 3 && response.seeders == 9);
+    CHECK(response.peers.size() == 2);
+    if(response.peers.size() == 2) {
+        CHECK(format_peer_endpoint(response.peers[0]) == "127.0.0.1:6881");
+        CHECK(format_peer_endpoint(response.peers[1]) == "10.0.0.2:80");
+    }
+
+    std::string reply6 = reply.substr(0, 12);
+    reply6 += std::string(15, '\0') + "\x01" + std::string("\x1a\xe1", 2);
+    AnnounceResponse response6;
+    CHECK(parse_udp_announce_reply(reply6, AF_INET6, response6));
+    CHECK(response6.peers.size() == 1 && format_peer_endpoint(response6.peers[0]) == "[::1]:6881");
+
+    AnnounceResponse truncated;
+    CHECK(!parse_udp_announce_reply(reply.substr(0, 11), AF_INET, truncated));
+}
+
+// Scripted tracker: answers one connect and one announce, checking the request layout as it goes
+static void serve_one_announce(int tracker_socket, bool& requests_valid) {
+    const uint64_t connection_id = 0x1122334455667788ULL;
+    char buffer[2048];
+    sockaddr_storage from;
+    socklen_t from_length = sizeof(from);
+
+    ssize_t length = recvfrom(tracker_socket, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&from), &from_length);
+    std::string connect_request(buffer, std::max<ssize_t>(length, 0));
+    requests_valid = connect_request.size() == 16 && read_big_endian(connect_request, 0, 8) == 0x41727101980ULL &&
+                     read_big_endian(connect_request, 8, 4) == 0;
+
+    std::string connect_reply;
+    append_big_endian(connect_reply, 0, 4);
+    connect_reply += connect_request.substr(12, 4);
+    append_big_endian(connect_reply, connection_id, 8);
+    sendto(tracker_socket, connect_reply.data(), connect_reply.size(), 0, reinterpret_cast<sockaddr*>(&from), from_length);
+
+    length = recvfrom(tracker_socket, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&from), &from_length);
+    std::string announce_request(buffer, std::max<ssize_t>(length, 0));
+    requests_valid = requests_valid && announce_request.size() == 98 && read_big_endian(announce_request, 0, 8) == connection_id &&
+                     read_big_endian(announce_request, 8, 4) == 1;
+
+    std::string announce_reply;
+    append_big_endian(announce_reply, 1, 4);
+    announce_reply += announce_request.substr(12, 4);
+    append_big_endian(announce_reply, 900, 4);
+    append_big_endian(announce_reply, 1, 4);
+    append_big_endian(announce_reply, 2, 4);
+    announce_reply += std::string("\x7f\x00\x00\x01\x1b\x58", 6);
+    sendto(tracker_socket, announce_reply.data(), announce_reply.size(), 0, reinterpret_cast<sockaddr*>(&from), from_length);
+}
+
+static void test_announce_exchange() {
+    int tracker_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t address_length = sizeof(address);
+    CHECK(bind(tracker_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+    getsockname(tracker_socket, reinterpret_cast<sockaddr*>(&address), &address_length);
+
+    bool requests_valid = false;
+    std::thread tracker(serve_one_announce, tracker_socket, std::ref(requests_valid));
+
+    AnnounceRequest request;
+    request.tracker_url = "udp://127.0.0.1:" + std::to_string(ntohs(address.sin_port)) + "/announce";
+    request.info_hash = "0123456789abcdef0123456789abcdef01234567";
+    request.peer_id = "-BT0001-000000000000";
+    AnnounceResponse response;
+    CHECK(udp_announce(request, response));
+
+    tracker.join();
+    close(tracker_socket);
+    CHECK(requests_valid);
+    CHECK(response.interval == 900 && response.leechers == 1 && response.seeders == 2);
+    CHECK(response.peers.size() == 1 && format_peer_endpoint(response.peers[0]) == "127.0.0.1:7000");
+}
+
+static void test_silent_tracker_budget() {
+    int tracker_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t address_length = sizeof(address);
+    CHECK(bind(tracker_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+    getsockname(tracker_socket, reinterpret_cast<sockaddr*>(&address), &address_length);
+
+    AnnounceRequest request;
+    request.tracker_url = "udp://127.0.0.1:" + std::to_string(ntohs(address.sin_port)) + "/announce";
+    request.info_hash = "0123456789abcdef0123456789abcdef01234567";
+    request.peer_id = "-BT0001-000000000000";
+
+    // A tracker that never answers fails the batch once the short budget is spent: 100 + 200 ms for the connect
+    UdpTrackerConfig config;
+    config.base_timeout_ms = 100;
+    config.max_retransmits = 1;
+    std::vector<AnnounceResponse> responses;
+    auto start = std::chrono::steady_clock::now();
+    CHECK(!udp_announce_batch({request}, responses, config)[0]);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    CHECK(elapsed >= std::chrono::milliseconds(250) && elapsed < std::chrono::seconds(2));
+
+    close(tracker_socket);
+}
+
+int main() {
+    test_parse_url();
+    test_announce_body();
+    test_announce_reply();
+    test_announce_exchange();
+    test_silent_tracker_budget();
+    return test_result();
+}
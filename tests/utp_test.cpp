@@ -0,0 +1,144 @@
+// Tests for uTP over loopback: a stream sent through one context arrives intact at another that accepts it, and
+// the FIN closing it reaches the peer even when its first transmission is lost
+
+#include "TestFunctions.h"
+#include "../src/EventLoopFunctions.h"
+#include "../src/UtpFunctions.h"
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+// Relay between the client and the server that drops the first FIN from the client, so it must be sent again
+struct FinDropRelay {
+    int socket = -1;
+    sockaddr_in server = {};
+    sockaddr_storage client = {};
+    socklen_t client_length = 0;
+    bool fin_dropped = false;
+};
+
+// Helper function to get a loopback endpoint for a port
+static PeerEndpoint loopback_endpoint(int port) {
+    PeerEndpoint endpoint;
+    CHECK(parse_peer_endpoint("127.0.0.1:" + std::to_string(port), endpoint));
+    return endpoint;
+}
+
+// Helper function to forward every datagram waiting at the relay to the other side
+static void forward_datagrams(FinDropRelay& relay) {
+    char buffer[2048];
+    for(;;) {
+        sockaddr_storage from;
+        socklen_t from_length = sizeof(from);
+        ssize_t length = recvfrom(relay.socket, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&from), &from_length);
+        if(length <= 0) return;
+
+        bool from_server = reinterpret_cast<sockaddr_in*>(&from)->sin_port == relay.server.sin_port;
+        if(from_server) {
+            sendto(relay.socket, buffer, length, 0, reinterpret_cast<sockaddr*>(&relay.client), relay.client_length);
+            continue;
+        }
+
+        relay.client = from;
+        relay.client_length = from_length;
+        if((static_cast<uint8_t>(buffer[0]) >> 4) == 1 && !relay.fin_dropped) { // ST_FIN
+            relay.fin_dropped = true;
+            continue;
+        }
+        sendto(relay.socket, buffer, length, 0, reinterpret_cast<sockaddr*>(&relay.server), sizeof(relay.server));
+    }
+}
+
+// Helper function to send 'data' from a client context to an accepting server context and close the stream,
+// optionally through the FIN-dropping relay; returns once the server has seen the end of the stream or time is up
+static void run_transfer(const std::string& data, bool through_relay) {
+    EventLoop loop;
+    CHECK(create_event_loop(loop));
+    UtpContext* server = create_utp_context(loop);
+    UtpContext* client = create_utp_context(loop);
+    CHECK(server && client);
+    if(!server || !client) return;
+
+    std::string received;
+    bool end_of_stream = false;
+    std::string close_reason = "not closed";
+    server->on_accept = [&](UtpSocket& socket) {
+        socket.on_data = [&](const char* bytes, size_t length) { received.append(bytes, length); };
+        socket.on_close = [&](const std::string& reason) {
+            end_of_stream = true;
+            close_reason = reason;
+        };
+    };
+
+    FinDropRelay relay;
+    int target_port = utp_context_port(*server);
+    if(through_relay) {
+        relay.socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        relay.server.sin_family = AF_INET;
+        relay.server.sin_port = htons(target_port);
+        relay.server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        sockaddr_in address = relay.server;
+        address.sin_port = 0;
+        socklen_t address_length = sizeof(address);
+        CHECK(bind(relay.socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+        getsockname(relay.socket, reinterpret_cast<sockaddr*>(&address), &address_length);
+        target_port = ntohs(address.sin_port);
+        event_loop_add(loop, relay.socket, EPOLLIN, [&relay](uint32_t) { forward_datagrams(relay); });
+    }
+
+    UtpSocket* connection = utp_connect(*client, loopback_endpoint(target_port));
+    CHECK(connection != nullptr);
+    bool connected = false;
+    connection->on_connect = [&] { connected = true; };
+
+    size_t written = 0;
+    bool closed = false;
+    auto deadline = Clock::now() + std::chrono::seconds(20);
+    while(!end_of_stream && Clock::now() < deadline) {
+        run_event_loop_once(loop, std::min(utp_context_timeout_ms(*server, 50), utp_context_timeout_ms(*client, 50)));
+
+        // Keep a bounded backlog queued, and close once everything has been written
+        if(connected && written < data.size() && connection->send_pending.size() < 256 * 1024) {
+            size_t length = std::min<size_t>(64 * 1024, data.size() - written);
+            utp_write(*connection, data.data() + written, length);
+            written += length;
+        }
+        if(connected && !closed && written == data.size() && connection->send_pending.empty() && connection->outgoing.empty()) {
+            utp_close(*connection);
+            closed = true;
+        }
+
+        utp_context_tick(*client);
+        utp_context_tick(*server);
+    }
+
+    CHECK(end_of_stream && close_reason.empty());
+    CHECK(received == data);
+    CHECK(!through_relay || relay.fin_dropped);
+
+    // The client frees its socket once the FIN is acknowledged
+    for(int i = 0; i < 100 && !client->sockets.empty(); ++i) {
+        run_event_loop_once(loop, 10);
+        utp_context_tick(*client);
+        utp_context_tick(*server);
+    }
+    CHECK(client->sockets.empty());
+
+    destroy_utp_context(client);
+    destroy_utp_context(server);
+    if(relay.socket != -1) {
+        event_loop_remove(loop, relay.socket);
+        close(relay.socket);
+    }
+    destroy_event_loop(loop);
+}
+
+int main() {
+    std::string data(2 * 1024 * 1024, '\0');
+    for(size_t i = 0; i < data.size(); ++i) data[i] = static_cast<char>(i * 7 + i / 1000);
+
+    run_transfer(data, false);
+    run_transfer(data.substr(0, 100000), true);
+    return test_result();
+}
@@ -0,0 +1,522 @@
+// Local HTTP/UDP tracker for exercising and benchmarking the tracker client offline.
+//
+//   mock_tracker serve [--http-port N] [--udp-port N] [--peers N] [--peers6 N] [--peer ip:port]...
+//                      [--interval S] [--min-interval S] [--non-compact] [--fail-rate F]
+//                      [--drop-rate F] [--latency-ms N] [--duration S]
+//   mock_tracker load <announce_url> [--announces N] [--concurrency N]
+
+#include "../src/InfoFunctions.h"
+#include "../src/PeerFunctions.h"
+#include "../src/UdpTrackerFunctions.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <netinet/in.h>
+#include <poll.h>
+
+// Behaviour of the mock tracker, set from the command line
+struct MockTrackerConfig {
+    int http_port = 8080;
+    int udp_port = 6969;
+    int generated_peers = 50;
+    int generated_peers6 = 0;
+    std::vector<PeerEndpoint> fixed_peers;
+    int64_t interval = 1800;
+    int64_t min_interval = 0;
+    bool non_compact = false;
+    double fail_rate = 0.0;
+    double drop_rate = 0.0;
+    int latency_ms = 0;
+    int duration_s = 0;
+};
+
+static std::atomic<int64_t> announces_served{0};
+static std::atomic<int64_t> scrapes_served{0};
+static std::atomic<int64_t> failures_served{0};
+
+static bool roll(double probability) {
+    static thread_local std::mt19937 generator(std::random_device{}());
+    return std::uniform_real_distribution<double>(0.0, 1.0)(generator) < probability;
+}
+
+// Helper function to build the peer list: explicit peers first, then generated 10.x.y.z / fd00:: addresses
+static std::vector<PeerEndpoint> build_peer_list(const MockTrackerConfig& config) {
+    std::vector<PeerEndpoint> peers = config.fixed_peers;
+
+    for(int i = 0; i < config.generated_peers; ++i) {
+        PeerEndpoint peer = {};
+        peer.address.v4.sin_family = AF_INET;
+        peer.address.v4.sin_addr.s_addr = htonl((10u << 24) | static_cast<uint32_t>(i + 1));
+        peer.address.v4.sin_port = htons(6881 + i % 100);
+        peers.push_back(peer);
+    }
+
+    for(int i = 0; i < config.generated_peers6; ++i) {
+        PeerEndpoint peer = {};
+        peer.address.v6.sin6_family = AF_INET6;
+        peer.address.v6.sin6_addr.s6_addr[0] = 0xfd;
+        peer.address.v6.sin6_addr.s6_addr[14] = static_cast<uint8_t>((i + 1) >> 8);
+        peer.address.v6.sin6_addr.s6_addr[15] = static_cast<uint8_t>(i + 1);
+        peer.address.v6.sin6_port = htons(6881 + i % 100);
+        peers.push_back(peer);
+    }
+
+    return peers;
+}
+
+// Helper function to pack peers of one address family in compact form
+static std::string compact_peers(const std::vector<PeerEndpoint>& peers, int family) {
+    std::string compact;
+
+    for(const auto& peer : peers) {
+        if(peer.family() != family) continue;
+
+        if(family == AF_INET6) {
+            compact.append(reinterpret_cast<const char*>(&peer.address.v6.sin6_addr), 16);
+            compact.append(reinterpret_cast<const char*>(&peer.address.v6.sin6_port), 2);
+        }
+        else {
+            compact.append(reinterpret_cast<const char*>(&peer.address.v4.sin_addr), 4);
+            compact.append(reinterpret_cast<const char*>(&peer.address.v4.sin_port), 2);
+        }
+    }
+
+    return compact;
+}
+
+// Helper function to percent-decode a query string value
+static std::string url_decode(const std::string& value) {
+    std::string decoded;
+
+    for(size_t i = 0; i < value.size(); ++i) {
+        if(value[i] == '%' && i + 2 < value.size()) {
+            decoded.push_back(static_cast<char>(std::stoi(value.substr(i + 1, 2), nullptr, 16)));
+            i += 2;
+        }
+        else {
+            decoded.push_back(value[i] == '+' ? ' ' : value[i]);
+        }
+    }
+
+    return decoded;
+}
+
+// Function to answer one HTTP announce or scrape with a bencoded body
+static std::string handle_http_request(const MockTrackerConfig& config, const std::vector<PeerEndpoint>& peers, const std::string& target) {
+    size_t question_index = target.find('?');
+    std::string path = target.substr(0, question_index);
+    std::string query = question_index == std::string::npos ? "" : target.substr(question_index + 1);
+
+    std::vector<std::pair<std::string, std::string>> parameters;
+    std::istringstream query_stream(query);
+    std::string pair;
+    while(std::getline(query_stream, pair, '&')) {
+        size_t equals_index = pair.find('=');
+        if(equals_index != std::string::npos) {
+            parameters.push_back({pair.substr(0, equals_index), url_decode(pair.substr(equals_index + 1))});
+        }
+    }
+
+    json reply = json::object();
+
+    if(roll(config.fail_rate)) {
+        ++failures_served;
+        reply["failure reason"] = "mock tracker injected failure";
+        return bencode(reply);
+    }
+
+    if(path.ends_with("/scrape")) {
+        ++scrapes_served;
+        json files = json::object();
+        for(const auto& [key, value] : parameters) {
+            if(key == "info_hash") {
+                files[value] = {{"complete", static_cast<int64_t>(peers.size())}, {"downloaded", 0}, {"incomplete", 0}};
+            }
+        }
+        reply["files"] = files;
+        return bencode(reply);
+    }
+
+    ++announces_served;
+    bool compact = !config.non_compact;
+    for(const auto& [key, value] : parameters) {
+        if(key == "compact" && value == "0") compact = false;
+    }
+
+    reply["interval"] = config.interval;
+    if(config.min_interval > 0) reply["min interval"] = config.min_interval;
+    reply["complete"] = static_cast<int64_t>(peers.size());
+    reply["incomplete"] = 0;
+
+    if(compact) {
+        reply["peers"] = compact_peers(peers, AF_INET);
+        std::string peers6 = compact_peers(peers, AF_INET6);
+        if(!peers6.empty()) reply["peers6"] = peers6;
+    }
+    else {
+        json peer_list = json::array();
+        for(const auto& peer : peers) {
+            std::string formatted = format_peer_endpoint(peer);
+            size_t colon_index = formatted.rfind(':');
+            std::string ip = formatted.substr(0, colon_index);
+            if(ip.front() == '[') ip = ip.substr(1, ip.size() - 2);
+            peer_list.push_back({{"ip", ip}, {"port", std::stoll(formatted.substr(colon_index + 1))}});
+        }
+        reply["peers"] = peer_list;
+    }
+
+    return bencode(reply);
+}
+
+// Function to serve one HTTP connection: read the request head, reply, close
+static void serve_http_connection(const MockTrackerConfig& config, const std::vector<PeerEndpoint>& peers, int client_socket) {
+    std::string request;
+    char buffer[4096];
+
+    while(request.find("\r\n\r\n") == std::string::npos && request.size() < 65536) {
+        ssize_t bytes_received = recv(client_socket, buffer, sizeof(buffer), 0);
+        if(bytes_received <= 0) {
+            close(client_socket);
+            return;
+        }
+        request.append(buffer, bytes_received);
+    }
+
+    // Request line: "GET <target> HTTP/1.1"
+    size_t first_space = request.find(' ');
+    size_t second_space = request.find(' ', first_space + 1);
+    std::string target = request.substr(first_space + 1, second_space - first_space - 1);
+
+    if(config.latency_ms > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(config.latency_ms));
+    }
+
+    std::string body = handle_http_request(config, peers, target);
+    std::string response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(body.size()) +
+                           "\r\nConnection: close\r\n\r\n" + body;
+
+    size_t total_sent = 0;
+    while(total_sent < response.size()) {
+        ssize_t bytes_sent = send(client_socket, response.data() + total_sent, response.size() - total_sent, MSG_NOSIGNAL);
+        if(bytes_sent <= 0) break;
+        total_sent += bytes_sent;
+    }
+
+    close(client_socket);
+}
+
+// Function to accept HTTP connections, one thread per connection so latency injection doesn't serialise clients
+static void run_http_server(const MockTrackerConfig& config, const std::vector<PeerEndpoint>& peers) {
+    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(config.http_port);
+
+    if(bind(server_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 || listen(server_socket, 1024) == -1) {
+        std::cerr << "Failed to listen on HTTP port " << config.http_port << ": " << strerror(errno) << std::endl;
+        close(server_socket);
+        return;
+    }
+
+    std::cout << "HTTP tracker on http://127.0.0.1:" << config.http_port << "/announce" << std::endl;
+
+    while(true) {
+        int client_socket = accept(server_socket, nullptr, nullptr);
+        if(client_socket == -1) continue;
+
+        std::thread(serve_http_connection, std::cref(config), std::cref(peers), client_socket).detach();
+    }
+}
+
+// Helper function to write a big-endian 32-bit integer into a packet
+static void append_be32(std::string& packet, uint32_t value) {
+    value = htonl(value);
+    packet.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Function to answer one UDP tracker datagram; returns an empty string for datagrams to ignore
+static std::string handle_udp_datagram(const MockTrackerConfig& config, const std::vector<PeerEndpoint>& peers, const char* datagram, size_t length, int family) {
+    if(length < 16) return "";
+
+    uint32_t action, transaction_id;
+    memcpy(&action, datagram + 8, 4);
+    memcpy(&transaction_id, datagram + 12, 4);
+    action = ntohl(action);
+
+    std::string reply;
+
+    if(action != 0 && roll(config.fail_rate)) {
+        ++failures_served;
+        append_be32(reply, 3);
+        reply.append(reinterpret_cast<const char*>(&transaction_id), 4);
+        reply += "mock tracker injected failure";
+        return reply;
+    }
+
+    append_be32(reply, action);
+    reply.append(reinterpret_cast<const char*>(&transaction_id), 4);
+
+    if(action == 0) {
+        // Connect: hand out a fixed connection ID; the mock accepts any ID afterwards
+        append_be32(reply, 0x4d4f434b);
+        append_be32(reply, 0x54524b52);
+    }
+    else if(action == 1 && length >= 98) {
+        ++announces_served;
+        append_be32(reply, static_cast<uint32_t>(config.interval));
+        append_be32(reply, 0);
+        append_be32(reply, static_cast<uint32_t>(peers.size()));
+        reply += compact_peers(peers, family);
+    }
+    else if(action == 2) {
+        ++scrapes_served;
+        for(size_t i = 16; i + 20 <= length; i += 20) {
+            append_be32(reply, static_cast<uint32_t>(peers.size()));
+            append_be32(reply, 0);
+            append_be32(reply, 0);
+        }
+    }
+    else {
+        return "";
+    }
+
+    return reply;
+}
+
+// Reply held back for latency injection
+struct DelayedDatagram {
+    std::chrono::steady_clock::time_point send_at;
+    std::string payload;
+    sockaddr_storage address;
+    socklen_t address_length;
+
+    bool operator>(const DelayedDatagram& other) const { return send_at > other.send_at; }
+};
+
+// Function to serve the UDP tracker protocol on one socket, delaying replies through a timer queue
+static void run_udp_server(const MockTrackerConfig& config, const std::vector<PeerEndpoint>& peers) {
+    int server_socket = socket(AF_INET, SOCK_DGRAM, 0);
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(config.udp_port);
+
+    if(bind(server_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1) {
+        std::cerr << "Failed to bind UDP port " << config.udp_port << ": " << strerror(errno) << std::endl;
+        close(server_socket);
+        return;
+    }
+
+    std::cout << "UDP tracker on udp://127.0.0.1:" << config.udp_port << "/announce" << std::endl;
+
+    std::priority_queue<DelayedDatagram, std::vector<DelayedDatagram>, std::greater<DelayedDatagram>> delayed;
+    char datagram[2048];
+
+    while(true) {
+        int timeout_ms = -1;
+        if(!delayed.empty()) {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(delayed.top().send_at - std::chrono::steady_clock::now()).count();
+            timeout_ms = static_cast<int>(std::max<int64_t>(wait, 0));
+        }
+
+        pollfd poll_fd = {server_socket, POLLIN, 0};
+        if(poll(&poll_fd, 1, timeout_ms) > 0) {
+            DelayedDatagram reply;
+            reply.address_length = sizeof(reply.address);
+            ssize_t received = recvfrom(server_socket, datagram, sizeof(datagram), 0, reinterpret_cast<sockaddr*>(&reply.address), &reply.address_length);
+
+            if(received > 0 && !roll(config.drop_rate)) {
+                reply.payload = handle_udp_datagram(config, peers, datagram, received, AF_INET);
+                reply.send_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(config.latency_ms);
+                if(!reply.payload.empty()) delayed.push(reply);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        while(!delayed.empty() && delayed.top().send_at <= now) {
+            const DelayedDatagram& reply = delayed.top();
+            sendto(server_socket, reply.payload.data(), reply.payload.size(), 0, reinterpret_cast<const sockaddr*>(&reply.address), reply.address_length);
+            delayed.pop();
+        }
+    }
+}
+
+// Helper function to print a latency percentile from sorted samples
+static void print_percentile(const std::vector<double>& sorted_ms, double percentile) {
+    size_t index = std::min(sorted_ms.size() - 1, static_cast<size_t>(percentile / 100.0 * sorted_ms.size()));
+    std::cout << "  p" << percentile << ": " << sorted_ms[index] << " ms" << std::endl;
+}
+
+// Function to fire 'announces' announces at a tracker with 'concurrency' in flight and report throughput/latency.
+// HTTP uses one blocking client per worker thread; UDP sends 'concurrency' announces per batch through one socket.
+static int run_load_test(const std::string& tracker_url, int announces, int concurrency) {
+    curl_global_init(CURL_GLOBAL_ALL);
+    udp_tracker_config().base_timeout_ms = 1000; // Fail fast instead of BEP 15's 15 s first retransmit
+
+    std::vector<AnnounceRequest> requests(announces);
+    for(int i = 0; i < announces; ++i) {
+        char info_hash[41];
+        snprintf(info_hash, sizeof(info_hash), "%040x", i);
+        requests[i].tracker_url = tracker_url;
+        requests[i].info_hash = info_hash;
+        requests[i].peer_id = "-MT0001-000000000000";
+        requests[i].left = 1;
+    }
+
+    std::vector<double> latencies_ms;
+    std::mutex latencies_mutex;
+    std::atomic<int> succeeded{0};
+    auto start = std::chrono::steady_clock::now();
+
+    if(tracker_url.rfind("udp://", 0) == 0) {
+        for(int first = 0; first < announces; first += concurrency) {
+            std::vector<AnnounceRequest> batch(requests.begin() + first, requests.begin() + std::min(announces, first + concurrency));
+            std::vector<AnnounceResponse> responses;
+
+            auto batch_start = std::chrono::steady_clock::now();
+            std::vector<bool> results = udp_announce_batch(batch, responses);
+            double batch_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batch_start).count();
+
+            for(bool result : results) {
+                succeeded += result;
+                latencies_ms.push_back(batch_ms);
+            }
+        }
+    }
+    else {
+        std::atomic<int> next_request{0};
+        std::vector<std::thread> workers;
+
+        for(int w = 0; w < concurrency; ++w) {
+            workers.emplace_back([&]() {
+                for(int i = next_request++; i < announces; i = next_request++) {
+                    AnnounceResponse response;
+                    auto request_start = std::chrono::steady_clock::now();
+                    bool result = http_announce(requests[i], response);
+                    double request_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - request_start).count();
+
+                    succeeded += result;
+                    std::lock_guard<std::mutex> lock(latencies_mutex);
+                    latencies_ms.push_back(request_ms);
+                }
+            });
+        }
+
+        for(auto& worker : workers) worker.join();
+    }
+
+    double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::sort(latencies_ms.begin(), latencies_ms.end());
+
+    std::cout << "Announces: " << announces << " (" << succeeded << " succeeded) in " << elapsed_s << " s" << std::endl;
+    std::cout << "Throughput: " << announces / elapsed_s << " announces/s" << std::endl;
+    std::cout << "Latency:" << std::endl;
+    if(!latencies_ms.empty()) {
+        print_percentile(latencies_ms, 50);
+        print_percentile(latencies_ms, 90);
+        print_percentile(latencies_ms, 99);
+        std::cout << "  max: " << latencies_ms.back() << " ms" << std::endl;
+    }
+
+    curl_global_cleanup();
+    return succeeded == announces ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    std::cout << std::unitbuf;
+    std::cerr << std::unitbuf;
+
+    if(argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " serve [options] | load <announce_url> [--announces N] [--concurrency N]" << std::endl;
+        return 1;
+    }
+
+    std::string command = argv[1];
+
+    if(command == "load") {
+        if(argc < 3) {
+            std::cerr << "Usage: " << argv[0] << " load <announce_url> [--announces N] [--concurrency N]" << std::endl;
+            return 1;
+        }
+
+        int announces = 1000;
+        int concurrency = 32;
+        for(int i = 3; i + 1 < argc; i += 2) {
+            std::string option = argv[i];
+            if(option == "--announces") announces = std::stoi(argv[i + 1]);
+            else if(option == "--concurrency") concurrency = std::max(1, std::stoi(argv[i + 1]));
+            else {
+                std::cerr << "unknown option: " << option << std::endl;
+                return 1;
+            }
+        }
+
+        return run_load_test(argv[2], announces, concurrency);
+    }
+    else if(command == "serve") {
+        static MockTrackerConfig config; // Outlives the detached server threads
+
+        for(int i = 2; i < argc; ++i) {
+            std::string option = argv[i];
+            if(option == "--non-compact") {
+                config.non_compact = true;
+                continue;
+            }
+            if(i + 1 >= argc) {
+                std::cerr << "missing value for " << option << std::endl;
+                return 1;
+            }
+
+            std::string value = argv[++i];
+            if(option == "--http-port") config.http_port = std::stoi(value);
+            else if(option == "--udp-port") config.udp_port = std::stoi(value);
+            else if(option == "--peers") config.generated_peers = std::stoi(value);
+            else if(option == "--peers6") config.generated_peers6 = std::stoi(value);
+            else if(option == "--interval") config.interval = std::stoll(value);
+            else if(option == "--min-interval") config.min_interval = std::stoll(value);
+            else if(option == "--fail-rate") config.fail_rate = std::stod(value);
+            else if(option == "--drop-rate") config.drop_rate = std::stod(value);
+            else if(option == "--latency-ms") config.latency_ms = std::stoi(value);
+            else if(option == "--duration") config.duration_s = std::stoi(value);
+            else if(option == "--peer") {
+                PeerEndpoint peer;
+                if(!parse_peer_endpoint(value, peer)) return 1;
+                config.fixed_peers.push_back(peer);
+            }
+            else {
+                std::cerr << "unknown option: " << option << std::endl;
+                return 1;
+            }
+        }
+
+        static const std::vector<PeerEndpoint> peers = build_peer_list(config);
+
+        // Port 0 disables a protocol
+        if(config.http_port > 0) std::thread(run_http_server, std::cref(config), std::cref(peers)).detach();
+        if(config.udp_port > 0) std::thread(run_udp_server, std::cref(config), std::cref(peers)).detach();
+
+        if(config.duration_s > 0) {
+            std::this_thread::sleep_for(std::chrono::seconds(config.duration_s));
+        }
+        else {
+            while(true) std::this_thread::sleep_for(std::chrono::hours(24));
+        }
+
+        std::cout << "Served " << announces_served << " announces, " << scrapes_served << " scrapes, "
+                  << failures_served << " injected failures" << std::endl;
+    }
+    else {
+        std::cerr << "unknown command: " << command << std::endl;
+        return 1;
+    }
+
+    return 0;
+}